@@ -1,10 +1,92 @@
 #include "code_highlight.h"
 #include <string.h>
 
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define MARKYD_HAVE_X86_SIMD 1
+#endif
+
 #define MARKYD_SCAN_FLAG_BLOCK_COMMENT (1u << 0)
 #define MARKYD_SCAN_FLAG_JAVA_TEXT_BLOCK (1u << 1)
 #define MARKYD_SCAN_FLAG_PY_TRIPLE_SINGLE (1u << 2)
 #define MARKYD_SCAN_FLAG_PY_TRIPLE_DOUBLE (1u << 3)
+/* Generic scanner: quote byte of a string left open at the end of a line. */
+#define MARKYD_SCAN_STRING_SHIFT 8
+#define MARKYD_SCAN_STRING_MASK (0xFFu << MARKYD_SCAN_STRING_SHIFT)
+
+/* Byte classes compiled from MarkydLexerRules. */
+#define MARKYD_LEX_CLASS_IDENT_START (1u << 0)
+#define MARKYD_LEX_CLASS_IDENT (1u << 1)
+#define MARKYD_LEX_CLASS_DIGIT (1u << 2)
+#define MARKYD_LEX_CLASS_QUOTE (1u << 3)
+#define MARKYD_LEX_CLASS_MULTILINE (1u << 4)
+#define MARKYD_LEX_CLASS_RAW (1u << 5)
+#define MARKYD_LEX_CLASS_COMMENT (1u << 6)
+
+/* MarkydLexerRules flags: case-insensitive keywords, line comments only after
+ * a blank, 'ident lifetimes/labels, and 1'000'000 digit separators. */
+#define MARKYD_LEX_FOLD_KEYWORDS (1u << 0)
+#define MARKYD_LEX_COMMENT_AFTER_SPACE (1u << 1)
+#define MARKYD_LEX_QUOTE_LIFETIMES (1u << 2)
+#define MARKYD_LEX_QUOTE_DIGIT_SEPARATOR (1u << 3)
+
+/* Delimiter bytes a plain run can stop at, besides NUL and word bytes. */
+#define SCAN_RUN_MAX_STOPS 6
+/* Bytes checked one at a time before a run switches to vector blocks. */
+#define SCAN_RUN_SCALAR_BYTES 16
+/* [0-9] and [A-Z_a-z] as bits of the low and high halves of ASCII. */
+#define SCAN_WORD_BITS_LOW G_GUINT64_CONSTANT(0x03FF000000000000)
+#define SCAN_WORD_BITS_HIGH G_GUINT64_CONSTANT(0x07FFFFFE87FFFFFE)
+
+/* Unlabeled blocks: bytes sampled, languages compared and the hits needed
+ * before any guess is made. */
+#define CODE_GUESS_MAX_BYTES 4096
+#define CODE_GUESS_MAX_LANGUAGES 16
+#define CODE_GUESS_MIN_HITS 3
+/* Punctuation typical of code; text where it is at least this share of the
+ * visible bytes counts as fully code-like. */
+#define CODE_GUESS_SYMBOLS "{}()[];=:<>$|&"
+#define CODE_GUESS_SYMBOL_RATIO 0.05
+
+/* Open-addressed keyword slots per language; a power of two kept at more
+ * than twice the largest keyword set so probes stay short. */
+#define KEYWORD_TABLE_SLOTS 256
+/* Keywords longer than this are not supported by the length filter. */
+#define KEYWORD_MAX_LEN 31
+G_STATIC_ASSERT(KEYWORD_MAX_LEN < 32);
+G_STATIC_ASSERT((KEYWORD_TABLE_SLOTS & (KEYWORD_TABLE_SLOTS - 1)) == 0);
+
+typedef struct {
+  const gchar *keyword;
+  const gchar *tag_name;
+  gsize len;
+} KeywordSlot;
+
+struct _MarkydKeywordTable {
+  gsize ready;
+  guint32 length_mask; /* Bit n set when some keyword is n bytes long. */
+  KeywordSlot slots[KEYWORD_TABLE_SLOTS];
+};
+
+typedef struct {
+  const gchar *line_comment;
+  const gchar *alt_line_comment;
+  const gchar *block_comment_open;
+  const gchar *block_comment_close;
+  const gchar *quotes;           /* String and char delimiters. */
+  const gchar *multiline_quotes; /* Subset whose strings may span lines. */
+  const gchar *raw_quotes;       /* Subset without backslash escapes. */
+  const gchar *ident_extra;      /* Identifier bytes beyond [A-Za-z0-9_]. */
+  guint flags;                   /* MARKYD_LEX_* */
+} MarkydLexerRules;
+
+struct _MarkydLexer {
+  MarkydLexerRules rules;
+  gsize ready;
+  guint8 classes[256]; /* MARKYD_LEX_CLASS_* per byte; 0 is plain text. */
+  /* Classed bytes outside [A-Za-z0-9_], i.e. where a plain run ends. */
+  gchar stops[SCAN_RUN_MAX_STOPS + 1];
+};
 
 static const gchar *const c_kw_group_a[] = {
     "break", "case",   "continue", "default", "do",    "else",
@@ -76,6 +158,193 @@ static const MarkydKeywordGroup py_groups[] = {
     {MARKYD_TAG_CODE_KW_C, py_kw_group_c, G_N_ELEMENTS(py_kw_group_c)},
 };
 
+static const gchar *const cpp_kw_group_a[] = {
+    "break", "case", "catch", "continue", "co_await", "co_return", "co_yield",
+    "default", "do", "else", "for", "goto", "if", "return", "switch", "throw",
+    "try", "while",
+};
+
+static const gchar *const cpp_kw_group_b[] = {
+    "alignas", "alignof", "class", "concept", "const", "consteval", "constexpr",
+    "constinit", "const_cast", "decltype", "delete", "dynamic_cast", "enum",
+    "explicit", "export", "extern", "final", "friend", "inline", "mutable",
+    "namespace", "new", "noexcept", "operator", "override", "private",
+    "protected", "public", "register", "reinterpret_cast", "requires", "sizeof",
+    "static", "static_assert", "static_cast", "struct", "template", "this",
+    "thread_local", "typedef", "typeid", "typename", "union", "using",
+    "virtual", "volatile",
+};
+
+static const gchar *const cpp_kw_group_c[] = {
+    "auto", "bool", "char", "char8_t", "char16_t", "char32_t", "double",
+    "false", "float", "int", "long", "nullptr", "short", "signed", "true",
+    "unsigned", "void", "wchar_t",
+};
+
+static const MarkydKeywordGroup cpp_groups[] = {
+    {MARKYD_TAG_CODE_KW_A, cpp_kw_group_a, G_N_ELEMENTS(cpp_kw_group_a)},
+    {MARKYD_TAG_CODE_KW_B, cpp_kw_group_b, G_N_ELEMENTS(cpp_kw_group_b)},
+    {MARKYD_TAG_CODE_KW_C, cpp_kw_group_c, G_N_ELEMENTS(cpp_kw_group_c)},
+};
+
+static const gchar *const rust_kw_group_a[] = {
+    "async", "await", "break", "continue", "else", "for", "if", "in", "loop",
+    "match", "return", "while", "yield",
+};
+
+static const gchar *const rust_kw_group_b[] = {
+    "as", "const", "crate", "dyn", "enum", "extern", "fn", "impl", "let",
+    "macro_rules", "mod", "move", "mut", "pub", "ref", "self", "Self", "static",
+    "struct", "super", "trait", "type", "union", "unsafe", "use", "where",
+};
+
+static const gchar *const rust_kw_group_c[] = {
+    "bool", "Box", "char", "Err", "f32", "f64", "false", "i8", "i16", "i32",
+    "i64", "i128", "isize", "None", "Ok", "Option", "Result", "Some", "str",
+    "String", "true", "u8", "u16", "u32", "u64", "u128", "usize", "Vec",
+};
+
+static const MarkydKeywordGroup rust_groups[] = {
+    {MARKYD_TAG_CODE_KW_A, rust_kw_group_a, G_N_ELEMENTS(rust_kw_group_a)},
+    {MARKYD_TAG_CODE_KW_B, rust_kw_group_b, G_N_ELEMENTS(rust_kw_group_b)},
+    {MARKYD_TAG_CODE_KW_C, rust_kw_group_c, G_N_ELEMENTS(rust_kw_group_c)},
+};
+
+static const gchar *const go_kw_group_a[] = {
+    "break", "case", "continue", "default", "defer", "else", "fallthrough",
+    "for", "go", "goto", "if", "range", "return", "select", "switch",
+};
+
+static const gchar *const go_kw_group_b[] = {
+    "chan", "const", "func", "import", "interface", "map", "package", "struct",
+    "type", "var",
+};
+
+static const gchar *const go_kw_group_c[] = {
+    "any", "bool", "byte", "complex64", "complex128", "error", "false",
+    "float32", "float64", "int", "int8", "int16", "int32", "int64", "iota",
+    "nil", "rune", "string", "true", "uint", "uint8", "uint16", "uint32",
+    "uint64", "uintptr",
+};
+
+static const MarkydKeywordGroup go_groups[] = {
+    {MARKYD_TAG_CODE_KW_A, go_kw_group_a, G_N_ELEMENTS(go_kw_group_a)},
+    {MARKYD_TAG_CODE_KW_B, go_kw_group_b, G_N_ELEMENTS(go_kw_group_b)},
+    {MARKYD_TAG_CODE_KW_C, go_kw_group_c, G_N_ELEMENTS(go_kw_group_c)},
+};
+
+static const gchar *const js_kw_group_a[] = {
+    "await", "break", "case", "catch", "continue", "debugger", "default", "do",
+    "else", "finally", "for", "if", "in", "of", "return", "switch", "throw",
+    "try", "while", "with", "yield",
+};
+
+static const gchar *const js_kw_group_b[] = {
+    "async", "class", "const", "delete", "export", "extends", "function", "get",
+    "import", "instanceof", "let", "new", "set", "static", "super", "this",
+    "typeof", "var", "void",
+};
+
+static const gchar *const js_kw_group_c[] = {
+    "false", "Infinity", "NaN", "null", "true", "undefined",
+};
+
+static const MarkydKeywordGroup js_groups[] = {
+    {MARKYD_TAG_CODE_KW_A, js_kw_group_a, G_N_ELEMENTS(js_kw_group_a)},
+    {MARKYD_TAG_CODE_KW_B, js_kw_group_b, G_N_ELEMENTS(js_kw_group_b)},
+    {MARKYD_TAG_CODE_KW_C, js_kw_group_c, G_N_ELEMENTS(js_kw_group_c)},
+};
+
+static const gchar *const ts_kw_group_a[] = {
+    "await", "break", "case", "catch", "continue", "debugger", "default", "do",
+    "else", "finally", "for", "if", "in", "of", "return", "switch", "throw",
+    "try", "while", "with", "yield",
+};
+
+static const gchar *const ts_kw_group_b[] = {
+    "async", "class", "const", "delete", "export", "extends", "function", "get",
+    "import", "instanceof", "let", "new", "set", "static", "super", "this",
+    "typeof", "var", "void", "abstract", "as", "declare", "enum", "implements",
+    "infer", "interface", "is", "keyof", "module", "namespace", "private",
+    "protected", "public", "readonly", "satisfies", "type",
+};
+
+static const gchar *const ts_kw_group_c[] = {
+    "false", "Infinity", "NaN", "null", "true", "undefined", "any", "bigint",
+    "boolean", "never", "number", "object", "string", "symbol", "unknown",
+};
+
+static const MarkydKeywordGroup ts_groups[] = {
+    {MARKYD_TAG_CODE_KW_A, ts_kw_group_a, G_N_ELEMENTS(ts_kw_group_a)},
+    {MARKYD_TAG_CODE_KW_B, ts_kw_group_b, G_N_ELEMENTS(ts_kw_group_b)},
+    {MARKYD_TAG_CODE_KW_C, ts_kw_group_c, G_N_ELEMENTS(ts_kw_group_c)},
+};
+
+static const gchar *const sh_kw_group_a[] = {
+    "case", "do", "done", "elif", "else", "esac", "fi", "for", "if", "in",
+    "select", "then", "until", "while",
+};
+
+static const gchar *const sh_kw_group_b[] = {
+    "alias", "break", "continue", "declare", "eval", "exec", "export",
+    "function", "local", "readonly", "return", "set", "shift", "source", "trap",
+    "unset",
+};
+
+static const gchar *const sh_kw_group_c[] = {
+    "false", "true",
+};
+
+static const MarkydKeywordGroup sh_groups[] = {
+    {MARKYD_TAG_CODE_KW_A, sh_kw_group_a, G_N_ELEMENTS(sh_kw_group_a)},
+    {MARKYD_TAG_CODE_KW_B, sh_kw_group_b, G_N_ELEMENTS(sh_kw_group_b)},
+    {MARKYD_TAG_CODE_KW_C, sh_kw_group_c, G_N_ELEMENTS(sh_kw_group_c)},
+};
+
+static const gchar *const json_kw_group_c[] = {
+    "false", "null", "true",
+};
+
+static const MarkydKeywordGroup json_groups[] = {
+    {MARKYD_TAG_CODE_KW_C, json_kw_group_c, G_N_ELEMENTS(json_kw_group_c)},
+};
+
+static const gchar *const yaml_kw_group_c[] = {
+    "false", "False", "FALSE", "no", "No", "NO", "null", "Null", "NULL", "off",
+    "Off", "OFF", "on", "On", "ON", "true", "True", "TRUE", "yes", "Yes", "YES",
+};
+
+static const MarkydKeywordGroup yaml_groups[] = {
+    {MARKYD_TAG_CODE_KW_C, yaml_kw_group_c, G_N_ELEMENTS(yaml_kw_group_c)},
+};
+
+static const gchar *const sql_kw_group_a[] = {
+    "begin", "case", "commit", "else", "end", "if", "loop", "return",
+    "rollback", "then", "when", "while",
+};
+
+static const gchar *const sql_kw_group_b[] = {
+    "add", "all", "alter", "and", "as", "asc", "between", "by", "constraint",
+    "create", "cross", "default", "delete", "desc", "distinct", "drop",
+    "exists", "foreign", "from", "full", "grant", "group", "having", "index",
+    "inner", "insert", "into", "is", "join", "key", "left", "like", "limit",
+    "not", "offset", "on", "or", "order", "outer", "primary", "references",
+    "returning", "revoke", "right", "select", "set", "table", "truncate",
+    "union", "unique", "update", "using", "values", "view", "where", "with",
+};
+
+static const gchar *const sql_kw_group_c[] = {
+    "bigint", "boolean", "char", "date", "decimal", "double", "false", "float",
+    "int", "integer", "null", "numeric", "real", "serial", "smallint", "text",
+    "time", "timestamp", "true", "varchar",
+};
+
+static const MarkydKeywordGroup sql_groups[] = {
+    {MARKYD_TAG_CODE_KW_A, sql_kw_group_a, G_N_ELEMENTS(sql_kw_group_a)},
+    {MARKYD_TAG_CODE_KW_B, sql_kw_group_b, G_N_ELEMENTS(sql_kw_group_b)},
+    {MARKYD_TAG_CODE_KW_C, sql_kw_group_c, G_N_ELEMENTS(sql_kw_group_c)},
+};
+
 static gboolean is_ascii_identifier_char(gchar c) {
   return (c == '_') || g_ascii_isalnum((guchar)c);
 }
@@ -84,65 +353,353 @@ static gboolean starts_with_triple_quote(const gchar *p) {
   return p && p[0] == '"' && p[1] == '"' && p[2] == '"';
 }
 
-static gboolean is_identifier_start(gunichar c) {
-  return (c == '_') || (c < 128 && g_ascii_isalpha((gchar)c));
-}
-
-static gboolean is_identifier_char(gunichar c) {
-  return (c == '_') || (c < 128 && g_ascii_isalnum((gchar)c));
+static gboolean is_identifier_start(gchar c) {
+  return (c == '_') || g_ascii_isalpha((guchar)c);
 }
 
-static void advance_utf8_char(const gchar **p, gint *char_index) {
+static void advance_utf8_char(const gchar **p) {
   if (!p || !*p || !**p) {
     return;
   }
   *p = g_utf8_next_char(*p);
-  (*char_index)++;
 }
 
-static void skip_quoted_literal(const gchar **p, gint *char_index,
-                                gchar quote_char) {
+/* Bit per ASCII byte that ends a plain run; NUL always does. */
+typedef struct {
+  guint64 bits[2];
+} ScanStopSet;
+
+static void scan_stop_set_init(ScanStopSet *set, const gchar *stops,
+                               gboolean words) {
+  set->bits[0] = 1;
+  set->bits[1] = 0;
+  if (words) {
+    set->bits[0] |= SCAN_WORD_BITS_LOW;
+    set->bits[1] |= SCAN_WORD_BITS_HIGH;
+  }
+  for (; *stops; stops++) {
+    guchar c = (guchar)*stops;
+    set->bits[c >> 6] |= G_GUINT64_CONSTANT(1) << (c & 63);
+  }
+}
+
+static gboolean scan_stop_set_has(const ScanStopSet *set, guchar c) {
+  return c < 128 && ((set->bits[c >> 6] >> (c & 63)) & 1) != 0;
+}
+
+#ifdef MARKYD_HAVE_X86_SIMD
+/* Lines are NUL-terminated rather than sized, so blocks are loaded aligned:
+ * an aligned load never crosses a page, which makes reading the tail of the
+ * last block past the terminator safe. Lanes before p are masked off. */
+__attribute__((target("sse2"))) static __m128i word_lanes_sse2(__m128i v) {
+  __m128i lower = _mm_or_si128(v, _mm_set1_epi8(0x20));
+  __m128i alpha = _mm_and_si128(_mm_cmpgt_epi8(lower, _mm_set1_epi8('a' - 1)),
+                                _mm_cmplt_epi8(lower, _mm_set1_epi8('z' + 1)));
+  __m128i digit = _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8('0' - 1)),
+                                _mm_cmplt_epi8(v, _mm_set1_epi8('9' + 1)));
+
+  return _mm_or_si128(_mm_or_si128(alpha, digit),
+                      _mm_cmpeq_epi8(v, _mm_set1_epi8('_')));
+}
+
+__attribute__((target("sse2"))) static const gchar *
+skip_run_sse2(const gchar *p, const gchar *stops, gboolean words) {
+  guint offset = (guint)((guintptr)p & 15);
+  const __m128i *block = (const __m128i *)(p - offset);
+  guint valid = (0xFFFFu << offset) & 0xFFFFu;
+  __m128i needles[SCAN_RUN_MAX_STOPS + 1];
+  guint n = 0;
+
+  /* Unused needles stay NUL, which always ends a run anyway. */
+  for (; n < SCAN_RUN_MAX_STOPS && stops[n]; n++) {
+    needles[n] = _mm_set1_epi8(stops[n]);
+  }
+  for (; n <= SCAN_RUN_MAX_STOPS; n++) {
+    needles[n] = _mm_setzero_si128();
+  }
+
+  for (;; block++, valid = 0xFFFFu) {
+    __m128i v = _mm_load_si128(block);
+    __m128i hit = words ? word_lanes_sse2(v) : _mm_setzero_si128();
+    guint stop;
+
+    for (guint i = 0; i <= SCAN_RUN_MAX_STOPS; i++) {
+      hit = _mm_or_si128(hit, _mm_cmpeq_epi8(v, needles[i]));
+    }
+    stop = (guint)_mm_movemask_epi8(hit) & valid;
+    if (stop != 0) {
+      return (const gchar *)block + __builtin_ctz(stop);
+    }
+  }
+}
+
+__attribute__((target("sse2"))) static const gchar *
+skip_word_sse2(const gchar *p) {
+  guint offset = (guint)((guintptr)p & 15);
+  const __m128i *block = (const __m128i *)(p - offset);
+  guint valid = (0xFFFFu << offset) & 0xFFFFu;
+
+  for (;; block++, valid = 0xFFFFu) {
+    guint stop =
+        ~(guint)_mm_movemask_epi8(word_lanes_sse2(_mm_load_si128(block))) &
+        valid;
+
+    if (stop != 0) {
+      return (const gchar *)block + __builtin_ctz(stop);
+    }
+  }
+}
+
+__attribute__((target("sse2"))) static gboolean
+is_ascii_sse2(const gchar *text, gsize len) {
+  __m128i acc = _mm_setzero_si128();
+  gsize i = 0;
+
+  for (; i + 16 <= len; i += 16) {
+    acc = _mm_or_si128(acc, _mm_loadu_si128((const __m128i *)(text + i)));
+  }
+  if (_mm_movemask_epi8(acc) != 0) {
+    return FALSE;
+  }
+  for (; i < len; i++) {
+    if ((guchar)text[i] >= 0x80) {
+      return FALSE;
+    }
+  }
+  return TRUE;
+}
+
+__attribute__((target("avx2"))) static __m256i word_lanes_avx2(__m256i v) {
+  __m256i lower = _mm256_or_si256(v, _mm256_set1_epi8(0x20));
+  __m256i alpha =
+      _mm256_and_si256(_mm256_cmpgt_epi8(lower, _mm256_set1_epi8('a' - 1)),
+                       _mm256_cmpgt_epi8(_mm256_set1_epi8('z' + 1), lower));
+  __m256i digit =
+      _mm256_and_si256(_mm256_cmpgt_epi8(v, _mm256_set1_epi8('0' - 1)),
+                       _mm256_cmpgt_epi8(_mm256_set1_epi8('9' + 1), v));
+
+  return _mm256_or_si256(_mm256_or_si256(alpha, digit),
+                         _mm256_cmpeq_epi8(v, _mm256_set1_epi8('_')));
+}
+
+__attribute__((target("avx2"))) static const gchar *
+skip_run_avx2(const gchar *p, const gchar *stops, gboolean words) {
+  guint offset = (guint)((guintptr)p & 31);
+  const __m256i *block = (const __m256i *)(p - offset);
+  guint32 valid = 0xFFFFFFFFu << offset;
+  __m256i needles[SCAN_RUN_MAX_STOPS + 1];
+  guint n = 0;
+
+  for (; n < SCAN_RUN_MAX_STOPS && stops[n]; n++) {
+    needles[n] = _mm256_set1_epi8(stops[n]);
+  }
+  for (; n <= SCAN_RUN_MAX_STOPS; n++) {
+    needles[n] = _mm256_setzero_si256();
+  }
+
+  for (;; block++, valid = 0xFFFFFFFFu) {
+    __m256i v = _mm256_load_si256(block);
+    __m256i hit = words ? word_lanes_avx2(v) : _mm256_setzero_si256();
+    guint32 stop;
+
+    for (guint i = 0; i <= SCAN_RUN_MAX_STOPS; i++) {
+      hit = _mm256_or_si256(hit, _mm256_cmpeq_epi8(v, needles[i]));
+    }
+    stop = (guint32)_mm256_movemask_epi8(hit) & valid;
+    if (stop != 0) {
+      return (const gchar *)block + __builtin_ctz(stop);
+    }
+  }
+}
+
+__attribute__((target("avx2"))) static const gchar *
+skip_word_avx2(const gchar *p) {
+  guint offset = (guint)((guintptr)p & 31);
+  const __m256i *block = (const __m256i *)(p - offset);
+  guint32 valid = 0xFFFFFFFFu << offset;
+
+  for (;; block++, valid = 0xFFFFFFFFu) {
+    guint32 stop = ~(guint32)_mm256_movemask_epi8(
+                       word_lanes_avx2(_mm256_load_si256(block))) &
+                   valid;
+
+    if (stop != 0) {
+      return (const gchar *)block + __builtin_ctz(stop);
+    }
+  }
+}
+
+__attribute__((target("avx2"))) static gboolean
+is_ascii_avx2(const gchar *text, gsize len) {
+  __m256i acc = _mm256_setzero_si256();
+  gsize i = 0;
+
+  for (; i + 32 <= len; i += 32) {
+    acc = _mm256_or_si256(acc,
+                          _mm256_loadu_si256((const __m256i *)(text + i)));
+  }
+  if (_mm256_movemask_epi8(acc) != 0) {
+    return FALSE;
+  }
+  return is_ascii_sse2(text + i, len - i);
+}
+
+static gboolean scan_use_avx2(void) {
+  static gsize level = 0;
+
+  if (g_once_init_enter(&level)) {
+    __builtin_cpu_init();
+    g_once_init_leave(&level, __builtin_cpu_supports("avx2") ? 2 : 1);
+  }
+  return level == 2;
+}
+#endif
+
+/* Advance over a run of bytes that are not NUL, not in stops (ASCII) and,
+ * when words is set, not [A-Za-z0-9_]. Returns the first stop byte. */
+static const gchar *skip_plain_run(const gchar *p, const gchar *stops,
+                                   gboolean words) {
+  ScanStopSet set;
+
+  /* Most runs between tokens are a few bytes; only go wide past that. */
+  scan_stop_set_init(&set, stops, words);
+  for (guint i = 0; i < SCAN_RUN_SCALAR_BYTES; i++, p++) {
+    if (scan_stop_set_has(&set, (guchar)*p)) {
+      return p;
+    }
+  }
+#ifdef MARKYD_HAVE_X86_SIMD
+  if (scan_use_avx2()) {
+    return skip_run_avx2(p, stops, words);
+  }
+  return skip_run_sse2(p, stops, words);
+#else
+  while (!scan_stop_set_has(&set, (guchar)*p)) {
+    p++;
+  }
+  return p;
+#endif
+}
+
+/* End of the [A-Za-z0-9_] run starting at p. */
+static const gchar *skip_word_run(const gchar *p) {
+  for (guint i = 0; i < SCAN_RUN_SCALAR_BYTES; i++, p++) {
+    if (!is_ascii_identifier_char(*p)) {
+      return p;
+    }
+  }
+#ifdef MARKYD_HAVE_X86_SIMD
+  if (scan_use_avx2()) {
+    return skip_word_avx2(p);
+  }
+  return skip_word_sse2(p);
+#else
+  while (is_ascii_identifier_char(*p)) {
+    p++;
+  }
+  return p;
+#endif
+}
+
+static void skip_quoted_literal(const gchar **p, gchar quote_char) {
+  const gchar stops[] = {'\\', quote_char, '\0'};
+
   if (!p || !*p || !**p) {
     return;
   }
 
   /* Consume opening quote. */
   (*p)++;
-  (*char_index)++;
 
   while (**p) {
+    *p = skip_plain_run(*p, stops, FALSE);
     if ((*p)[0] == '\\') {
       (*p)++;
-      (*char_index)++;
       if (**p) {
         *p = g_utf8_next_char(*p);
-        (*char_index)++;
       }
       continue;
     }
     if ((*p)[0] == quote_char) {
       (*p)++;
-      (*char_index)++;
       break;
     }
-    advance_utf8_char(p, char_index);
+    advance_utf8_char(p);
   }
 }
 
-static const gchar *lookup_keyword_tag(const MarkydLanguageHighlight *language,
-                                       const gchar *token, gsize token_len) {
-  if (!language || !token || token_len == 0) {
-    return NULL;
+/* FNV-1a over the token bytes. */
+static guint32 keyword_hash(const gchar *token, gsize token_len) {
+  guint32 hash = 2166136261u;
+  for (gsize i = 0; i < token_len; i++) {
+    hash ^= (guchar)token[i];
+    hash *= 16777619u;
   }
+  return hash;
+}
+
+static void keyword_table_build(const MarkydLanguageHighlight *language) {
+  MarkydKeywordTable *table = language->keyword_table;
+  gsize count = 0;
 
   for (gsize i = 0; i < language->group_count; i++) {
     const MarkydKeywordGroup *group = &language->groups[i];
     for (gsize k = 0; k < group->keyword_count; k++) {
       const gchar *kw = group->keywords[k];
-      if (strlen(kw) == token_len && strncmp(kw, token, token_len) == 0) {
-        return group->tag_name;
+      gsize len = strlen(kw);
+      guint32 slot = keyword_hash(kw, len) & (KEYWORD_TABLE_SLOTS - 1);
+
+      /* Runs inside g_once: returning early would publish a partial table. */
+      if (len > KEYWORD_MAX_LEN || count >= KEYWORD_TABLE_SLOTS / 2) {
+        g_error("Keyword table for %s cannot hold \"%s\"", language->language,
+                kw);
+      }
+
+      /* Earlier groups win, matching the old first-match scan order. */
+      while (table->slots[slot].keyword &&
+             (table->slots[slot].len != len ||
+              memcmp(table->slots[slot].keyword, kw, len) != 0)) {
+        slot = (slot + 1) & (KEYWORD_TABLE_SLOTS - 1);
       }
+      if (table->slots[slot].keyword) {
+        continue;
+      }
+
+      table->slots[slot].keyword = kw;
+      table->slots[slot].tag_name = group->tag_name;
+      table->slots[slot].len = len;
+      table->length_mask |= 1u << len;
+      count++;
+    }
+  }
+}
+
+static const gchar *lookup_keyword_tag(const MarkydLanguageHighlight *language,
+                                       const gchar *token, gsize token_len) {
+  MarkydKeywordTable *table;
+  guint32 slot;
+
+  if (!language || !token || token_len == 0 || !language->keyword_table) {
+    return NULL;
+  }
+
+  table = language->keyword_table;
+  if (g_once_init_enter(&table->ready)) {
+    keyword_table_build(language);
+    g_once_init_leave(&table->ready, 1);
+  }
+
+  if (token_len > KEYWORD_MAX_LEN || !(table->length_mask & (1u << token_len))) {
+    return NULL;
+  }
+
+  slot = keyword_hash(token, token_len) & (KEYWORD_TABLE_SLOTS - 1);
+  while (table->slots[slot].keyword) {
+    if (table->slots[slot].len == token_len &&
+        memcmp(table->slots[slot].keyword, token, token_len) == 0) {
+      return table->slots[slot].tag_name;
     }
+    slot = (slot + 1) & (KEYWORD_TABLE_SLOTS - 1);
   }
 
   return NULL;
@@ -523,7 +1080,6 @@ static void scan_line_c_like(const MarkydLanguageHighlight *language,
                              gpointer user_data,
                              gboolean allow_java_text_blocks) {
   const gchar *p;
-  gint char_index = 0;
   gboolean in_block_comment = FALSE;
   gboolean in_java_text_block = FALSE;
 
@@ -539,28 +1095,28 @@ static void scan_line_c_like(const MarkydLanguageHighlight *language,
   p = line;
   while (*p) {
     if (allow_java_text_blocks && in_java_text_block) {
-      gint start_char_index = char_index;
+      gint start = (gint)(p - line);
       while (*p) {
+        p = skip_plain_run(p, "\"", FALSE);
         if (starts_with_triple_quote(p)) {
           p += 3;
-          char_index += 3;
           in_java_text_block = FALSE;
           break;
         }
-        advance_utf8_char(&p, &char_index);
+        advance_utf8_char(&p);
       }
-      on_token(start_char_index, char_index, MARKYD_TAG_CODE_LITERAL, user_data);
+      on_token(start, (gint)(p - line), MARKYD_TAG_CODE_LITERAL, user_data);
       continue;
     }
 
     if (in_block_comment) {
+      p = skip_plain_run(p, "*", FALSE);
       if (p[0] == '*' && p[1] == '/') {
         p += 2;
-        char_index += 2;
         in_block_comment = FALSE;
         continue;
       }
-      advance_utf8_char(&p, &char_index);
+      advance_utf8_char(&p);
       continue;
     }
 
@@ -569,76 +1125,59 @@ static void scan_line_c_like(const MarkydLanguageHighlight *language,
     }
     if (p[0] == '/' && p[1] == '*') {
       p += 2;
-      char_index += 2;
       in_block_comment = TRUE;
       continue;
     }
     if (allow_java_text_blocks && starts_with_triple_quote(p)) {
-      gint start_char_index = char_index;
+      gint start = (gint)(p - line);
       p += 3;
-      char_index += 3;
       in_java_text_block = TRUE;
       while (*p) {
+        p = skip_plain_run(p, "\"", FALSE);
         if (starts_with_triple_quote(p)) {
           p += 3;
-          char_index += 3;
           in_java_text_block = FALSE;
           break;
         }
-        advance_utf8_char(&p, &char_index);
+        advance_utf8_char(&p);
       }
-      on_token(start_char_index, char_index, MARKYD_TAG_CODE_LITERAL, user_data);
+      on_token(start, (gint)(p - line), MARKYD_TAG_CODE_LITERAL, user_data);
       continue;
     }
     if (p[0] == '"' || p[0] == '\'') {
-      gint start_char_index = char_index;
-      skip_quoted_literal(&p, &char_index, p[0]);
-      on_token(start_char_index, char_index, MARKYD_TAG_CODE_LITERAL, user_data);
+      gint start = (gint)(p - line);
+      skip_quoted_literal(&p, p[0]);
+      on_token(start, (gint)(p - line), MARKYD_TAG_CODE_LITERAL, user_data);
       continue;
     }
 
-    gunichar c = g_utf8_get_char(p);
-    const gchar *next = g_utf8_next_char(p);
-
-    if (is_identifier_start(c)) {
+    if (is_identifier_start(*p)) {
       const gchar *token_start = p;
-      gint start_char_index = char_index;
-
-      p = next;
-      char_index++;
 
-      while (*p) {
-        gunichar tc = g_utf8_get_char(p);
-        const gchar *tnext = g_utf8_next_char(p);
-        if (!is_identifier_char(tc)) {
-          break;
-        }
-        p = tnext;
-        char_index++;
-      }
+      p = skip_word_run(p);
 
       gsize token_len = (gsize)(p - token_start);
       const gchar *tag_name = lookup_keyword_tag(language, token_start, token_len);
       if (tag_name) {
-        on_token(start_char_index, char_index, tag_name, user_data);
+        on_token((gint)(token_start - line), (gint)(p - line), tag_name,
+                 user_data);
       }
 
       continue;
     }
 
     if (starts_number_c(line, p)) {
-      gint number_chars = scan_number_c(p);
-      if (number_chars > 0) {
-        on_token(char_index, char_index + number_chars, MARKYD_TAG_CODE_LITERAL,
-                 user_data);
-        p += number_chars;
-        char_index += number_chars;
+      gint number_len = scan_number_c(p);
+      if (number_len > 0) {
+        gint start = (gint)(p - line);
+        on_token(start, start + number_len, MARKYD_TAG_CODE_LITERAL, user_data);
+        p += number_len;
         continue;
       }
     }
 
-    p = next;
-    char_index++;
+    advance_utf8_char(&p);
+    p = skip_plain_run(p, "/\"'.", TRUE);
   }
 
   if (in_block_comment) {
@@ -671,7 +1210,6 @@ static void scan_line_python(const MarkydLanguageHighlight *language,
                              MarkydCodeTokenCallback on_token,
                              gpointer user_data) {
   const gchar *p;
-  gint char_index = 0;
   gboolean in_triple_single = FALSE;
   gboolean in_triple_double = FALSE;
 
@@ -685,21 +1223,22 @@ static void scan_line_python(const MarkydLanguageHighlight *language,
   p = line;
   while (*p) {
     if (in_triple_single || in_triple_double) {
-      gint start_char_index = char_index;
+      gint start = (gint)(p - line);
       gchar quote = in_triple_single ? '\'' : '"';
+      gchar stops[] = {quote, '\0'};
 
       while (*p) {
+        p = skip_plain_run(p, stops, FALSE);
         if (p[0] == quote && p[1] == quote && p[2] == quote) {
           p += 3;
-          char_index += 3;
           in_triple_single = FALSE;
           in_triple_double = FALSE;
           break;
         }
-        advance_utf8_char(&p, &char_index);
+        advance_utf8_char(&p);
       }
 
-      on_token(start_char_index, char_index, MARKYD_TAG_CODE_LITERAL, user_data);
+      on_token(start, (gint)(p - line), MARKYD_TAG_CODE_LITERAL, user_data);
       continue;
     }
 
@@ -715,24 +1254,23 @@ static void scan_line_python(const MarkydLanguageHighlight *language,
 
       if (parse_python_string_start(p, &prefix_len, &quote_char, &is_triple,
                                     &is_raw)) {
-        gint start_char_index = char_index;
+        gint start = (gint)(p - line);
 
         p += prefix_len;
-        char_index += prefix_len;
 
         if (is_triple) {
+          gchar stops[] = {quote_char, '\0'};
           gboolean closed = FALSE;
           p += 3;
-          char_index += 3;
 
           while (*p) {
+            p = skip_plain_run(p, stops, FALSE);
             if (p[0] == quote_char && p[1] == quote_char && p[2] == quote_char) {
               p += 3;
-              char_index += 3;
               closed = TRUE;
               break;
             }
-            advance_utf8_char(&p, &char_index);
+            advance_utf8_char(&p);
           }
 
           if (!closed) {
@@ -743,76 +1281,60 @@ static void scan_line_python(const MarkydLanguageHighlight *language,
             }
           }
         } else {
+          gchar stops[] = {'\\', quote_char, '\0'};
+
           /* Consume opening quote. */
           p++;
-          char_index++;
           while (*p) {
+            p = skip_plain_run(p, stops, FALSE);
             if (!is_raw && p[0] == '\\') {
               p++;
-              char_index++;
               if (*p) {
-                advance_utf8_char(&p, &char_index);
+                advance_utf8_char(&p);
               }
               continue;
             }
             if (p[0] == quote_char) {
               p++;
-              char_index++;
               break;
             }
-            advance_utf8_char(&p, &char_index);
+            advance_utf8_char(&p);
           }
         }
 
-        on_token(start_char_index, char_index, MARKYD_TAG_CODE_LITERAL,
+        on_token(start, (gint)(p - line), MARKYD_TAG_CODE_LITERAL,
                  user_data);
         continue;
       }
     }
 
-    {
-      gunichar c = g_utf8_get_char(p);
-      const gchar *next = g_utf8_next_char(p);
-
-      if (is_identifier_start(c)) {
-        const gchar *token_start = p;
-        gint start_char_index = char_index;
-
-        p = next;
-        char_index++;
+    if (is_identifier_start(*p)) {
+      const gchar *token_start = p;
 
-        while (*p) {
-          gunichar tc = g_utf8_get_char(p);
-          const gchar *tnext = g_utf8_next_char(p);
-          if (!is_identifier_char(tc)) {
-            break;
-          }
-          p = tnext;
-          char_index++;
-        }
+      p = skip_word_run(p);
 
-        gsize token_len = (gsize)(p - token_start);
-        const gchar *tag_name =
-            lookup_keyword_tag(language, token_start, token_len);
-        if (tag_name) {
-          on_token(start_char_index, char_index, tag_name, user_data);
-        }
-        continue;
+      gsize token_len = (gsize)(p - token_start);
+      const gchar *tag_name =
+          lookup_keyword_tag(language, token_start, token_len);
+      if (tag_name) {
+        on_token((gint)(token_start - line), (gint)(p - line), tag_name,
+                 user_data);
       }
+      continue;
     }
 
     if (starts_number_python(line, p)) {
-      gint number_chars = scan_number_python(p);
-      if (number_chars > 0) {
-        on_token(char_index, char_index + number_chars, MARKYD_TAG_CODE_LITERAL,
-                 user_data);
-        p += number_chars;
-        char_index += number_chars;
+      gint number_len = scan_number_python(p);
+      if (number_len > 0) {
+        gint start = (gint)(p - line);
+        on_token(start, start + number_len, MARKYD_TAG_CODE_LITERAL, user_data);
+        p += number_len;
         continue;
       }
     }
 
-    advance_utf8_char(&p, &char_index);
+    advance_utf8_char(&p);
+    p = skip_plain_run(p, "#\"'.", TRUE);
   }
 
   if (in_triple_single) {
@@ -827,11 +1349,352 @@ static void scan_line_python(const MarkydLanguageHighlight *language,
   }
 }
 
+static void lexer_mark_bytes(MarkydLexer *lexer, const gchar *bytes,
+                             guint8 class_bits) {
+  for (const gchar *p = bytes; p && *p; p++) {
+    lexer->classes[(guchar)*p] |= class_bits;
+  }
+}
+
+static void lexer_compile(const MarkydLanguageHighlight *language,
+                          MarkydLexer *lexer) {
+  const MarkydLexerRules *rules = &lexer->rules;
+
+  for (guint c = 0; c < 128; c++) {
+    if (c == '_' || g_ascii_isalpha((gchar)c)) {
+      lexer->classes[c] |= MARKYD_LEX_CLASS_IDENT_START | MARKYD_LEX_CLASS_IDENT;
+    } else if (g_ascii_isdigit((gchar)c)) {
+      lexer->classes[c] |= MARKYD_LEX_CLASS_DIGIT | MARKYD_LEX_CLASS_IDENT;
+    }
+  }
+  lexer_mark_bytes(lexer, rules->ident_extra,
+                   MARKYD_LEX_CLASS_IDENT_START | MARKYD_LEX_CLASS_IDENT);
+  lexer_mark_bytes(lexer, rules->quotes, MARKYD_LEX_CLASS_QUOTE);
+  lexer_mark_bytes(lexer, rules->multiline_quotes, MARKYD_LEX_CLASS_MULTILINE);
+  lexer_mark_bytes(lexer, rules->raw_quotes, MARKYD_LEX_CLASS_RAW);
+
+  if (rules->line_comment) {
+    lexer->classes[(guchar)rules->line_comment[0]] |= MARKYD_LEX_CLASS_COMMENT;
+  }
+  if (rules->alt_line_comment) {
+    lexer->classes[(guchar)rules->alt_line_comment[0]] |=
+        MARKYD_LEX_CLASS_COMMENT;
+  }
+  if (rules->block_comment_open) {
+    lexer->classes[(guchar)rules->block_comment_open[0]] |=
+        MARKYD_LEX_CLASS_COMMENT;
+  }
+
+  for (guint c = 1, n = 0; c < 128; c++) {
+    if (lexer->classes[c] && !is_ascii_identifier_char((gchar)c)) {
+      /* Runs inside g_once: returning early would publish a partial lexer. */
+      if (n >= SCAN_RUN_MAX_STOPS) {
+        g_error("Lexer for %s has more than %d stop bytes",
+                language->language, SCAN_RUN_MAX_STOPS);
+      }
+      lexer->stops[n++] = (gchar)c;
+    }
+  }
+}
+
+/* Advance past the closing quote; FALSE when the line ends first. */
+static gboolean lex_skip_string(const gchar **p, gchar quote, gboolean raw) {
+  const gchar stops[] = {quote, raw ? '\0' : '\\', '\0'};
+  const gchar *s = *p;
+  gboolean closed = FALSE;
+
+  while (*s) {
+    s = skip_plain_run(s, stops, FALSE);
+    if (*s == '\\' && !raw) {
+      s++;
+      if (*s) {
+        s = g_utf8_next_char(s);
+      }
+      continue;
+    }
+    if (*s == quote) {
+      s++;
+      closed = TRUE;
+      break;
+    }
+  }
+
+  *p = s;
+  return closed;
+}
+
+static gboolean lex_skip_block_comment(const gchar **p, const gchar *close) {
+  const gchar *end = strstr(*p, close);
+
+  *p = end ? end + strlen(close) : *p + strlen(*p);
+  return end != NULL;
+}
+
+/* Numbers absorb identifier bytes so suffixes (10u32, 1.0f, 0xFFULL) and
+ * digit separators stay inside the literal. */
+static const gchar *lex_skip_number(const MarkydLexer *lexer, const gchar *p) {
+  gboolean hex = p[0] == '0' && (p[1] == 'x' || p[1] == 'X');
+  const gchar *s = hex ? p + 2 : p + 1;
+
+  while (*s) {
+    gchar c = *s;
+
+    if (lexer->classes[(guchar)c] & MARKYD_LEX_CLASS_IDENT) {
+      s++;
+      if (!hex && (c == 'e' || c == 'E') && (*s == '+' || *s == '-') &&
+          g_ascii_isdigit(s[1])) {
+        s++;
+      }
+      continue;
+    }
+    if (c == '.' && g_ascii_isdigit(s[1])) {
+      s++;
+      continue;
+    }
+    if (c == '\'' && (lexer->rules.flags & MARKYD_LEX_QUOTE_DIGIT_SEPARATOR) &&
+        g_ascii_isxdigit(s[1])) {
+      s++;
+      continue;
+    }
+    break;
+  }
+  return s;
+}
+
+static const gchar *lex_keyword_tag(const MarkydLanguageHighlight *language,
+                                    const gchar *token, gsize token_len) {
+  gchar folded[KEYWORD_MAX_LEN + 1];
+
+  if (language->lexer->rules.flags & MARKYD_LEX_FOLD_KEYWORDS) {
+    if (token_len > KEYWORD_MAX_LEN) {
+      return NULL;
+    }
+    for (gsize i = 0; i < token_len; i++) {
+      folded[i] = g_ascii_tolower(token[i]);
+    }
+    token = folded;
+  }
+  return lookup_keyword_tag(language, token, token_len);
+}
+
+/* Rule-driven scanner. Runs of plain bytes (class 0, including all non-ASCII)
+ * are skipped a vector at a time; only comment, quote, identifier and digit
+ * bytes branch further. Multi-byte chars need no decoding: every byte that
+ * starts or ends a token is ASCII. */
+static void scan_line_generic(const MarkydLanguageHighlight *language,
+                              const gchar *line, MarkydCodeScanState *state,
+                              MarkydCodeTokenCallback on_token,
+                              gpointer user_data) {
+  MarkydLexer *lexer;
+  const MarkydLexerRules *rules;
+  const gchar *p = line;
+
+  if (!language || !language->lexer || !line || !state || !on_token) {
+    return;
+  }
+
+  lexer = language->lexer;
+  if (g_once_init_enter(&lexer->ready)) {
+    lexer_compile(language, lexer);
+    g_once_init_leave(&lexer->ready, 1);
+  }
+  rules = &lexer->rules;
+
+  if (state->flags & MARKYD_SCAN_FLAG_BLOCK_COMMENT) {
+    if (!lex_skip_block_comment(&p, rules->block_comment_close)) {
+      return;
+    }
+    state->flags &= ~MARKYD_SCAN_FLAG_BLOCK_COMMENT;
+  } else if (state->flags & MARKYD_SCAN_STRING_MASK) {
+    gchar quote = (gchar)((state->flags & MARKYD_SCAN_STRING_MASK) >>
+                          MARKYD_SCAN_STRING_SHIFT);
+    gboolean closed = lex_skip_string(
+        &p, quote, (lexer->classes[(guchar)quote] & MARKYD_LEX_CLASS_RAW) != 0);
+
+    if (p > line) {
+      on_token(0, (gint)(p - line), MARKYD_TAG_CODE_LITERAL, user_data);
+    }
+    if (!closed) {
+      return;
+    }
+    state->flags &= ~MARKYD_SCAN_STRING_MASK;
+  }
+
+  while (*p) {
+    guchar c = (guchar)*p;
+    guint8 cls = lexer->classes[c];
+
+    if (cls == 0) {
+      guint n = 0;
+
+      /* The class table is the cheapest test for short runs. */
+      do {
+        c = (guchar)*++p;
+      } while (c != '\0' && lexer->classes[c] == 0 &&
+               ++n < SCAN_RUN_SCALAR_BYTES);
+      if (n == SCAN_RUN_SCALAR_BYTES) {
+        p = skip_plain_run(p, lexer->stops, TRUE);
+      }
+      continue;
+    }
+
+    if (cls & MARKYD_LEX_CLASS_COMMENT) {
+      gboolean spaced = !(rules->flags & MARKYD_LEX_COMMENT_AFTER_SPACE) ||
+                        p == line || g_ascii_isspace(p[-1]);
+
+      if (spaced && ((rules->line_comment &&
+                      g_str_has_prefix(p, rules->line_comment)) ||
+                     (rules->alt_line_comment &&
+                      g_str_has_prefix(p, rules->alt_line_comment)))) {
+        break;
+      }
+      if (rules->block_comment_open &&
+          g_str_has_prefix(p, rules->block_comment_open)) {
+        gsize open_len = strlen(rules->block_comment_open);
+        p += open_len;
+        if (!lex_skip_block_comment(&p, rules->block_comment_close)) {
+          state->flags |= MARKYD_SCAN_FLAG_BLOCK_COMMENT;
+          return;
+        }
+        continue;
+      }
+    }
+
+    if (cls & MARKYD_LEX_CLASS_QUOTE) {
+      gint start = (gint)(p - line);
+
+      if ((rules->flags & MARKYD_LEX_QUOTE_LIFETIMES) && c == '\'' &&
+          (lexer->classes[(guchar)p[1]] & MARKYD_LEX_CLASS_IDENT_START) &&
+          p[2] != '\'') {
+        p++;
+        continue;
+      }
+
+      p++;
+      if (!lex_skip_string(&p, (gchar)c, (cls & MARKYD_LEX_CLASS_RAW) != 0) &&
+          (cls & MARKYD_LEX_CLASS_MULTILINE)) {
+        state->flags |= (guint32)c << MARKYD_SCAN_STRING_SHIFT;
+      }
+      on_token(start, (gint)(p - line), MARKYD_TAG_CODE_LITERAL, user_data);
+      continue;
+    }
+
+    if (cls & MARKYD_LEX_CLASS_IDENT_START) {
+      const gchar *token_start = p;
+      const gchar *tag_name;
+
+      while (lexer->classes[(guchar)*p] & MARKYD_LEX_CLASS_IDENT) {
+        p++;
+      }
+      tag_name = lex_keyword_tag(language, token_start, (gsize)(p - token_start));
+      if (tag_name) {
+        on_token((gint)(token_start - line), (gint)(p - line), tag_name,
+                 user_data);
+      }
+      continue;
+    }
+
+    if (cls & MARKYD_LEX_CLASS_DIGIT) {
+      const gchar *number_start = p;
+
+      p = lex_skip_number(lexer, p);
+      on_token((gint)(number_start - line), (gint)(p - line),
+               MARKYD_TAG_CODE_LITERAL, user_data);
+      continue;
+    }
+
+    p++;
+  }
+}
+
+static MarkydKeywordTable c_keyword_table;
+static MarkydKeywordTable java_keyword_table;
+static MarkydKeywordTable py_keyword_table;
+static MarkydKeywordTable cpp_keyword_table;
+static MarkydKeywordTable rust_keyword_table;
+static MarkydKeywordTable go_keyword_table;
+static MarkydKeywordTable js_keyword_table;
+static MarkydKeywordTable ts_keyword_table;
+static MarkydKeywordTable sh_keyword_table;
+static MarkydKeywordTable json_keyword_table;
+static MarkydKeywordTable yaml_keyword_table;
+static MarkydKeywordTable sql_keyword_table;
+
+static MarkydLexer cpp_lexer = {
+    {"//", NULL, "/*", "*/", "\"'", NULL, NULL, NULL,
+     MARKYD_LEX_QUOTE_DIGIT_SEPARATOR},
+    0,
+    {0},
+    {0}};
+static MarkydLexer rust_lexer = {
+    {"//", NULL, "/*", "*/", "\"'", "\"", NULL, NULL,
+     MARKYD_LEX_QUOTE_LIFETIMES},
+    0,
+    {0},
+    {0}};
+static MarkydLexer go_lexer = {
+    {"//", NULL, "/*", "*/", "\"'`", "`", "`", NULL, 0}, 0, {0}, {0}};
+static MarkydLexer js_lexer = {
+    {"//", NULL, "/*", "*/", "\"'`", "`", NULL, "$", 0}, 0, {0}, {0}};
+static MarkydLexer ts_lexer = {
+    {"//", NULL, "/*", "*/", "\"'`", "`", NULL, "$", 0}, 0, {0}, {0}};
+static MarkydLexer sh_lexer = {
+    {"#", NULL, NULL, NULL, "\"'", "\"'", "'", NULL,
+     MARKYD_LEX_COMMENT_AFTER_SPACE},
+    0,
+    {0},
+    {0}};
+static MarkydLexer json_lexer = {
+    {NULL, NULL, NULL, NULL, "\"", NULL, NULL, NULL, 0}, 0, {0}, {0}};
+static MarkydLexer yaml_lexer = {
+    {"#", NULL, NULL, NULL, "\"'", NULL, "'", NULL,
+     MARKYD_LEX_COMMENT_AFTER_SPACE},
+    0,
+    {0},
+    {0}};
+static MarkydLexer sql_lexer = {
+    {"--", NULL, "/*", "*/", "'\"", "'", "'", NULL, MARKYD_LEX_FOLD_KEYWORDS},
+    0,
+    {0},
+    {0}};
+
+#define GENERIC_LANGUAGE(name, prefix)                                         \
+  {name, prefix##_groups, G_N_ELEMENTS(prefix##_groups), scan_line_generic,    \
+   &prefix##_keyword_table, &prefix##_lexer}
+
 static const MarkydLanguageHighlight languages[] = {
-    {"c", c_groups, G_N_ELEMENTS(c_groups), scan_line_c},
-    {"java", java_groups, G_N_ELEMENTS(java_groups), scan_line_java},
-    {"python", py_groups, G_N_ELEMENTS(py_groups), scan_line_python},
-    {"py", py_groups, G_N_ELEMENTS(py_groups), scan_line_python},
+    {"c", c_groups, G_N_ELEMENTS(c_groups), scan_line_c, &c_keyword_table,
+     NULL},
+    {"java", java_groups, G_N_ELEMENTS(java_groups), scan_line_java,
+     &java_keyword_table, NULL},
+    {"python", py_groups, G_N_ELEMENTS(py_groups), scan_line_python,
+     &py_keyword_table, NULL},
+    {"py", py_groups, G_N_ELEMENTS(py_groups), scan_line_python,
+     &py_keyword_table, NULL},
+    GENERIC_LANGUAGE("cpp", cpp),
+    GENERIC_LANGUAGE("c++", cpp),
+    GENERIC_LANGUAGE("cc", cpp),
+    GENERIC_LANGUAGE("cxx", cpp),
+    GENERIC_LANGUAGE("hpp", cpp),
+    GENERIC_LANGUAGE("rust", rust),
+    GENERIC_LANGUAGE("rs", rust),
+    GENERIC_LANGUAGE("go", go),
+    GENERIC_LANGUAGE("golang", go),
+    GENERIC_LANGUAGE("javascript", js),
+    GENERIC_LANGUAGE("js", js),
+    GENERIC_LANGUAGE("jsx", js),
+    GENERIC_LANGUAGE("mjs", js),
+    GENERIC_LANGUAGE("typescript", ts),
+    GENERIC_LANGUAGE("ts", ts),
+    GENERIC_LANGUAGE("tsx", ts),
+    GENERIC_LANGUAGE("sh", sh),
+    GENERIC_LANGUAGE("bash", sh),
+    GENERIC_LANGUAGE("shell", sh),
+    GENERIC_LANGUAGE("zsh", sh),
+    GENERIC_LANGUAGE("json", json),
+    GENERIC_LANGUAGE("yaml", yaml),
+    GENERIC_LANGUAGE("yml", yaml),
+    GENERIC_LANGUAGE("sql", sql),
 };
 
 const MarkydLanguageHighlight *
@@ -869,3 +1732,236 @@ void markyd_code_scan_line(const MarkydLanguageHighlight *language,
 
   language->scan_line(language, line, state, on_token, user_data);
 }
+
+gboolean markyd_code_text_is_ascii(const gchar *text, gsize len) {
+  if (!text) {
+    return TRUE;
+  }
+
+#ifdef MARKYD_HAVE_X86_SIMD
+  if (scan_use_avx2()) {
+    return is_ascii_avx2(text, len);
+  }
+  return is_ascii_sse2(text, len);
+#else
+  for (gsize i = 0; i < len; i++) {
+    if ((guchar)text[i] >= 0x80) {
+      return FALSE;
+    }
+  }
+  return TRUE;
+#endif
+}
+
+/* Language guessing for unlabeled blocks. Evidence is keyword hits from the
+ * languages' own tables plus a few line-start markers; a hit shared by n
+ * languages adds 1/n to each, so distinctive keywords decide the winner. */
+typedef struct {
+  const gchar *prefix;    /* At the first non-blank byte of a line. */
+  const gchar *languages; /* Space-separated canonical names. */
+} CodeGuessMarker;
+
+static const CodeGuessMarker guess_markers[] = {
+    {"#include", "c cpp"}, {"#define", "c cpp"}, {"#!/", "sh"},
+    {"$ ", "sh"},          {"def ", "python"},  {"- ", "yaml"},
+};
+
+typedef struct {
+  gsize ready;
+  guint count;
+  const MarkydLanguageHighlight *languages[CODE_GUESS_MAX_LANGUAGES];
+  guint32 marker_masks[G_N_ELEMENTS(guess_markers)];
+  guint32 json_mask;
+  guint32 yaml_mask;
+} CodeGuessTables;
+
+typedef struct {
+  gdouble score[CODE_GUESS_MAX_LANGUAGES];
+  guint cover[CODE_GUESS_MAX_LANGUAGES]; /* Hits each language recognizes. */
+  guint hits;
+} CodeGuessEvidence;
+
+static CodeGuessTables guess_tables;
+
+static guint32 guess_language_mask(const gchar *names) {
+  gchar **parts = g_strsplit(names, " ", -1);
+  guint32 mask = 0;
+
+  for (gchar **name = parts; *name; name++) {
+    const MarkydLanguageHighlight *language = markyd_code_lookup_language(*name);
+    for (guint i = 0; language && i < guess_tables.count; i++) {
+      if (guess_tables.languages[i]->keyword_table == language->keyword_table) {
+        mask |= 1u << i;
+      }
+    }
+  }
+  g_strfreev(parts);
+  return mask;
+}
+
+/* One candidate per keyword table; aliases share theirs. */
+static void guess_tables_build(void) {
+  for (gsize i = 0; i < G_N_ELEMENTS(languages); i++) {
+    gboolean seen = FALSE;
+
+    for (guint k = 0; k < guess_tables.count; k++) {
+      seen = seen || guess_tables.languages[k]->keyword_table ==
+                         languages[i].keyword_table;
+    }
+    if (!seen && guess_tables.count < CODE_GUESS_MAX_LANGUAGES) {
+      guess_tables.languages[guess_tables.count++] = &languages[i];
+    }
+  }
+  for (gsize i = 0; i < G_N_ELEMENTS(guess_markers); i++) {
+    guess_tables.marker_masks[i] =
+        guess_language_mask(guess_markers[i].languages);
+  }
+  guess_tables.json_mask = guess_language_mask("json");
+  guess_tables.yaml_mask = guess_language_mask("yaml");
+}
+
+static void guess_add(CodeGuessEvidence *evidence, guint32 mask) {
+  gdouble share = 1.0 / __builtin_popcount(mask);
+
+  for (guint i = 0; i < guess_tables.count; i++) {
+    if (mask & (1u << i)) {
+      evidence->score[i] += share;
+      evidence->cover[i]++;
+    }
+  }
+  evidence->hits++;
+}
+
+const gchar *markyd_code_keyword_tag(const MarkydLanguageHighlight *language,
+                                     const gchar *token, gsize token_len) {
+  if (!language || !token || token_len == 0) {
+    return NULL;
+  }
+  if (language->lexer) {
+    return lex_keyword_tag(language, token, token_len);
+  }
+  return lookup_keyword_tag(language, token, token_len);
+}
+
+/* Markers that only make sense at the start of a line: preprocessor lines,
+ * shebangs, prompts, JSON members and YAML keys. */
+static void guess_line_start(CodeGuessEvidence *evidence, const gchar *line,
+                             const gchar *end) {
+  const gchar *p = line;
+
+  while (p < end && (*p == ' ' || *p == '\t')) {
+    p++;
+  }
+  for (gsize i = 0; i < G_N_ELEMENTS(guess_markers); i++) {
+    gsize len = strlen(guess_markers[i].prefix);
+    if ((gsize)(end - p) >= len &&
+        memcmp(p, guess_markers[i].prefix, len) == 0) {
+      guess_add(evidence, guess_tables.marker_masks[i]);
+      return;
+    }
+  }
+
+  if (p < end && *p == '"') {
+    const gchar *close = memchr(p + 1, '"', (gsize)(end - p - 1));
+    if (close && close + 1 < end && close[1] == ':') {
+      guess_add(evidence, guess_tables.json_mask);
+    }
+    return;
+  }
+
+  if (p < end && (g_ascii_isalpha(*p) || *p == '_')) {
+    const gchar *q = p;
+    while (q < end && (is_ascii_identifier_char(*q) || *q == '-')) {
+      q++;
+    }
+    if (q < end && *q == ':' && (q + 1 == end || q[1] == ' ') &&
+        !memchr(q, '(', (gsize)(end - q)) && !memchr(q, ';', (gsize)(end - q))) {
+      guess_add(evidence, guess_tables.yaml_mask);
+    }
+  }
+}
+
+const MarkydLanguageHighlight *
+markyd_code_guess_language(const gchar *text, gsize len,
+                           gdouble min_confidence) {
+  CodeGuessEvidence evidence;
+  const gchar *end;
+  const gchar *p;
+  gsize symbols = 0;
+  gsize visible = 0;
+  guint best = 0;
+  gdouble confidence;
+
+  if (!text || len == 0 || min_confidence > 1.0) {
+    return NULL;
+  }
+
+  if (g_once_init_enter(&guess_tables.ready)) {
+    guess_tables_build();
+    g_once_init_leave(&guess_tables.ready, 1);
+  }
+
+  /* Bounded work: only the first CODE_GUESS_MAX_BYTES are sampled. The cut
+   * may fall mid-line or mid-word; a clipped word simply scores as written. */
+  end = text + MIN(len, CODE_GUESS_MAX_BYTES);
+  memset(&evidence, 0, sizeof(evidence));
+
+  for (p = text; p < end;) {
+    const gchar *line_end = memchr(p, '\n', (gsize)(end - p));
+
+    if (!line_end) {
+      line_end = end;
+    }
+    guess_line_start(&evidence, p, line_end);
+
+    while (p < line_end) {
+      guchar c = (guchar)*p;
+
+      if (g_ascii_isalpha(c) || c == '_') {
+        const gchar *word = p;
+        guint32 mask = 0;
+
+        while (p < line_end && is_ascii_identifier_char(*p)) {
+          p++;
+        }
+        for (guint i = 0; i < guess_tables.count; i++) {
+          if (markyd_code_keyword_tag(guess_tables.languages[i], word,
+                                      (gsize)(p - word))) {
+            mask |= 1u << i;
+          }
+        }
+        if (mask) {
+          guess_add(&evidence, mask);
+        }
+        visible += (gsize)(p - word);
+        continue;
+      }
+      if (c > ' ') {
+        visible++;
+        symbols += strchr(CODE_GUESS_SYMBOLS, c) != NULL;
+      }
+      p++;
+    }
+    p = line_end + 1;
+  }
+
+  if (evidence.hits < CODE_GUESS_MIN_HITS || visible == 0) {
+    return NULL;
+  }
+
+  /* Rank by recognized hits plus the shared-weight score: each hit counts 1
+   * and adds 1/n more when n languages share it, so a distinctive keyword
+   * outweighs one the language merely shares. */
+  for (guint i = 1; i < guess_tables.count; i++) {
+    if (evidence.score[i] + evidence.cover[i] >
+        evidence.score[best] + evidence.cover[best]) {
+      best = i;
+    }
+  }
+
+  /* Share of the evidence the winner explains, damped for text with too
+   * little punctuation to be code (prose shares many keywords). */
+  confidence = (gdouble)evidence.cover[best] / evidence.hits *
+               MIN(1.0, (gdouble)symbols / visible / CODE_GUESS_SYMBOL_RATIO);
+  return confidence >= min_confidence ? guess_tables.languages[best] : NULL;
+}
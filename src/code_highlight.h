@@ -14,12 +14,19 @@ typedef struct _MarkydKeywordGroup {
   gsize keyword_count;
 } MarkydKeywordGroup;
 
+/* Keyword hash built on first use from a language's groups. */
+typedef struct _MarkydKeywordTable MarkydKeywordTable;
+
+/* Rule tables for the generic scanner, compiled into byte classes on first use. */
+typedef struct _MarkydLexer MarkydLexer;
+
 typedef struct _MarkydCodeScanState {
   guint32 flags;
 } MarkydCodeScanState;
 
-typedef void (*MarkydCodeTokenCallback)(gint start_char_offset,
-                                        gint end_char_offset,
+/* Offsets are bytes into the scanned line; tokens never split a UTF-8
+ * sequence. */
+typedef void (*MarkydCodeTokenCallback)(gint start_offset, gint end_offset,
                                         const gchar *tag_name,
                                         gpointer user_data);
 
@@ -35,6 +42,8 @@ typedef struct _MarkydLanguageHighlight {
   const MarkydKeywordGroup *groups;
   gsize group_count;
   MarkydCodeScanLineFunc scan_line;
+  MarkydKeywordTable *keyword_table;
+  MarkydLexer *lexer; /* NULL for hand-written scanners. */
 } MarkydLanguageHighlight;
 
 /* Lookup by optional fenced code language (case-insensitive), e.g. "c". */
@@ -50,4 +59,20 @@ void markyd_code_scan_line(const MarkydLanguageHighlight *language,
                            MarkydCodeTokenCallback on_token,
                            gpointer user_data);
 
+/* Keyword tag of one identifier in language, or NULL when it is not a
+ * keyword. */
+const gchar *markyd_code_keyword_tag(const MarkydLanguageHighlight *language,
+                                     const gchar *token, gsize token_len);
+
+/* Guess the language of an unlabeled block from its first few KB using the
+ * keyword tables. Returns NULL unless the guess reaches min_confidence
+ * (0..1; anything above 1 disables guessing). */
+const MarkydLanguageHighlight *
+markyd_code_guess_language(const gchar *text, gsize len,
+                           gdouble min_confidence);
+
+/* TRUE when text holds no multi-byte chars, so token byte offsets are also
+ * char offsets. Vectorized when the CPU supports it. */
+gboolean markyd_code_text_is_ascii(const gchar *text, gsize len);
+
 #endif /* MARKYD_CODE_HIGHLIGHT_H */
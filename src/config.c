@@ -28,6 +28,14 @@ MarkydConfig *config_new(void) {
   cfg->h2_color = g_strdup("#C678DD");
   cfg->h3_color = g_strdup("#E5C07B");
   cfg->list_bullet_color = g_strdup("#61AFEF");
+  cfg->code_language_confidence = 0.6;
+  cfg->code_collapse_lines = 500;
+  cfg->code_preview_lines = 40;
+  cfg->long_line_limit = 10000;
+  cfg->degrade_source_kb = 4096;
+  cfg->render_budget_ms = 1500;
+  cfg->highlight_budget_ms = 3000;
+  cfg->widget_budget_ms = 500;
 
   cfg->line_numbers = FALSE;
   cfg->word_wrap = TRUE;
@@ -125,6 +133,39 @@ gboolean config_load(MarkydConfig *cfg) {
     cfg->list_bullet_color = g_key_file_get_string(
         keyfile, "Markdown", "list_bullet_color", NULL);
   }
+  if (g_key_file_has_key(keyfile, "Markdown", "code_language_confidence",
+                         NULL)) {
+    cfg->code_language_confidence = g_key_file_get_double(
+        keyfile, "Markdown", "code_language_confidence", NULL);
+  }
+  if (g_key_file_has_key(keyfile, "Markdown", "code_collapse_lines", NULL)) {
+    cfg->code_collapse_lines = g_key_file_get_integer(
+        keyfile, "Markdown", "code_collapse_lines", NULL);
+  }
+  if (g_key_file_has_key(keyfile, "Markdown", "code_preview_lines", NULL)) {
+    cfg->code_preview_lines = g_key_file_get_integer(
+        keyfile, "Markdown", "code_preview_lines", NULL);
+  }
+  if (g_key_file_has_key(keyfile, "Markdown", "long_line_limit", NULL)) {
+    cfg->long_line_limit = g_key_file_get_integer(keyfile, "Markdown",
+                                                  "long_line_limit", NULL);
+  }
+  if (g_key_file_has_key(keyfile, "Markdown", "degrade_source_kb", NULL)) {
+    cfg->degrade_source_kb = g_key_file_get_integer(keyfile, "Markdown",
+                                                    "degrade_source_kb", NULL);
+  }
+  if (g_key_file_has_key(keyfile, "Markdown", "render_budget_ms", NULL)) {
+    cfg->render_budget_ms = g_key_file_get_integer(keyfile, "Markdown",
+                                                   "render_budget_ms", NULL);
+  }
+  if (g_key_file_has_key(keyfile, "Markdown", "highlight_budget_ms", NULL)) {
+    cfg->highlight_budget_ms = g_key_file_get_integer(
+        keyfile, "Markdown", "highlight_budget_ms", NULL);
+  }
+  if (g_key_file_has_key(keyfile, "Markdown", "widget_budget_ms", NULL)) {
+    cfg->widget_budget_ms = g_key_file_get_integer(keyfile, "Markdown",
+                                                   "widget_budget_ms", NULL);
+  }
 
   /* Editor */
   if (g_key_file_has_key(keyfile, "Editor", "word_wrap", NULL))
@@ -163,6 +204,22 @@ gboolean config_save(MarkydConfig *cfg) {
   g_key_file_set_string(keyfile, "Markdown", "h3_color", cfg->h3_color);
   g_key_file_set_string(keyfile, "Markdown", "list_bullet_color",
                         cfg->list_bullet_color);
+  g_key_file_set_double(keyfile, "Markdown", "code_language_confidence",
+                        cfg->code_language_confidence);
+  g_key_file_set_integer(keyfile, "Markdown", "code_collapse_lines",
+                         cfg->code_collapse_lines);
+  g_key_file_set_integer(keyfile, "Markdown", "code_preview_lines",
+                         cfg->code_preview_lines);
+  g_key_file_set_integer(keyfile, "Markdown", "long_line_limit",
+                         cfg->long_line_limit);
+  g_key_file_set_integer(keyfile, "Markdown", "degrade_source_kb",
+                         cfg->degrade_source_kb);
+  g_key_file_set_integer(keyfile, "Markdown", "render_budget_ms",
+                         cfg->render_budget_ms);
+  g_key_file_set_integer(keyfile, "Markdown", "highlight_budget_ms",
+                         cfg->highlight_budget_ms);
+  g_key_file_set_integer(keyfile, "Markdown", "widget_budget_ms",
+                         cfg->widget_budget_ms);
 
   /* Editor */
   g_key_file_set_boolean(keyfile, "Editor", "word_wrap", cfg->word_wrap);
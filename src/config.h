@@ -23,6 +23,27 @@ typedef struct _MarkydConfig {
   gchar *h3_color;
   gchar *list_bullet_color;
 
+  /* Unlabeled code blocks are highlighted when the guessed language reaches
+   * this confidence (0..1; above 1 disables guessing). */
+  gdouble code_language_confidence;
+
+  /* Code blocks longer than code_collapse_lines show only their first
+   * code_preview_lines until expanded (0 disables collapsing). */
+  gint code_collapse_lines;
+  gint code_preview_lines;
+
+  /* Lines longer than this many chars are cut short behind an expand control,
+   * code lines are broken into pieces of this length (0 disables both). */
+  gint long_line_limit;
+
+  /* Render budget: past degrade_source_kb of source, or once a render stage
+   * runs over its time, the rest of the render uses cheaper output until it
+   * is rendered fully on request (0 disables a limit). */
+  gint degrade_source_kb;
+  gint render_budget_ms;    /* Parsing and inserting text. */
+  gint highlight_budget_ms; /* Idle code highlighting. */
+  gint widget_budget_ms;    /* Table and image widgets. */
+
   /* Editor */
   gboolean line_numbers;
   gboolean word_wrap;
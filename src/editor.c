@@ -1,18 +1,33 @@
 #include "editor.h"
 #include "app.h"
+#include "config.h"
 #include "markdown.h"
 #include <string.h>
 
+/* Time budget for one idle slice of off-screen code highlighting. */
+#define CODE_HIGHLIGHT_SLICE_USEC 4000
+/* Retry delay while the next block is still on a tokenizer thread. */
+#define CODE_HIGHLIGHT_POLL_MS 2
+
+static gboolean on_highlight_code_idle(gpointer user_data);
+
+static gboolean on_button_press(GtkWidget *widget, GdkEventButton *event,
+                                gpointer user_data);
 static gboolean on_button_release(GtkWidget *widget, GdkEventButton *event,
                                   gpointer user_data);
 static gboolean on_motion_notify(GtkWidget *widget, GdkEventMotion *event,
                                  gpointer user_data);
 static gboolean on_leave_notify(GtkWidget *widget, GdkEventCrossing *event,
                                 gpointer user_data);
+static void cancel_section_toggle(MarkydEditor *self);
 static void apply_markdown(MarkydEditor *self);
 static void schedule_markdown_apply(MarkydEditor *self);
-static void render_image_widgets(MarkydEditor *self);
-static void render_table_widgets(MarkydEditor *self);
+static void render_image_widgets(MarkydEditor *self, gint start_offset,
+                                 gint end_offset);
+static void render_table_widgets(MarkydEditor *self, gint start_offset,
+                                 gint end_offset);
+static void render_code_fold_widgets(MarkydEditor *self);
+static void render_section_fold_widgets(MarkydEditor *self);
 static void refresh_image_widget_scales(MarkydEditor *self);
 static gboolean resolve_image_source_path(MarkydEditor *self, const gchar *src,
                                           gchar **out_path);
@@ -77,8 +92,9 @@ static gboolean get_link_url_at_iter(GtkTextBuffer *buffer, GtkTextIter *at,
 
 static gboolean scroll_to_markdown_anchor(MarkydEditor *self,
                                           const gchar *fragment) {
-  gchar *mark_name;
-  GtkTextMark *mark;
+  gint heading;
+  GtkTextIter at;
+  gchar *slug;
 
   if (!self || !self->buffer || !fragment) {
     return FALSE;
@@ -93,20 +109,30 @@ static gboolean scroll_to_markdown_anchor(MarkydEditor *self,
     return TRUE;
   }
 
-  mark_name = markdown_anchor_mark_name(fragment);
-  mark = gtk_text_buffer_get_mark(self->buffer, mark_name);
-  g_free(mark_name);
-  if (!mark) {
-    return FALSE;
-  }
-
-  {
-    GtkTextIter at;
-    gtk_text_buffer_get_iter_at_mark(self->buffer, &at, mark);
-    gtk_text_buffer_place_cursor(self->buffer, &at);
+  /* Unfold outer sections first until the heading is in the buffer. fragment
+   * may be owned by a heading that unfolding moves, so work on a copy. */
+  slug = g_strdup(fragment);
+  heading = markdown_render_index_lookup_anchor(self->render_index, slug);
+  while (heading < 0) {
+    ViewmdFoldedSection *fold =
+        markdown_render_index_fold_with_anchor(self->render_index, slug);
+    if (!fold || !markyd_editor_unfold_section(self, fold)) {
+      g_free(slug);
+      return FALSE;
+    }
+    heading = markdown_render_index_lookup_anchor(self->render_index, slug);
   }
-  gtk_text_view_scroll_to_mark(GTK_TEXT_VIEW(self->text_view), mark, 0.2, FALSE,
-                               0.0, 0.0);
+  g_free(slug);
+
+  gtk_text_buffer_get_iter_at_offset(
+      self->buffer, &at,
+      g_array_index(self->render_index->headings, ViewmdRenderHeading, heading)
+          .start_offset);
+  gtk_text_buffer_place_cursor(self->buffer, &at);
+  /* Scroll via the insert mark so the move survives pending revalidation. */
+  gtk_text_view_scroll_to_mark(GTK_TEXT_VIEW(self->text_view),
+                               gtk_text_buffer_get_insert(self->buffer), 0.2,
+                               FALSE, 0.0, 0.0);
   return TRUE;
 }
 
@@ -132,18 +158,128 @@ static void set_link_cursor(MarkydEditor *self, gboolean active) {
   }
 }
 
+static void cancel_code_highlighting(MarkydEditor *self) {
+  if (self->highlight_idle_id != 0) {
+    g_source_remove(self->highlight_idle_id);
+    self->highlight_idle_id = 0;
+  }
+  self->highlight_next = 0;
+}
+
+static void notify_degraded(MarkydEditor *self) {
+  if (self->degraded_func) {
+    self->degraded_func(self, self->render_index->degraded, self->degraded_data);
+  }
+}
+
+static gboolean render_budget_applies(MarkydEditor *self) {
+  return config && !self->render_index->full_render;
+}
+
+static void schedule_code_highlighting(MarkydEditor *self, gboolean stalled) {
+  if (self->render_index->degraded & VIEWMD_DEGRADED_HIGHLIGHT) {
+    return;
+  }
+  if (stalled) {
+    self->highlight_idle_id =
+        g_timeout_add_full(G_PRIORITY_LOW, CODE_HIGHLIGHT_POLL_MS,
+                           on_highlight_code_idle, self, NULL);
+  } else {
+    self->highlight_idle_id =
+        g_idle_add_full(G_PRIORITY_LOW, on_highlight_code_idle, self, NULL);
+  }
+}
+
+/* Blocks are tokenized on the worker pool; each slice applies the ones in the
+ * viewport, whatever the budget, then continues in document order. Blocks no
+ * worker has reached yet are tokenized here. */
+static gboolean on_highlight_code_idle(gpointer user_data) {
+  MarkydEditor *self = (MarkydEditor *)user_data;
+  GPtrArray *blocks = self->render_index->code_blocks;
+  GtkTextView *view = GTK_TEXT_VIEW(self->text_view);
+  gint64 slice_start = g_get_monotonic_time();
+  gint64 deadline = slice_start + CODE_HIGHLIGHT_SLICE_USEC;
+  GdkRectangle visible;
+  GtkTextIter top;
+  GtkTextIter bottom;
+  gint bottom_offset;
+  gboolean stalled = FALSE;
+
+  gtk_text_view_get_visible_rect(view, &visible);
+  gtk_text_view_get_iter_at_location(view, &top, visible.x, visible.y);
+  gtk_text_view_get_iter_at_location(view, &bottom, visible.x,
+                                     visible.y + visible.height);
+  bottom_offset = gtk_text_iter_get_offset(&bottom);
+  for (guint i = markdown_render_index_first_code_block(
+           self->render_index, gtk_text_iter_get_offset(&top));
+       i < blocks->len &&
+       ((ViewmdCodeBlock *)g_ptr_array_index(blocks, i))->start_offset <=
+           bottom_offset;
+       i++) {
+    markdown_highlight_code_block(self->buffer, g_ptr_array_index(blocks, i));
+  }
+
+  while (self->highlight_next < blocks->len &&
+         g_get_monotonic_time() < deadline) {
+    if (!markdown_highlight_code_block(
+            self->buffer, g_ptr_array_index(blocks, self->highlight_next))) {
+      stalled = TRUE;
+      break;
+    }
+    self->highlight_next++;
+  }
+
+  self->highlight_idle_id = 0;
+  self->highlight_spent += g_get_monotonic_time() - slice_start;
+  if (self->highlight_next < blocks->len && render_budget_applies(self) &&
+      config->highlight_budget_ms > 0 &&
+      self->highlight_spent > (gint64)config->highlight_budget_ms * 1000) {
+    /* Blocks already highlighted keep their tags; the rest stay plain. */
+    self->render_index->degraded |= VIEWMD_DEGRADED_HIGHLIGHT;
+    notify_degraded(self);
+    return G_SOURCE_REMOVE;
+  }
+  if (self->highlight_next < blocks->len) {
+    schedule_code_highlighting(self, stalled);
+  }
+  return G_SOURCE_REMOVE;
+}
+
 static void apply_markdown(MarkydEditor *self) {
   if (!self) {
     return;
   }
 
+  cancel_code_highlighting(self);
+  self->highlight_spent = 0;
   self->updating_tags = TRUE;
+  self->render_generation++;
+  markyd_text_snapshot_unref(self->text_snapshot);
+  self->text_snapshot = NULL;
   markdown_apply_tags(self->buffer,
-                      self->source_content ? self->source_content : "");
-  render_image_widgets(self);
-  render_table_widgets(self);
+                      self->source_content ? self->source_content : "",
+                      self->render_index);
+  self->widget_deadline =
+      render_budget_applies(self) && config->widget_budget_ms > 0
+          ? g_get_monotonic_time() + (gint64)config->widget_budget_ms * 1000
+          : 0;
+  render_image_widgets(self, 0, -1);
+  render_table_widgets(self, 0, -1);
+  self->widget_deadline = 0;
+  render_code_fold_widgets(self);
+  render_section_fold_widgets(self);
   refresh_image_widget_scales(self);
   self->updating_tags = FALSE;
+
+  if (self->render_index->code_blocks->len > 0) {
+    markdown_tokenize_code_blocks_async(self->render_index);
+    schedule_code_highlighting(self, FALSE);
+  }
+
+  if (self->rendered_func) {
+    self->rendered_func(self, self->render_generation, self->rendered_data);
+  }
+  notify_degraded(self);
 }
 
 static gboolean resolve_image_source_path(MarkydEditor *self, const gchar *src,
@@ -262,7 +398,34 @@ static void refresh_image_widget_scales(MarkydEditor *self) {
   }
 }
 
-static void render_image_widgets(MarkydEditor *self) {
+/* Anchors get widgets within [start_offset, end_offset); -1 is the end. */
+static void get_widget_range(MarkydEditor *self, gint start_offset,
+                             gint end_offset, GtkTextIter *start,
+                             GtkTextIter *end) {
+  gtk_text_buffer_get_iter_at_offset(self->buffer, start, start_offset);
+  if (end_offset < 0) {
+    gtk_text_buffer_get_end_iter(self->buffer, end);
+  } else {
+    gtk_text_buffer_get_iter_at_offset(self->buffer, end, end_offset);
+  }
+}
+
+/* Once the widget budget of a render is spent, images stay labels and
+ * tables become plain text for the rest of it. */
+static gboolean widget_budget_spent(MarkydEditor *self) {
+  if (self->render_index->degraded & VIEWMD_DEGRADED_WIDGETS) {
+    return TRUE;
+  }
+  if (self->widget_deadline > 0 &&
+      g_get_monotonic_time() > self->widget_deadline) {
+    self->render_index->degraded |= VIEWMD_DEGRADED_WIDGETS;
+    return TRUE;
+  }
+  return FALSE;
+}
+
+static void render_image_widgets(MarkydEditor *self, gint start_offset,
+                                 gint end_offset) {
   GtkTextIter iter;
   GtkTextIter end;
   gint max_width;
@@ -272,7 +435,7 @@ static void render_image_widgets(MarkydEditor *self) {
   }
 
   max_width = get_image_max_width(self);
-  gtk_text_buffer_get_bounds(self->buffer, &iter, &end);
+  get_widget_range(self, start_offset, end_offset, &iter, &end);
   while (!gtk_text_iter_equal(&iter, &end)) {
     GtkTextChildAnchor *anchor = gtk_text_iter_get_child_anchor(&iter);
     if (anchor &&
@@ -286,7 +449,8 @@ static void render_image_widgets(MarkydEditor *self) {
             g_object_get_data(G_OBJECT(anchor), VIEWMD_IMAGE_ALT_DATA);
         gchar *path = NULL;
 
-        if (resolve_image_source_path(self, src, &path)) {
+        if (!widget_budget_spent(self) &&
+            resolve_image_source_path(self, src, &path)) {
           GError *err = NULL;
           GdkPixbuf *orig = gdk_pixbuf_new_from_file(path, &err);
           if (orig) {
@@ -327,7 +491,8 @@ static void render_image_widgets(MarkydEditor *self) {
   }
 }
 
-static void render_table_widgets(MarkydEditor *self) {
+static void render_table_widgets(MarkydEditor *self, gint start_offset,
+                                 gint end_offset) {
   GtkTextIter iter;
   GtkTextIter end;
 
@@ -335,7 +500,7 @@ static void render_table_widgets(MarkydEditor *self) {
     return;
   }
 
-  gtk_text_buffer_get_bounds(self->buffer, &iter, &end);
+  get_widget_range(self, start_offset, end_offset, &iter, &end);
   while (!gtk_text_iter_equal(&iter, &end)) {
     GtkTextChildAnchor *anchor = gtk_text_iter_get_child_anchor(&iter);
     if (anchor &&
@@ -343,7 +508,9 @@ static void render_table_widgets(MarkydEditor *self) {
       GtkWidget *table =
           g_object_get_data(G_OBJECT(anchor), VIEWMD_TABLE_WIDGET_DATA);
       if (!table) {
-        table = markdown_create_table_widget(anchor);
+        table = widget_budget_spent(self)
+                    ? markdown_create_table_text_widget(anchor)
+                    : markdown_create_table_widget(anchor);
         if (table) {
           gtk_text_view_add_child_at_anchor(GTK_TEXT_VIEW(self->text_view), table,
                                             anchor);
@@ -356,6 +523,287 @@ static void render_table_widgets(MarkydEditor *self) {
   }
 }
 
+static void on_code_fold_clicked(GtkButton *button, gpointer user_data) {
+  MarkydEditor *self = (MarkydEditor *)user_data;
+  GtkTextChildAnchor *anchor =
+      g_object_get_data(G_OBJECT(button), VIEWMD_CODE_FOLD_ANCHOR_DATA);
+
+  markyd_editor_expand_code(
+      self, markdown_render_index_lookup_collapsed(self->render_index, anchor));
+}
+
+/* Collapsed tails are listed in the index, so no buffer walk is needed. */
+static void render_code_fold_widgets(MarkydEditor *self) {
+  GPtrArray *tails;
+
+  if (!self || !self->text_view || !self->render_index) {
+    return;
+  }
+
+  tails = self->render_index->collapsed_code;
+  for (guint i = 0; i < tails->len; i++) {
+    ViewmdCollapsedCode *code = g_ptr_array_index(tails, i);
+    GtkWidget *button;
+    gchar *label;
+
+    if (g_object_get_data(G_OBJECT(code->anchor),
+                          VIEWMD_CODE_FOLD_WIDGET_DATA)) {
+      continue;
+    }
+
+    if (code->truncated_line) {
+      glong chars = g_utf8_strlen(code->text, -1);
+      label = g_strdup_printf("Show line (%ld more char%s)", chars,
+                              chars == 1 ? "" : "s");
+    } else {
+      label = g_strdup_printf("Expand (%u more line%s)", code->line_count,
+                              code->line_count == 1 ? "" : "s");
+    }
+    button = gtk_button_new_with_label(label);
+    g_free(label);
+    gtk_button_set_relief(GTK_BUTTON(button), GTK_RELIEF_NONE);
+    gtk_widget_set_halign(button, GTK_ALIGN_START);
+    gtk_style_context_add_class(gtk_widget_get_style_context(button),
+                                "viewmd-code-fold");
+    g_object_set_data(G_OBJECT(button), VIEWMD_CODE_FOLD_ANCHOR_DATA,
+                      code->anchor);
+    g_signal_connect(button, "clicked", G_CALLBACK(on_code_fold_clicked), self);
+    gtk_text_view_add_child_at_anchor(GTK_TEXT_VIEW(self->text_view), button,
+                                      code->anchor);
+    gtk_widget_show_all(button);
+    g_object_set_data(G_OBJECT(code->anchor), VIEWMD_CODE_FOLD_WIDGET_DATA,
+                      button);
+  }
+}
+
+gboolean markyd_editor_expand_code(MarkydEditor *self,
+                                   ViewmdCollapsedCode *code) {
+  gint offset;
+  guint block;
+
+  if (!self || !code) {
+    return FALSE;
+  }
+
+  offset = code->offset;
+  self->updating_tags = TRUE;
+  if (!markdown_expand_collapsed_code(self->buffer, self->render_index, code)) {
+    self->updating_tags = FALSE;
+    return FALSE;
+  }
+  self->updating_tags = FALSE;
+  self->render_generation++;
+  markyd_text_snapshot_unref(self->text_snapshot);
+  self->text_snapshot = NULL;
+
+  /* The block was reset to PENDING; rewind the idle pass to reach it. */
+  block = markdown_render_index_first_code_block(self->render_index, offset);
+  if (block < self->render_index->code_blocks->len) {
+    markdown_tokenize_code_blocks_async(self->render_index);
+    self->highlight_next = MIN(self->highlight_next, block);
+    if (self->highlight_idle_id == 0) {
+      schedule_code_highlighting(self, FALSE);
+    }
+  }
+
+  if (self->rendered_func) {
+    self->rendered_func(self, self->render_generation, self->rendered_data);
+  }
+  return TRUE;
+}
+
+static void on_section_fold_clicked(GtkButton *button, gpointer user_data) {
+  MarkydEditor *self = (MarkydEditor *)user_data;
+  GtkTextChildAnchor *anchor =
+      g_object_get_data(G_OBJECT(button), VIEWMD_SECTION_FOLD_ANCHOR_DATA);
+
+  markyd_editor_unfold_section(
+      self, markdown_render_index_lookup_fold(self->render_index, anchor));
+}
+
+static void render_section_fold_widgets(MarkydEditor *self) {
+  GPtrArray *folds;
+
+  if (!self || !self->text_view || !self->render_index) {
+    return;
+  }
+
+  folds = self->render_index->folded_sections;
+  for (guint i = 0; i < folds->len; i++) {
+    ViewmdFoldedSection *fold = g_ptr_array_index(folds, i);
+    GtkWidget *button;
+    gchar *label;
+
+    if (g_object_get_data(G_OBJECT(fold->anchor),
+                          VIEWMD_SECTION_FOLD_WIDGET_DATA)) {
+      continue;
+    }
+
+    label = g_strdup_printf("Unfold (%u line%s)", fold->line_count,
+                            fold->line_count == 1 ? "" : "s");
+    button = gtk_button_new_with_label(label);
+    g_free(label);
+    gtk_button_set_relief(GTK_BUTTON(button), GTK_RELIEF_NONE);
+    gtk_widget_set_halign(button, GTK_ALIGN_START);
+    gtk_style_context_add_class(gtk_widget_get_style_context(button),
+                                "viewmd-section-fold");
+    g_object_set_data(G_OBJECT(button), VIEWMD_SECTION_FOLD_ANCHOR_DATA,
+                      fold->anchor);
+    g_signal_connect(button, "clicked", G_CALLBACK(on_section_fold_clicked),
+                     self);
+    gtk_text_view_add_child_at_anchor(GTK_TEXT_VIEW(self->text_view), button,
+                                      fold->anchor);
+    gtk_widget_show_all(button);
+    g_object_set_data(G_OBJECT(fold->anchor), VIEWMD_SECTION_FOLD_WIDGET_DATA,
+                      button);
+  }
+}
+
+/* Folding moves offsets and index entries like a new render: rebuild widgets
+ * for restored text in [start_offset, end_offset), restart highlighting for
+ * restored code blocks and notify the listener. */
+static void sections_changed(MarkydEditor *self, gint start_offset,
+                             gint end_offset) {
+  self->render_generation++;
+  markyd_text_snapshot_unref(self->text_snapshot);
+  self->text_snapshot = NULL;
+
+  if (end_offset < 0 || end_offset > start_offset) {
+    render_image_widgets(self, start_offset, end_offset);
+    render_table_widgets(self, start_offset, end_offset);
+    refresh_image_widget_scales(self);
+  }
+  render_code_fold_widgets(self);
+  render_section_fold_widgets(self);
+
+  /* Block indices moved; applied blocks are skipped quickly on the rescan. */
+  cancel_code_highlighting(self);
+  if (self->render_index->code_blocks->len > 0) {
+    markdown_tokenize_code_blocks_async(self->render_index);
+    schedule_code_highlighting(self, FALSE);
+  }
+
+  if (self->rendered_func) {
+    self->rendered_func(self, self->render_generation, self->rendered_data);
+  }
+}
+
+gboolean markyd_editor_unfold_section(MarkydEditor *self,
+                                      ViewmdFoldedSection *fold) {
+  gint offset;
+  gint length;
+  gboolean unfolded;
+
+  if (!self || !fold) {
+    return FALSE;
+  }
+
+  offset = fold->offset;
+  self->updating_tags = TRUE;
+  unfolded = markdown_unfold_section(self->buffer, self->render_index, fold,
+                                     &length);
+  self->updating_tags = FALSE;
+  if (!unfolded) {
+    return FALSE;
+  }
+
+  sections_changed(self, offset, offset + length);
+  return TRUE;
+}
+
+gboolean markyd_editor_toggle_section(MarkydEditor *self, guint heading) {
+  ViewmdRenderIndex *index;
+  ViewmdFoldedSection *fold;
+  GtkTextIter iter;
+  gboolean folded;
+
+  if (!self || !self->render_index ||
+      heading >= self->render_index->headings->len) {
+    return FALSE;
+  }
+
+  index = self->render_index;
+  gtk_text_buffer_get_iter_at_offset(
+      self->buffer, &iter,
+      g_array_index(index->headings, ViewmdRenderHeading, heading).start_offset);
+  if (gtk_text_iter_forward_line(&iter)) {
+    fold = markdown_render_index_fold_at(index, gtk_text_iter_get_offset(&iter));
+    if (fold) {
+      return markyd_editor_unfold_section(self, fold);
+    }
+  }
+
+  self->updating_tags = TRUE;
+  folded = markdown_fold_section(self->buffer, index, heading);
+  self->updating_tags = FALSE;
+  if (folded) {
+    sections_changed(self, 0, 0);
+  }
+  return folded;
+}
+
+void markyd_editor_fold_to_level(MarkydEditor *self, gint level) {
+  GArray *headings;
+  GArray *tops;
+  gint open_level = 0;
+  gboolean folded = FALSE;
+
+  if (!self || !self->render_index) {
+    return;
+  }
+
+  /* Fold the outermost sections at or below level; nested ones go with them. */
+  headings = self->render_index->headings;
+  tops = g_array_new(FALSE, FALSE, sizeof(guint));
+  for (guint i = 0; i < headings->len; i++) {
+    gint heading_level = g_array_index(headings, ViewmdRenderHeading, i).level;
+    if (heading_level < level) {
+      open_level = 0;
+    } else if (open_level == 0 || heading_level <= open_level) {
+      g_array_append_val(tops, i);
+      open_level = heading_level;
+    }
+  }
+
+  /* Back to front, so earlier heading indices and offsets stay valid and
+   * each fold only shifts the short tail already folded. */
+  self->updating_tags = TRUE;
+  for (guint i = tops->len; i > 0; i--) {
+    folded |= markdown_fold_section(self->buffer, self->render_index,
+                                    g_array_index(tops, guint, i - 1));
+  }
+  self->updating_tags = FALSE;
+  g_array_free(tops, TRUE);
+
+  if (folded) {
+    sections_changed(self, 0, 0);
+  }
+}
+
+void markyd_editor_unfold_all(MarkydEditor *self) {
+  GPtrArray *folds;
+  gboolean unfolded = FALSE;
+
+  if (!self || !self->render_index) {
+    return;
+  }
+
+  /* Nested folds surface as their parents open; keep going until none. */
+  folds = self->render_index->folded_sections;
+  self->updating_tags = TRUE;
+  while (folds->len > 0 &&
+         markdown_unfold_section(self->buffer, self->render_index,
+                                 g_ptr_array_index(folds, folds->len - 1),
+                                 NULL)) {
+    unfolded = TRUE;
+  }
+  self->updating_tags = FALSE;
+
+  if (unfolded) {
+    sections_changed(self, 0, -1);
+  }
+}
+
 static gboolean apply_markdown_idle(gpointer user_data) {
   MarkydEditor *self = (MarkydEditor *)user_data;
   self->markdown_idle_id = 0;
@@ -374,6 +822,62 @@ static void schedule_markdown_apply(MarkydEditor *self) {
 
 void markyd_editor_refresh(MarkydEditor *self) { schedule_markdown_apply(self); }
 
+void markyd_editor_render_fully(MarkydEditor *self) {
+  if (!self) {
+    return;
+  }
+  self->render_index->full_render = TRUE;
+  schedule_markdown_apply(self);
+}
+
+void markyd_editor_set_degraded_callback(MarkydEditor *self,
+                                         MarkydEditorDegradedFunc func,
+                                         gpointer user_data) {
+  if (!self) {
+    return;
+  }
+  self->degraded_func = func;
+  self->degraded_data = user_data;
+}
+
+gboolean markyd_editor_scroll_to_anchor(MarkydEditor *self,
+                                        const gchar *fragment) {
+  return scroll_to_markdown_anchor(self, fragment);
+}
+
+void markyd_editor_set_render_callback(MarkydEditor *self,
+                                       MarkydEditorRenderedFunc func,
+                                       gpointer user_data) {
+  if (!self) {
+    return;
+  }
+  self->rendered_func = func;
+  self->rendered_data = user_data;
+}
+
+MarkydTextSnapshot *markyd_editor_get_text_snapshot(MarkydEditor *self) {
+  GtkTextIter start;
+  GtkTextIter end;
+  gchar *text;
+
+  if (!self || !self->buffer) {
+    return NULL;
+  }
+
+  if (self->text_snapshot &&
+      self->text_snapshot->generation == self->render_generation) {
+    return self->text_snapshot;
+  }
+
+  markyd_text_snapshot_unref(self->text_snapshot);
+  gtk_text_buffer_get_bounds(self->buffer, &start, &end);
+  text = gtk_text_buffer_get_slice(self->buffer, &start, &end, TRUE);
+  self->text_snapshot =
+      markyd_text_snapshot_new(text, -1, self->render_generation);
+  g_free(text);
+  return self->text_snapshot;
+}
+
 MarkydEditor *markyd_editor_new(MarkydApp *app) {
   MarkydEditor *self = g_new0(MarkydEditor, 1);
 
@@ -393,11 +897,14 @@ MarkydEditor *markyd_editor_new(MarkydApp *app) {
   gtk_text_view_set_cursor_visible(GTK_TEXT_VIEW(self->text_view), FALSE);
 
   self->buffer = gtk_text_view_get_buffer(GTK_TEXT_VIEW(self->text_view));
+  self->render_index = markdown_render_index_new();
   markdown_init_tags(self->buffer);
 
   gtk_widget_add_events(self->text_view, GDK_POINTER_MOTION_MASK |
                                             GDK_LEAVE_NOTIFY_MASK |
                                             GDK_BUTTON_RELEASE_MASK);
+  g_signal_connect(self->text_view, "button-press-event",
+                   G_CALLBACK(on_button_press), self);
   g_signal_connect(self->text_view, "button-release-event",
                    G_CALLBACK(on_button_release), self);
   g_signal_connect(self->text_view, "motion-notify-event",
@@ -426,6 +933,10 @@ void markyd_editor_free(MarkydEditor *self) {
     g_source_remove(self->markdown_idle_id);
     self->markdown_idle_id = 0;
   }
+  cancel_section_toggle(self);
+  cancel_code_highlighting(self);
+  markyd_text_snapshot_unref(self->text_snapshot);
+  markdown_render_index_free(self->render_index);
   g_free(self->source_content);
   g_free(self);
 }
@@ -437,6 +948,7 @@ void markyd_editor_set_content(MarkydEditor *self, const gchar *content) {
 
   g_free(self->source_content);
   self->source_content = g_strdup(content ? content : "");
+  self->render_index->full_render = FALSE;
   schedule_markdown_apply(self);
 }
 
@@ -466,6 +978,99 @@ void markyd_editor_focus(MarkydEditor *self) {
   }
 }
 
+static void cancel_section_toggle(MarkydEditor *self) {
+  if (self->section_toggle_id != 0) {
+    g_source_remove(self->section_toggle_id);
+    self->section_toggle_id = 0;
+  }
+}
+
+/* Double-click selects the word under the pointer using the same word
+ * boundaries as whole-word search. */
+static gboolean on_button_press(GtkWidget *widget, GdkEventButton *event,
+                                gpointer user_data) {
+  MarkydEditor *self = (MarkydEditor *)user_data;
+  const MarkydTextSnapshot *snapshot;
+  GtkTextIter iter;
+  GtkTextIter word_start;
+  GtkTextIter word_end;
+  gint bx, by;
+  gint start_offset;
+  gint end_offset;
+
+  if (event->button == 1 && (event->type == GDK_2BUTTON_PRESS ||
+                             event->type == GDK_3BUTTON_PRESS)) {
+    /* The first click of the sequence was not a heading click after all. */
+    cancel_section_toggle(self);
+    self->multi_click = TRUE;
+  }
+
+  if (event->type != GDK_2BUTTON_PRESS || event->button != 1) {
+    return FALSE;
+  }
+
+  gtk_text_view_window_to_buffer_coords(GTK_TEXT_VIEW(widget),
+                                        GTK_TEXT_WINDOW_TEXT, (gint)event->x,
+                                        (gint)event->y, &bx, &by);
+  gtk_text_view_get_iter_at_location(GTK_TEXT_VIEW(widget), &iter, bx, by);
+
+  snapshot = markyd_editor_get_text_snapshot(self);
+  if (!markyd_text_snapshot_word_bounds(snapshot, gtk_text_iter_get_offset(&iter),
+                                        &start_offset, &end_offset)) {
+    return FALSE;
+  }
+
+  gtk_text_buffer_get_iter_at_offset(self->buffer, &word_start, start_offset);
+  gtk_text_buffer_get_iter_at_offset(self->buffer, &word_end, end_offset);
+  gtk_text_buffer_select_range(self->buffer, &word_start, &word_end);
+  return TRUE;
+}
+
+static gboolean on_section_toggle_timeout(gpointer user_data) {
+  MarkydEditor *self = (MarkydEditor *)user_data;
+
+  self->section_toggle_id = 0;
+  if (self->section_toggle_generation == self->render_generation) {
+    markyd_editor_toggle_section(self, self->section_toggle_heading);
+  }
+  return G_SOURCE_REMOVE;
+}
+
+/* A plain click on a heading line folds or unfolds its section. The toggle
+ * waits out the double-click time so that double-clicking a word in a
+ * heading selects it instead. */
+static gboolean toggle_section_at_iter(MarkydEditor *self, GtkTextIter *iter) {
+  GtkTextIter start;
+  gint heading;
+  gint double_click_ms = 400;
+
+  if (gtk_text_buffer_get_has_selection(self->buffer)) {
+    return FALSE;
+  }
+
+  heading = markdown_render_index_heading_at(self->render_index,
+                                             gtk_text_iter_get_offset(iter));
+  if (heading < 0) {
+    return FALSE;
+  }
+  gtk_text_buffer_get_iter_at_offset(
+      self->buffer, &start,
+      g_array_index(self->render_index->headings, ViewmdRenderHeading, heading)
+          .start_offset);
+  if (gtk_text_iter_get_line(&start) != gtk_text_iter_get_line(iter)) {
+    return FALSE;
+  }
+
+  g_object_get(gtk_widget_get_settings(self->text_view),
+               "gtk-double-click-time", &double_click_ms, NULL);
+  cancel_section_toggle(self);
+  self->section_toggle_heading = (guint)heading;
+  self->section_toggle_generation = self->render_generation;
+  self->section_toggle_id = g_timeout_add((guint)MAX(double_click_ms, 0),
+                                          on_section_toggle_timeout, self);
+  return TRUE;
+}
+
 static gboolean on_button_release(GtkWidget *widget, GdkEventButton *event,
                                   gpointer user_data) {
   MarkydEditor *self = (MarkydEditor *)user_data;
@@ -484,7 +1089,11 @@ static gboolean on_button_release(GtkWidget *widget, GdkEventButton *event,
   gtk_text_view_get_iter_at_location(GTK_TEXT_VIEW(widget), &iter, bx, by);
 
   if (!get_link_url_at_iter(self->buffer, &iter, &url)) {
-    return FALSE;
+    if (self->multi_click) {
+      self->multi_click = FALSE;
+      return FALSE;
+    }
+    return toggle_section_at_iter(self, &iter);
   }
 
   if (url[0] == '#') {
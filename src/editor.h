@@ -1,11 +1,23 @@
 #ifndef MARKYD_EDITOR_H
 #define MARKYD_EDITOR_H
 
+#include "markdown.h"
+#include "text_snapshot.h"
 #include <gtk/gtk.h>
 
 typedef struct _MarkydApp MarkydApp;
+typedef struct _MarkydEditor MarkydEditor;
 
-typedef struct _MarkydEditor {
+/* Called once after each completed render of the buffer contents. */
+typedef void (*MarkydEditorRenderedFunc)(MarkydEditor *editor, guint generation,
+                                         gpointer user_data);
+
+/* Called after each render with its VIEWMD_DEGRADED_* reasons (0 when none),
+ * and again if idle work later falls back to cheaper output. */
+typedef void (*MarkydEditorDegradedFunc)(MarkydEditor *editor, guint reasons,
+                                         gpointer user_data);
+
+struct _MarkydEditor {
   GtkWidget *text_view;
   GtkTextBuffer *buffer;
   MarkydApp *app;
@@ -18,7 +30,36 @@ typedef struct _MarkydEditor {
 
   /* Coalesce markdown re-rendering to idle to avoid invalidating GTK iterators. */
   guint markdown_idle_id;
-} MarkydEditor;
+
+  /* Incremented whenever the rendered buffer contents are replaced. */
+  guint render_generation;
+
+  /* Casefolded search snapshot of the rendered text, built on first use. */
+  MarkydTextSnapshot *text_snapshot;
+
+  /* Offset lookup tables for the current render. */
+  ViewmdRenderIndex *render_index;
+
+  /* Low-priority idle highlighting render_index->code_blocks. */
+  guint highlight_idle_id;
+  guint highlight_next;
+  gint64 highlight_spent; /* Usec of highlighting spent on this render. */
+
+  /* Monotonic usec after which widgets are built the cheap way; 0 if none. */
+  gint64 widget_deadline;
+
+  /* Heading click waiting out the double-click time before it toggles. */
+  guint section_toggle_id;
+  guint section_toggle_heading;
+  guint section_toggle_generation;
+  /* Set by a double or triple press so its release does not toggle. */
+  gboolean multi_click;
+
+  MarkydEditorRenderedFunc rendered_func;
+  gpointer rendered_data;
+  MarkydEditorDegradedFunc degraded_func;
+  gpointer degraded_data;
+};
 
 /* Lifecycle */
 MarkydEditor *markyd_editor_new(MarkydApp *app);
@@ -32,6 +73,49 @@ gchar *markyd_editor_get_content(MarkydEditor *editor);
 GtkWidget *markyd_editor_get_widget(MarkydEditor *editor);
 void markyd_editor_focus(MarkydEditor *editor);
 
+/* Casefolded snapshot of the current rendered text for searching. */
+MarkydTextSnapshot *markyd_editor_get_text_snapshot(MarkydEditor *editor);
+
+/* Scroll to a heading anchor fragment ("" for the top). FALSE if unknown. */
+gboolean markyd_editor_scroll_to_anchor(MarkydEditor *editor,
+                                        const gchar *fragment);
+
+/* Insert the hidden lines of a collapsed code block and highlight it. Reported
+ * through the render callback like a new render, since offsets past the
+ * block move. FALSE if code is not part of the current render. */
+gboolean markyd_editor_expand_code(MarkydEditor *editor,
+                                   ViewmdCollapsedCode *code);
+
+/* Fold the section under heading (an index into render_index->headings), or
+ * unfold it if folded. Reported through the render callback. FALSE if
+ * nothing changed. */
+gboolean markyd_editor_toggle_section(MarkydEditor *editor, guint heading);
+
+/* Put a folded section back into the buffer. FALSE if fold is not part of the
+ * current render. */
+gboolean markyd_editor_unfold_section(MarkydEditor *editor,
+                                      ViewmdFoldedSection *fold);
+
+/* Fold the outermost sections of headings at level or deeper in one pass. */
+void markyd_editor_fold_to_level(MarkydEditor *editor, gint level);
+
+/* Unfold every folded section, nested ones included. */
+void markyd_editor_unfold_all(MarkydEditor *editor);
+
+/* Register the render-completed notification (one listener). */
+void markyd_editor_set_render_callback(MarkydEditor *editor,
+                                       MarkydEditorRenderedFunc func,
+                                       gpointer user_data);
+
+/* Register the degraded-render notification (one listener). */
+void markyd_editor_set_degraded_callback(MarkydEditor *editor,
+                                         MarkydEditorDegradedFunc func,
+                                         gpointer user_data);
+
+/* Render the current document again without the render budget. Loading new
+ * content restores the budget. */
+void markyd_editor_render_fully(MarkydEditor *editor);
+
 /* Force a refresh of markdown styling/rendering (e.g., after settings change). */
 void markyd_editor_refresh(MarkydEditor *editor);
 
@@ -0,0 +1,91 @@
+#include "fuzzy_match.h"
+
+#define FUZZY_SCORE_MATCH 10
+#define FUZZY_SCORE_WORD_START 15
+#define FUZZY_SCORE_CONSECUTIVE 20
+#define FUZZY_MAX_GAP_PENALTY 10
+#define FUZZY_MAX_LEADING_PENALTY 20
+
+static guint char_mask_bit(gunichar c) {
+  if (c >= 'a' && c <= 'z') {
+    return c - 'a';
+  }
+  if (c >= '0' && c <= '9') {
+    return 26 + (c - '0');
+  }
+  /* Everything else shares the remaining 28 bits. */
+  return 36 + (c % 28);
+}
+
+guint64 markyd_fuzzy_char_mask(const gchar *folded) {
+  guint64 mask = 0;
+
+  if (!folded) {
+    return 0;
+  }
+
+  for (const gchar *p = folded; *p != '\0'; p = g_utf8_next_char(p)) {
+    mask |= G_GUINT64_CONSTANT(1) << char_mask_bit(g_utf8_get_char(p));
+  }
+  return mask;
+}
+
+/* Greedy left-to-right match: each pattern char takes the first candidate
+ * char that equals it. Bonuses for word starts and runs, penalties for gaps,
+ * a late first hit and trailing length. */
+gint markyd_fuzzy_score(const gchar *pattern, const gchar *candidate) {
+  const gchar *c;
+  gunichar prev = 0;
+  gint pos = 0;
+  gint first = -1;
+  gint last = -1;
+  gint score = 0;
+
+  if (!pattern || !candidate) {
+    return -1;
+  }
+
+  c = candidate;
+  for (const gchar *p = pattern; *p != '\0'; p = g_utf8_next_char(p)) {
+    gunichar want = g_utf8_get_char(p);
+    gboolean found = FALSE;
+
+    while (*c != '\0') {
+      gunichar have = g_utf8_get_char(c);
+      gboolean word_start = pos == 0 || !g_unichar_isalnum(prev);
+
+      prev = have;
+      c = g_utf8_next_char(c);
+      pos++;
+
+      if (have != want) {
+        continue;
+      }
+
+      score += FUZZY_SCORE_MATCH;
+      if (word_start) {
+        score += FUZZY_SCORE_WORD_START;
+      }
+      if (last >= 0 && last == pos - 2) {
+        score += FUZZY_SCORE_CONSECUTIVE;
+      } else if (last >= 0) {
+        score -= MIN(pos - 2 - last, FUZZY_MAX_GAP_PENALTY);
+      }
+      if (first < 0) {
+        first = pos - 1;
+      }
+      last = pos - 1;
+      found = TRUE;
+      break;
+    }
+
+    if (!found) {
+      return -1;
+    }
+  }
+
+  score -= MIN(first < 0 ? 0 : first, FUZZY_MAX_LEADING_PENALTY);
+  /* Prefer shorter candidates among otherwise equal hits. */
+  score -= (gint)(g_utf8_strlen(c, -1) / 8);
+  return MAX(score, 0);
+}
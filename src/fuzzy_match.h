@@ -0,0 +1,14 @@
+#ifndef MARKYD_FUZZY_MATCH_H
+#define MARKYD_FUZZY_MATCH_H
+
+#include <glib.h>
+
+/* Bit set of the chars in a casefolded string. A candidate can only match a
+ * pattern whose mask is a subset of the candidate's mask. */
+guint64 markyd_fuzzy_char_mask(const gchar *folded);
+
+/* Score pattern as an in-order subsequence of candidate (both casefolded).
+ * Higher is better; -1 when pattern does not occur. */
+gint markyd_fuzzy_score(const gchar *pattern, const gchar *candidate);
+
+#endif /* MARKYD_FUZZY_MATCH_H */
@@ -1,6 +1,7 @@
 #include "markdown.h"
 #include "code_highlight.h"
 #include "config.h"
+#include "fuzzy_match.h"
 #include "md4c/md4c.h"
 #include <string.h>
 
@@ -55,11 +56,22 @@ typedef struct {
   GPtrArray *rows;  /* ViewmdTableRow* */
 } ViewmdTable;
 
+/* Walks shorter than this move the iter forward; longer gaps re-seek. */
+#define CODE_SPAN_WALK_LIMIT 512
+/* Bytes of text and tokens kept across renders by the code token cache. */
+#define CODE_TOKEN_CACHE_MAX_BYTES (32 * 1024 * 1024)
+/* A folded section leaves its placeholder anchor and a newline behind. */
+#define FOLD_PLACEHOLDER_CHARS 2
+
 typedef struct {
   gint start_offset;
   gint end_offset;
-  const MarkydLanguageHighlight *language;
-} CodeBlockRange;
+  guint tag_id; /* Index into code_tag_names. */
+} ViewmdCodeToken;
+
+static const gchar *const code_tag_names[] = {
+    MARKYD_TAG_CODE_KW_A, MARKYD_TAG_CODE_KW_B, MARKYD_TAG_CODE_KW_C,
+    MARKYD_TAG_CODE_LITERAL};
 
 typedef struct {
   GtkTextBuffer *buffer;
@@ -71,6 +83,7 @@ typedef struct {
   GHashTable *anchor_counts;
   GString *heading_text;
   gint heading_start_offset;
+  gint heading_level;
   gboolean in_heading;
   gboolean list_item_prefix_pending;
   guint quote_depth;
@@ -82,11 +95,30 @@ typedef struct {
   gboolean in_image;
   gchar *image_src;
   GString *image_alt;
-  GArray *code_blocks; /* CodeBlockRange */
+  GPtrArray *code_blocks; /* ViewmdCodeBlock* */
+  /* Text inserted since the current highlighted code block began. */
+  GString *code_text;
   gint current_code_start_offset;
   const MarkydLanguageHighlight *current_code_language;
+  gdouble code_guess_confidence;
+  /* Code lines past the preview are held here until the block ends; then
+   * they are inserted or, for a long block, kept back in the index. */
+  GString *code_tail;
+  guint code_lines;
+  guint code_tail_lines;
+  guint code_collapse_lines; /* 0: never collapse. */
+  guint code_preview_lines;
+  /* Guard against lines too long for Pango to lay out quickly. */
+  guint long_line_limit; /* 0: no limit. */
+  guint line_chars;      /* Chars inserted since the last newline. */
+  guint code_line_chars; /* Same for the code line being rendered. */
+  GString *line_tail;    /* Rest of an over-long line, held back. */
+  /* Render budget; past it the rest of the document gets cheaper output. */
+  gint64 render_deadline; /* Monotonic usec; 0 when unlimited. */
+  guint degraded;         /* VIEWMD_DEGRADED_* */
   gboolean has_output;
   guint trailing_newlines;
+  ViewmdRenderIndex *index;
 } RenderCtx;
 
 static void viewmd_table_row_free(gpointer data) {
@@ -276,8 +308,12 @@ static void update_newline_state(RenderCtx *ctx, const gchar *text, gsize len) {
   for (gsize i = 0; i < len; i++) {
     if (text[i] == '\n') {
       ctx->trailing_newlines++;
+      ctx->line_chars = 0;
     } else {
       ctx->trailing_newlines = 0;
+      if (((guchar)text[i] & 0xC0) != 0x80) {
+        ctx->line_chars++;
+      }
     }
   }
 }
@@ -321,6 +357,33 @@ static void apply_active_tags(RenderCtx *ctx, gint start_offset,
   }
 }
 
+/* Ends the visible part of an over-long line with an expand control holding
+ * the rest. Expanding it reuses the collapsed code path; tags active here are
+ * reapplied to the text then, inline styles within it are not. */
+static void line_emit_truncated_tail(RenderCtx *ctx) {
+  ViewmdCollapsedCode *tail;
+  GtkTextChildAnchor *anchor;
+
+  if (!ctx->line_tail) {
+    return;
+  }
+
+  tail = g_new0(ViewmdCollapsedCode, 1);
+  tail->offset = gtk_text_iter_get_offset(&ctx->iter);
+  tail->line_count = 1;
+  tail->truncated_line = TRUE;
+  tail->text = g_string_free(ctx->line_tail, FALSE);
+  ctx->line_tail = NULL;
+
+  anchor = gtk_text_buffer_create_child_anchor(ctx->buffer, &ctx->iter);
+  g_object_set_data(G_OBJECT(anchor), VIEWMD_CODE_FOLD_ANCHOR_DATA,
+                    GINT_TO_POINTER(1));
+  tail->anchor = g_object_ref(anchor);
+  apply_active_tags(ctx, tail->offset, tail->offset + 1);
+  note_non_newline_output(ctx);
+  g_ptr_array_add(ctx->index->collapsed_code, tail);
+}
+
 static void insert_text(RenderCtx *ctx, const gchar *text, gsize len) {
   gint start_offset;
   gint end_offset;
@@ -329,9 +392,14 @@ static void insert_text(RenderCtx *ctx, const gchar *text, gsize len) {
     return;
   }
 
+  /* Anything not routed through insert_guarded_text ends the held line. */
+  line_emit_truncated_tail(ctx);
   start_offset = gtk_text_iter_get_offset(&ctx->iter);
   gtk_text_buffer_insert(ctx->buffer, &ctx->iter, text, (gint)len);
   end_offset = gtk_text_iter_get_offset(&ctx->iter);
+  if (ctx->code_text) {
+    g_string_append_len(ctx->code_text, text, (gssize)len);
+  }
 
   apply_active_tags(ctx, start_offset, end_offset);
   update_newline_state(ctx, text, len);
@@ -344,6 +412,70 @@ static void insert_cstr(RenderCtx *ctx, const gchar *text) {
   insert_text(ctx, text, strlen(text));
 }
 
+/* Inline text with the long line guard: once a line reaches long_line_limit
+ * chars the rest of it goes to line_tail until its newline. */
+static void insert_guarded_text(RenderCtx *ctx, const gchar *text) {
+  const gchar *p = text;
+
+  while (*p) {
+    const gchar *nl = strchr(p, '\n');
+    const gchar *line_end = nl ? nl : p + strlen(p);
+    const gchar *cut = p;
+
+    if (ctx->line_tail) {
+      g_string_append_len(ctx->line_tail, p, line_end - p);
+      if (!nl) {
+        return;
+      }
+      line_emit_truncated_tail(ctx);
+      p = nl;
+      continue;
+    }
+
+    for (guint room = ctx->long_line_limit - MIN(ctx->line_chars,
+                                                 ctx->long_line_limit);
+         room > 0 && cut < line_end; room--) {
+      cut = g_utf8_next_char(cut);
+    }
+    if (cut == line_end) {
+      cut = nl ? nl + 1 : line_end;
+      insert_text(ctx, p, (gsize)(cut - p));
+      p = cut;
+      continue;
+    }
+
+    insert_text(ctx, p, (gsize)(cut - p));
+    ctx->line_tail = g_string_new(NULL);
+    p = cut;
+  }
+}
+
+/* Code keeps its columns, so instead of hiding the rest of a long line it is
+ * broken every long_line_limit chars. NULL when text needs no break. */
+static gchar *code_break_long_lines(RenderCtx *ctx, const gchar *text) {
+  GString *out = NULL;
+
+  if (ctx->long_line_limit == 0) {
+    return NULL;
+  }
+
+  for (const gchar *p = text; *p; p = g_utf8_next_char(p)) {
+    if (*p == '\n') {
+      ctx->code_line_chars = 0;
+    } else if (++ctx->code_line_chars > ctx->long_line_limit) {
+      if (!out) {
+        out = g_string_new_len(text, p - text);
+      }
+      g_string_append_c(out, '\n');
+      ctx->code_line_chars = 1;
+    }
+    if (out) {
+      g_string_append_len(out, p, g_utf8_next_char(p) - p);
+    }
+  }
+  return out ? g_string_free(out, FALSE) : NULL;
+}
+
 static void ensure_newlines(RenderCtx *ctx, guint min_newlines) {
   if (!ctx || min_newlines == 0 || !ctx->has_output) {
     return;
@@ -475,77 +607,368 @@ static gchar *extract_code_language_from_detail(MD_BLOCK_CODE_DETAIL *code) {
 }
 
 typedef struct {
-  GtkTextBuffer *buffer;
-  gint line_offset;
-} CodeTagApplyContext;
+  GArray *tokens; /* ViewmdCodeToken */
+  gint line_offset; /* Char offset of the current line in the block. */
+  const gchar *line;
+  gboolean line_ascii;
+  /* Last byte offset converted in a non-ASCII line and its char offset;
+   * tokens arrive left to right, so each line is decoded about once. */
+  gint cursor_byte;
+  gint cursor_char;
+} CodeTokenContext;
+
+static gint code_token_char_offset(CodeTokenContext *tok, gint byte_offset) {
+  if (tok->line_ascii) {
+    return byte_offset;
+  }
+  if (byte_offset < tok->cursor_byte) {
+    tok->cursor_byte = 0;
+    tok->cursor_char = 0;
+  }
+  tok->cursor_char += (gint)g_utf8_strlen(tok->line + tok->cursor_byte,
+                                          byte_offset - tok->cursor_byte);
+  tok->cursor_byte = byte_offset;
+  return tok->cursor_char;
+}
 
-static void on_code_scan_token(gint start_char_offset, gint end_char_offset,
+static void on_code_scan_token(gint start_offset, gint end_offset,
                                const gchar *tag_name, gpointer user_data) {
-  CodeTagApplyContext *ctx = (CodeTagApplyContext *)user_data;
+  CodeTokenContext *tok = (CodeTokenContext *)user_data;
+  ViewmdCodeToken token;
 
-  if (!ctx || !ctx->buffer || !tag_name || end_char_offset <= start_char_offset) {
+  if (!tok || !tag_name || end_offset <= start_offset) {
     return;
   }
 
-  apply_tag_by_name_offsets(ctx->buffer, tag_name, ctx->line_offset + start_char_offset,
-                            ctx->line_offset + end_char_offset);
+  token.start_offset =
+      tok->line_offset + code_token_char_offset(tok, start_offset);
+  token.end_offset = tok->line_offset + code_token_char_offset(tok, end_offset);
+  for (token.tag_id = 0; token.tag_id < G_N_ELEMENTS(code_tag_names);
+       token.tag_id++) {
+    if (tag_name == code_tag_names[token.tag_id] ||
+        strcmp(tag_name, code_tag_names[token.tag_id]) == 0) {
+      g_array_append_val(tok->tokens, token);
+      return;
+    }
+  }
 }
 
-static void apply_code_highlighting_for_block(GtkTextBuffer *buffer,
-                                              const CodeBlockRange *range) {
-  GtkTextIter start;
-  GtkTextIter end;
-  gchar *text;
-  const gchar *line_start;
-  MarkydCodeScanState state = {0};
-  CodeTagApplyContext ctx = {0};
-  gint line_offset;
+static gint compare_code_tokens(gconstpointer a, gconstpointer b) {
+  const ViewmdCodeToken *ta = (const ViewmdCodeToken *)a;
+  const ViewmdCodeToken *tb = (const ViewmdCodeToken *)b;
+  return (ta->start_offset > tb->start_offset) -
+         (ta->start_offset < tb->start_offset);
+}
+
+/* Process-wide LRU of token arrays keyed by (language, text), so re-renders
+ * of unchanged blocks skip the scanner. Entries keep a copy of the text, and
+ * the hash only picks the bucket. Guarded by the mutex since workers consult
+ * it. */
+typedef struct {
+  const MarkydLanguageHighlight *language;
+  guint64 hash;
+  gsize len;
+  const gchar *text; /* Owned by the entry once inserted. */
+} CodeTokenCacheKey;
+
+typedef struct {
+  CodeTokenCacheKey key;
+  GArray *tokens;
+  GList link; /* In code_token_lru, most recent first. */
+} CodeTokenCacheEntry;
+
+static GMutex code_token_cache_lock;
+static GHashTable *code_token_cache;
+static GQueue code_token_lru = G_QUEUE_INIT;
+static gsize code_token_cache_bytes;
+
+static guint64 code_text_hash(const gchar *text, gsize len) {
+  guint64 hash = G_GUINT64_CONSTANT(14695981039346656037);
+  for (gsize i = 0; i < len; i++) {
+    hash ^= (guchar)text[i];
+    hash *= G_GUINT64_CONSTANT(1099511628211);
+  }
+  return hash;
+}
+
+static guint code_token_cache_key_hash(gconstpointer data) {
+  const CodeTokenCacheKey *key = (const CodeTokenCacheKey *)data;
+  return (guint)(key->hash ^ (key->hash >> 32));
+}
+
+static gboolean code_token_cache_key_equal(gconstpointer a, gconstpointer b) {
+  const CodeTokenCacheKey *ka = (const CodeTokenCacheKey *)a;
+  const CodeTokenCacheKey *kb = (const CodeTokenCacheKey *)b;
+  return ka->language == kb->language && ka->hash == kb->hash &&
+         ka->len == kb->len && memcmp(ka->text, kb->text, ka->len) == 0;
+}
+
+/* Heap bytes held by an entry: its copy of the text plus the token array. */
+static gsize code_token_cache_cost(const CodeTokenCacheEntry *entry) {
+  return sizeof(*entry) + entry->key.len + 1 +
+         (gsize)entry->tokens->len * g_array_get_element_size(entry->tokens);
+}
+
+/* Returns a new ref on the cached tokens, or NULL. */
+static GArray *code_token_cache_lookup(const CodeTokenCacheKey *key) {
+  CodeTokenCacheEntry *entry = NULL;
+  GArray *tokens = NULL;
+
+  g_mutex_lock(&code_token_cache_lock);
+  if (code_token_cache) {
+    entry = g_hash_table_lookup(code_token_cache, key);
+  }
+  if (entry) {
+    g_queue_unlink(&code_token_lru, &entry->link);
+    g_queue_push_head_link(&code_token_lru, &entry->link);
+    tokens = g_array_ref(entry->tokens);
+  }
+  g_mutex_unlock(&code_token_cache_lock);
+  return tokens;
+}
+
+/* Takes ownership of key->text. */
+static void code_token_cache_insert(const CodeTokenCacheKey *key,
+                                    GArray *tokens) {
+  CodeTokenCacheEntry *entry;
 
-  if (!buffer || !range || !range->language || range->end_offset <= range->start_offset) {
+  g_mutex_lock(&code_token_cache_lock);
+  if (!code_token_cache) {
+    code_token_cache = g_hash_table_new(code_token_cache_key_hash,
+                                        code_token_cache_key_equal);
+  }
+  if (g_hash_table_contains(code_token_cache, key)) {
+    g_mutex_unlock(&code_token_cache_lock);
+    g_free((gchar *)key->text);
     return;
   }
 
-  gtk_text_buffer_get_iter_at_offset(buffer, &start, range->start_offset);
-  gtk_text_buffer_get_iter_at_offset(buffer, &end, range->end_offset);
-  text = gtk_text_buffer_get_text(buffer, &start, &end, FALSE);
-  if (!text) {
+  entry = g_new0(CodeTokenCacheEntry, 1);
+  entry->key = *key;
+  entry->tokens = g_array_ref(tokens);
+  entry->link.data = entry;
+  g_hash_table_insert(code_token_cache, &entry->key, entry);
+  g_queue_push_head_link(&code_token_lru, &entry->link);
+  code_token_cache_bytes += code_token_cache_cost(entry);
+
+  while (code_token_cache_bytes > CODE_TOKEN_CACHE_MAX_BYTES &&
+         code_token_lru.length > 1) {
+    GList *last = g_queue_pop_tail_link(&code_token_lru);
+    CodeTokenCacheEntry *old = (CodeTokenCacheEntry *)last->data;
+
+    g_hash_table_remove(code_token_cache, &old->key);
+    code_token_cache_bytes -= code_token_cache_cost(old);
+    g_array_unref(old->tokens);
+    g_free((gchar *)old->key.text);
+    g_free(old);
+  }
+  g_mutex_unlock(&code_token_cache_lock);
+}
+
+/* Scan the block text line by line, splitting it in place. Touches nothing
+ * but the block, so it may run on any thread. */
+static void tokenize_code_block(ViewmdCodeBlock *block) {
+  MarkydCodeScanState state;
+  CodeTokenContext tok;
+  CodeTokenCacheKey key;
+  gchar *line = block->text;
+  gboolean block_ascii;
+
+  if (!block->language) {
+    block->language = markyd_code_guess_language(
+        block->text, strlen(block->text), block->guess_confidence);
+  }
+  if (!block->language) {
+    g_free(block->text);
+    block->text = NULL;
+    block->tokens = g_array_new(FALSE, FALSE, sizeof(ViewmdCodeToken));
     return;
   }
 
-  markyd_code_scan_state_reset(&state);
-  ctx.buffer = buffer;
-  line_offset = range->start_offset;
-  line_start = text;
+  key.language = block->language;
+  key.len = strlen(block->text);
+  key.hash = code_text_hash(block->text, key.len);
+  key.text = block->text;
+  block->tokens = code_token_cache_lookup(&key);
+  if (block->tokens) {
+    g_free(block->text);
+    block->text = NULL;
+    return;
+  }
+  /* The scan below splits block->text in place. */
+  key.text = g_strndup(block->text, key.len);
 
+  tok.tokens = g_array_new(FALSE, FALSE, sizeof(ViewmdCodeToken));
+  tok.line_offset = 0;
+  block_ascii = markyd_code_text_is_ascii(block->text, key.len);
+  markyd_code_scan_state_reset(&state);
   while (TRUE) {
-    const gchar *nl = strchr(line_start, '\n');
-    gsize len = nl ? (gsize)(nl - line_start) : strlen(line_start);
-    gchar *line = g_strndup(line_start, len);
+    gchar *nl = strchr(line, '\n');
+    gsize line_len = nl ? (gsize)(nl - line) : strlen(line);
 
-    ctx.line_offset = line_offset;
-    markyd_code_scan_line(range->language, line, &state, on_code_scan_token, &ctx);
-    line_offset += (gint)g_utf8_strlen(line, -1);
-    g_free(line);
+    if (nl) {
+      *nl = '\0';
+    }
+    tok.line = line;
+    tok.line_ascii = block_ascii || markyd_code_text_is_ascii(line, line_len);
+    tok.cursor_byte = 0;
+    tok.cursor_char = 0;
+    markyd_code_scan_line(block->language, line, &state, on_code_scan_token,
+                          &tok);
+    tok.line_offset += code_token_char_offset(&tok, (gint)line_len);
 
     if (!nl) {
       break;
     }
+    tok.line_offset += 1; /* '\n' */
+    line = nl + 1;
+  }
 
-    line_offset += 1; /* '\n' */
-    line_start = nl + 1;
+  for (guint i = 1; i < tok.tokens->len; i++) {
+    if (g_array_index(tok.tokens, ViewmdCodeToken, i).start_offset <
+        g_array_index(tok.tokens, ViewmdCodeToken, i - 1).start_offset) {
+      g_array_sort(tok.tokens, compare_code_tokens);
+      break;
+    }
   }
 
-  g_free(text);
+  g_free(block->text);
+  block->text = NULL;
+  block->tokens = tok.tokens;
+  code_token_cache_insert(&key, tok.tokens);
 }
 
-static void apply_code_highlighting(GtkTextBuffer *buffer, GArray *code_blocks) {
-  if (!buffer || !code_blocks || code_blocks->len == 0) {
+/* Apply sorted tokens relative to base with a single iter moving through the
+ * buffer. */
+static void apply_code_tokens(GtkTextBuffer *buffer, GArray *tokens, gint base) {
+  GtkTextTag *tags[G_N_ELEMENTS(code_tag_names)];
+  GtkTextIter start;
+  GtkTextIter end;
+  gint at;
+
+  if (!buffer || !tokens || tokens->len == 0) {
     return;
   }
 
-  for (guint i = 0; i < code_blocks->len; i++) {
-    CodeBlockRange *range = &g_array_index(code_blocks, CodeBlockRange, i);
-    apply_code_highlighting_for_block(buffer, range);
+  for (guint i = 0; i < G_N_ELEMENTS(code_tag_names); i++) {
+    tags[i] = lookup_tag(buffer, code_tag_names[i]);
+  }
+
+  at = g_array_index(tokens, ViewmdCodeToken, 0).start_offset;
+  gtk_text_buffer_get_iter_at_offset(buffer, &start, base + at);
+  for (guint i = 0; i < tokens->len; i++) {
+    ViewmdCodeToken *token = &g_array_index(tokens, ViewmdCodeToken, i);
+
+    if (token->start_offset - at < CODE_SPAN_WALK_LIMIT) {
+      gtk_text_iter_forward_chars(&start, token->start_offset - at);
+    } else {
+      gtk_text_iter_set_offset(&start, base + token->start_offset);
+    }
+    at = token->start_offset;
+
+    if (!tags[token->tag_id]) {
+      continue;
+    }
+    end = start;
+    gtk_text_iter_forward_chars(&end, token->end_offset - token->start_offset);
+    gtk_text_buffer_apply_tag(buffer, tags[token->tag_id], &start, &end);
+  }
+}
+
+static ViewmdCodeBlock *code_block_ref(ViewmdCodeBlock *block) {
+  g_atomic_int_inc(&block->ref_count);
+  return block;
+}
+
+static void code_block_unref(gpointer data) {
+  ViewmdCodeBlock *block = (ViewmdCodeBlock *)data;
+
+  if (!block || !g_atomic_int_dec_and_test(&block->ref_count)) {
+    return;
+  }
+  g_free(block->text);
+  if (block->tokens) {
+    g_array_unref(block->tokens);
+  }
+  g_free(block);
+}
+
+/* Dropped from the render index: workers that have not started skip it. */
+static void code_block_release(gpointer data) {
+  ViewmdCodeBlock *block = (ViewmdCodeBlock *)data;
+
+  if (!block) {
+    return;
+  }
+  g_atomic_int_compare_and_exchange(&block->state, VIEWMD_CODE_BLOCK_PENDING,
+                                    VIEWMD_CODE_BLOCK_CANCELLED);
+  code_block_unref(block);
+}
+
+static void code_tokenize_worker(gpointer data, gpointer user_data) {
+  ViewmdCodeBlock *block = (ViewmdCodeBlock *)data;
+  (void)user_data;
+
+  if (g_atomic_int_compare_and_exchange(&block->state, VIEWMD_CODE_BLOCK_PENDING,
+                                        VIEWMD_CODE_BLOCK_TOKENIZING)) {
+    tokenize_code_block(block);
+    g_atomic_int_set(&block->state, VIEWMD_CODE_BLOCK_TOKENIZED);
+  }
+  code_block_unref(block);
+}
+
+/* Blocks always start from a reset scan state, so they are independent. */
+static GThreadPool *code_tokenize_pool(void) {
+  static GThreadPool *pool = NULL;
+
+  if (g_once_init_enter(&pool)) {
+    GThreadPool *created = g_thread_pool_new(
+        code_tokenize_worker, NULL, (gint)MAX(g_get_num_processors(), 1), FALSE,
+        NULL);
+    g_once_init_leave(&pool, created);
+  }
+  return pool;
+}
+
+void markdown_tokenize_code_blocks_async(ViewmdRenderIndex *index) {
+  GThreadPool *pool;
+
+  if (!index || index->code_blocks->len == 0) {
+    return;
+  }
+
+  pool = code_tokenize_pool();
+  for (guint i = 0; i < index->code_blocks->len; i++) {
+    ViewmdCodeBlock *block = g_ptr_array_index(index->code_blocks, i);
+    if (g_atomic_int_get(&block->state) == VIEWMD_CODE_BLOCK_PENDING) {
+      g_thread_pool_push(pool, code_block_ref(block), NULL);
+    }
+  }
+}
+
+gboolean markdown_highlight_code_block(GtkTextBuffer *buffer,
+                                       ViewmdCodeBlock *block) {
+  if (!buffer || !block) {
+    return TRUE;
+  }
+
+  if (g_atomic_int_compare_and_exchange(&block->state, VIEWMD_CODE_BLOCK_PENDING,
+                                        VIEWMD_CODE_BLOCK_TOKENIZING)) {
+    tokenize_code_block(block);
+    g_atomic_int_set(&block->state, VIEWMD_CODE_BLOCK_TOKENIZED);
+  }
+
+  switch (g_atomic_int_get(&block->state)) {
+  case VIEWMD_CODE_BLOCK_TOKENIZING:
+    return FALSE;
+  case VIEWMD_CODE_BLOCK_TOKENIZED:
+    apply_code_tokens(buffer, block->tokens, block->start_offset);
+    g_array_unref(block->tokens);
+    block->tokens = NULL;
+    g_atomic_int_set(&block->state, VIEWMD_CODE_BLOCK_APPLIED);
+    return TRUE;
+  default:
+    return TRUE;
   }
 }
 
@@ -605,13 +1028,6 @@ gchar *markdown_normalize_anchor_slug(const gchar *text) {
   return g_string_free(out, FALSE);
 }
 
-gchar *markdown_anchor_mark_name(const gchar *fragment) {
-  gchar *slug = markdown_normalize_anchor_slug(fragment);
-  gchar *name = g_strdup_printf("%s%s", VIEWMD_ANCHOR_MARK_PREFIX, slug);
-  g_free(slug);
-  return name;
-}
-
 static void capture_heading_text(RenderCtx *ctx, const gchar *text) {
   if (!ctx || !ctx->in_heading || !ctx->heading_text || !text) {
     return;
@@ -621,12 +1037,32 @@ static void capture_heading_text(RenderCtx *ctx, const gchar *text) {
   }
 }
 
+static void record_heading(RenderCtx *ctx, const gchar *slug) {
+  ViewmdRenderHeading heading;
+
+  if (!ctx || !ctx->index || !ctx->heading_text) {
+    return;
+  }
+
+  heading.start_offset = ctx->heading_start_offset;
+  heading.level = ctx->heading_level;
+  heading.text = g_strstrip(g_strdup(ctx->heading_text->str));
+  heading.slug = g_strdup(slug);
+  heading.folded = g_utf8_casefold(heading.text, -1);
+  heading.char_mask = markyd_fuzzy_char_mask(heading.folded);
+  /* A literal "foo-1" heading can collide with a deduplicated one; the
+   * earlier heading keeps the anchor. */
+  if (slug && !g_hash_table_contains(ctx->index->anchors, slug)) {
+    g_hash_table_insert(ctx->index->anchors, g_strdup(slug),
+                        GUINT_TO_POINTER(ctx->index->headings->len + 1));
+  }
+  g_array_append_val(ctx->index->headings, heading);
+}
+
 static void create_heading_anchor(RenderCtx *ctx) {
   gchar *base;
   guint count;
   gchar *slug;
-  gchar *mark_name;
-  GtkTextIter at;
 
   if (!ctx || !ctx->heading_text) {
     return;
@@ -635,18 +1071,15 @@ static void create_heading_anchor(RenderCtx *ctx) {
   base = markdown_normalize_anchor_slug(ctx->heading_text->str);
   if (!base || base[0] == '\0') {
     g_free(base);
+    record_heading(ctx, NULL);
     return;
   }
 
   count = GPOINTER_TO_UINT(g_hash_table_lookup(ctx->anchor_counts, base));
   slug = (count == 0) ? g_strdup(base) : g_strdup_printf("%s-%u", base, count);
   g_hash_table_replace(ctx->anchor_counts, g_strdup(base), GUINT_TO_POINTER(count + 1));
+  record_heading(ctx, slug);
 
-  mark_name = g_strdup_printf("%s%s", VIEWMD_ANCHOR_MARK_PREFIX, slug);
-  gtk_text_buffer_get_iter_at_offset(ctx->buffer, &at, ctx->heading_start_offset);
-  gtk_text_buffer_create_mark(ctx->buffer, mark_name, &at, TRUE);
-
-  g_free(mark_name);
   g_free(slug);
   g_free(base);
 }
@@ -678,6 +1111,60 @@ static gchar *table_cell_markup_to_plain(const gchar *markup) {
   return g_strdup(markup);
 }
 
+/* Plain cell text padded to column width, with a rule under the header. */
+static gchar *table_format_plain(const ViewmdTable *table) {
+  guint cols = table->col_count;
+  guint *widths = g_new0(guint, cols);
+  GPtrArray *cells = g_ptr_array_new_with_free_func(g_free);
+  GString *out = g_string_new(NULL);
+
+  for (guint r = 0; r < table->rows->len; r++) {
+    ViewmdTableRow *row = g_ptr_array_index(table->rows, r);
+    for (guint c = 0; c < cols; c++) {
+      const gchar *markup = row && c < row->cells->len
+                                ? g_ptr_array_index(row->cells, c)
+                                : NULL;
+      gchar *plain = table_cell_markup_to_plain(markup ? markup : "");
+      widths[c] = MAX(widths[c], (guint)g_utf8_strlen(plain, -1));
+      g_ptr_array_add(cells, plain);
+    }
+  }
+
+  for (guint r = 0; r < table->rows->len; r++) {
+    ViewmdTableRow *row = g_ptr_array_index(table->rows, r);
+    ViewmdTableRow *next =
+        r + 1 < table->rows->len ? g_ptr_array_index(table->rows, r + 1) : NULL;
+
+    for (guint c = 0; c < cols; c++) {
+      const gchar *plain = g_ptr_array_index(cells, r * cols + c);
+      g_string_append(out, c > 0 ? " | " : "");
+      g_string_append(out, plain);
+      if (c + 1 < cols) {
+        for (guint pad = (guint)g_utf8_strlen(plain, -1); pad < widths[c];
+             pad++) {
+          g_string_append_c(out, ' ');
+        }
+      }
+    }
+    if (row && row->is_header && !(next && next->is_header)) {
+      g_string_append_c(out, '\n');
+      for (guint c = 0; c < cols; c++) {
+        g_string_append(out, c > 0 ? "-+-" : "");
+        for (guint dash = 0; dash < MAX(widths[c], 1); dash++) {
+          g_string_append_c(out, '-');
+        }
+      }
+    }
+    if (next) {
+      g_string_append_c(out, '\n');
+    }
+  }
+
+  g_ptr_array_free(cells, TRUE);
+  g_free(widths);
+  return g_string_free(out, FALSE);
+}
+
 static void table_search_index_free(gpointer data) {
   ViewmdTableSearchIndex *index = (ViewmdTableSearchIndex *)data;
   if (!index) {
@@ -689,6 +1176,894 @@ static void table_search_index_free(gpointer data) {
   g_free(index);
 }
 
+static void render_index_table_release(gpointer data) {
+  ViewmdTableSearchIndex *table = (ViewmdTableSearchIndex *)data;
+  /* The search index is owned by the anchor and may be freed here. */
+  if (table && table->anchor) {
+    g_object_unref(table->anchor);
+  }
+}
+
+static void render_heading_clear(gpointer data) {
+  ViewmdRenderHeading *heading = (ViewmdRenderHeading *)data;
+  g_free(heading->text);
+  g_free(heading->slug);
+  g_free(heading->folded);
+}
+
+static void collapsed_code_free(gpointer data) {
+  ViewmdCollapsedCode *code = (ViewmdCollapsedCode *)data;
+  if (!code) {
+    return;
+  }
+  g_object_unref(code->anchor);
+  g_free(code->text);
+  markyd_text_snapshot_unref(code->snapshot);
+  g_free(code);
+}
+
+static void folded_section_free(gpointer data);
+
+ViewmdRenderIndex *markdown_render_index_new(void) {
+  ViewmdRenderIndex *index = g_new0(ViewmdRenderIndex, 1);
+  index->tables = g_ptr_array_new_with_free_func(render_index_table_release);
+  index->headings = g_array_new(FALSE, FALSE, sizeof(ViewmdRenderHeading));
+  g_array_set_clear_func(index->headings, render_heading_clear);
+  index->anchors = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+  index->code_blocks = g_ptr_array_new_with_free_func(code_block_release);
+  index->collapsed_code = g_ptr_array_new_with_free_func(collapsed_code_free);
+  index->folded_sections = g_ptr_array_new_with_free_func(folded_section_free);
+  return index;
+}
+
+void markdown_render_index_clear(ViewmdRenderIndex *index) {
+  if (!index) {
+    return;
+  }
+  g_ptr_array_set_size(index->tables, 0);
+  g_array_set_size(index->headings, 0);
+  g_hash_table_remove_all(index->anchors);
+  g_ptr_array_set_size(index->code_blocks, 0);
+  g_ptr_array_set_size(index->collapsed_code, 0);
+  g_ptr_array_set_size(index->folded_sections, 0);
+  index->anchors_stale = FALSE;
+  index->degraded = 0;
+}
+
+void markdown_render_index_free(ViewmdRenderIndex *index) {
+  if (!index) {
+    return;
+  }
+  g_ptr_array_free(index->tables, TRUE);
+  g_array_free(index->headings, TRUE);
+  g_hash_table_destroy(index->anchors);
+  g_ptr_array_free(index->code_blocks, TRUE);
+  g_ptr_array_free(index->collapsed_code, TRUE);
+  g_ptr_array_free(index->folded_sections, TRUE);
+  g_free(index);
+}
+
+guint markdown_render_index_first_code_block(const ViewmdRenderIndex *index,
+                                             gint offset) {
+  guint lo = 0;
+  guint hi;
+
+  if (!index) {
+    return 0;
+  }
+
+  hi = index->code_blocks->len;
+  while (lo < hi) {
+    guint mid = lo + (hi - lo) / 2;
+    ViewmdCodeBlock *block = g_ptr_array_index(index->code_blocks, mid);
+    if (block->end_offset <= offset) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  return lo;
+}
+
+/* Slugs are unique per render, so the first heading with one owns it. */
+static void render_index_rebuild_anchors(ViewmdRenderIndex *index) {
+  g_hash_table_remove_all(index->anchors);
+  for (guint i = 0; i < index->headings->len; i++) {
+    const gchar *slug =
+        g_array_index(index->headings, ViewmdRenderHeading, i).slug;
+    if (slug && !g_hash_table_contains(index->anchors, slug)) {
+      g_hash_table_insert(index->anchors, g_strdup(slug),
+                          GUINT_TO_POINTER(i + 1));
+    }
+  }
+  index->anchors_stale = FALSE;
+}
+
+gint markdown_render_index_lookup_anchor(ViewmdRenderIndex *index,
+                                         const gchar *fragment) {
+  gchar *slug;
+  guint found;
+
+  if (!index || !fragment) {
+    return -1;
+  }
+
+  if (index->anchors_stale) {
+    render_index_rebuild_anchors(index);
+  }
+  slug = markdown_normalize_anchor_slug(fragment);
+  found = GPOINTER_TO_UINT(g_hash_table_lookup(index->anchors, slug));
+  g_free(slug);
+  return (gint)found - 1;
+}
+
+gint markdown_render_index_heading_at(const ViewmdRenderIndex *index,
+                                      gint offset) {
+  guint lo = 0;
+  guint hi;
+
+  if (!index) {
+    return -1;
+  }
+
+  hi = index->headings->len;
+  while (lo < hi) {
+    guint mid = lo + (hi - lo) / 2;
+    if (g_array_index(index->headings, ViewmdRenderHeading, mid).start_offset <=
+        offset) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  return (gint)lo - 1;
+}
+
+ViewmdTableSearchIndex *markdown_render_index_lookup_table(
+    const ViewmdRenderIndex *index, gint start_offset, gint end_offset) {
+  guint lo = 0;
+  guint hi;
+  ViewmdTableSearchIndex *table;
+
+  if (!index || end_offset <= start_offset) {
+    return NULL;
+  }
+
+  /* First table ending after start_offset; tables never overlap. */
+  hi = index->tables->len;
+  while (lo < hi) {
+    guint mid = lo + (hi - lo) / 2;
+    table = g_ptr_array_index(index->tables, mid);
+    if (table->end_offset <= start_offset) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+
+  if (lo >= index->tables->len) {
+    return NULL;
+  }
+  table = g_ptr_array_index(index->tables, lo);
+  return table->start_offset < end_offset ? table : NULL;
+}
+
+const ViewmdTableSearchCellRange *
+markdown_table_search_index_lookup_cell(const ViewmdTableSearchIndex *table,
+                                        gint start_offset, gint end_offset) {
+  GArray *cells;
+  guint first;
+  guint lo;
+  guint hi;
+
+  if (!table || !table->cells || table->cells->len == 0) {
+    return NULL;
+  }
+  cells = table->cells;
+
+  lo = 0;
+  hi = cells->len;
+  while (lo < hi) {
+    guint mid = lo + (hi - lo) / 2;
+    if (g_array_index(cells, ViewmdTableSearchCellRange, mid).end_offset <=
+        start_offset) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  first = lo;
+  if (first >= cells->len) {
+    return NULL;
+  }
+  if (g_array_index(cells, ViewmdTableSearchCellRange, first).start_offset <=
+      start_offset) {
+    return &g_array_index(cells, ViewmdTableSearchCellRange, first);
+  }
+
+  /* Match starts in a separator: prefer the last cell it reaches into. */
+  lo = first;
+  hi = cells->len;
+  while (lo < hi) {
+    guint mid = lo + (hi - lo) / 2;
+    if (g_array_index(cells, ViewmdTableSearchCellRange, mid).start_offset <
+        end_offset) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  if (lo > first) {
+    return &g_array_index(cells, ViewmdTableSearchCellRange, lo - 1);
+  }
+  return NULL;
+}
+
+static void shift_offset(gint *offset, gint from_offset, gint delta) {
+  if (*offset >= from_offset) {
+    *offset += delta;
+  }
+}
+
+typedef gint (*RenderIndexOffsetFunc)(gconstpointer entry);
+
+static gint table_entry_offset(gconstpointer entry) {
+  return ((const ViewmdTableSearchIndex *)entry)->start_offset;
+}
+
+static gint code_block_entry_offset(gconstpointer entry) {
+  return ((const ViewmdCodeBlock *)entry)->start_offset;
+}
+
+static gint collapsed_code_entry_offset(gconstpointer entry) {
+  return ((const ViewmdCollapsedCode *)entry)->offset;
+}
+
+static gint folded_section_entry_offset(gconstpointer entry) {
+  return ((const ViewmdFoldedSection *)entry)->offset;
+}
+
+/* Index of the first entry starting at or after offset. */
+static guint ptr_array_lower_bound(GPtrArray *array, gint offset,
+                                   RenderIndexOffsetFunc entry_offset) {
+  guint lo = 0;
+  guint hi = array->len;
+
+  while (lo < hi) {
+    guint mid = lo + (hi - lo) / 2;
+    if (entry_offset(g_ptr_array_index(array, mid)) < offset) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  return lo;
+}
+
+static guint heading_lower_bound(GArray *headings, gint offset) {
+  guint lo = 0;
+  guint hi = headings->len;
+
+  while (lo < hi) {
+    guint mid = lo + (hi - lo) / 2;
+    if (g_array_index(headings, ViewmdRenderHeading, mid).start_offset <
+        offset) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  return lo;
+}
+
+/* Entries are sorted and never overlap, so only the range entry just before
+ * the lower bound can reach past from_offset. */
+void markdown_render_index_shift(ViewmdRenderIndex *index, gint from_offset,
+                                 gint delta) {
+  guint first;
+
+  if (!index || delta == 0) {
+    return;
+  }
+
+  first = ptr_array_lower_bound(index->tables, from_offset, table_entry_offset);
+  for (guint i = first > 0 ? first - 1 : 0; i < index->tables->len; i++) {
+    ViewmdTableSearchIndex *table = g_ptr_array_index(index->tables, i);
+    shift_offset(&table->start_offset, from_offset, delta);
+    shift_offset(&table->end_offset, from_offset, delta);
+    for (guint c = 0; table->cells && c < table->cells->len; c++) {
+      ViewmdTableSearchCellRange *cell =
+          &g_array_index(table->cells, ViewmdTableSearchCellRange, c);
+      shift_offset(&cell->start_offset, from_offset, delta);
+      shift_offset(&cell->end_offset, from_offset, delta);
+    }
+  }
+  for (guint i = heading_lower_bound(index->headings, from_offset);
+       i < index->headings->len; i++) {
+    g_array_index(index->headings, ViewmdRenderHeading, i).start_offset += delta;
+  }
+  /* Workers never read block offsets, so these can move under them. */
+  first = ptr_array_lower_bound(index->code_blocks, from_offset,
+                                code_block_entry_offset);
+  for (guint i = first > 0 ? first - 1 : 0; i < index->code_blocks->len; i++) {
+    ViewmdCodeBlock *block = g_ptr_array_index(index->code_blocks, i);
+    shift_offset(&block->start_offset, from_offset, delta);
+    shift_offset(&block->end_offset, from_offset, delta);
+  }
+  for (guint i = ptr_array_lower_bound(index->collapsed_code, from_offset,
+                                       collapsed_code_entry_offset);
+       i < index->collapsed_code->len; i++) {
+    ViewmdCollapsedCode *code = g_ptr_array_index(index->collapsed_code, i);
+    code->offset += delta;
+  }
+  for (guint i = ptr_array_lower_bound(index->folded_sections, from_offset,
+                                       folded_section_entry_offset);
+       i < index->folded_sections->len; i++) {
+    ViewmdFoldedSection *fold = g_ptr_array_index(index->folded_sections, i);
+    fold->offset += delta;
+  }
+}
+
+ViewmdCollapsedCode *
+markdown_render_index_lookup_collapsed(const ViewmdRenderIndex *index,
+                                       GtkTextChildAnchor *anchor) {
+  if (!index || !anchor) {
+    return NULL;
+  }
+  for (guint i = 0; i < index->collapsed_code->len; i++) {
+    ViewmdCollapsedCode *code = g_ptr_array_index(index->collapsed_code, i);
+    if (code->anchor == anchor) {
+      return code;
+    }
+  }
+  return NULL;
+}
+
+MarkydTextSnapshot *markdown_collapsed_code_snapshot(ViewmdCollapsedCode *code) {
+  if (!code) {
+    return NULL;
+  }
+  if (!code->snapshot) {
+    code->snapshot = markyd_text_snapshot_new(code->text, -1, 0);
+  }
+  return code->snapshot;
+}
+
+/* The block's old tokens only covered the preview; a fresh block tokenizes
+ * the whole text again so multi-line state carries into the tail. */
+static void requeue_expanded_code_block(GtkTextBuffer *buffer,
+                                        ViewmdRenderIndex *index,
+                                        gint control_offset, gint end_offset) {
+  guint i = markdown_render_index_first_code_block(index, control_offset - 1);
+  ViewmdCodeBlock *old;
+  ViewmdCodeBlock *block;
+  GtkTextIter start;
+  GtkTextIter end;
+
+  if (i >= index->code_blocks->len) {
+    return;
+  }
+  old = g_ptr_array_index(index->code_blocks, i);
+  if (old->end_offset != control_offset) {
+    return;
+  }
+
+  block = g_new0(ViewmdCodeBlock, 1);
+  block->ref_count = 1;
+  block->state = VIEWMD_CODE_BLOCK_PENDING;
+  block->start_offset = old->start_offset;
+  block->end_offset = end_offset;
+  /* A worker may be writing a guessed language into old at any time, so only
+   * the fence label carries over; the full text is guessed again. */
+  block->language = old->fence_language;
+  block->fence_language = old->fence_language;
+  block->guess_confidence = old->guess_confidence;
+  gtk_text_buffer_get_iter_at_offset(buffer, &start, block->start_offset);
+  gtk_text_buffer_get_iter_at_offset(buffer, &end, block->end_offset);
+  block->text = gtk_text_buffer_get_text(buffer, &start, &end, TRUE);
+
+  code_block_release(old);
+  g_ptr_array_index(index->code_blocks, i) = block;
+}
+
+gboolean markdown_expand_collapsed_code(GtkTextBuffer *buffer,
+                                        ViewmdRenderIndex *index,
+                                        ViewmdCollapsedCode *code) {
+  GtkTextIter start;
+  GtkTextIter end;
+  GSList *tags;
+  guint position = 0;
+  gint offset;
+  gint removed;
+  gint inserted;
+
+  if (!buffer || !index || !code) {
+    return FALSE;
+  }
+  while (position < index->collapsed_code->len &&
+         g_ptr_array_index(index->collapsed_code, position) != code) {
+    position++;
+  }
+  if (position == index->collapsed_code->len) {
+    return FALSE;
+  }
+
+  /* The control is the anchor plus its newline unless the tail lacks one. */
+  gtk_text_buffer_get_iter_at_child_anchor(buffer, &start, code->anchor);
+  offset = gtk_text_iter_get_offset(&start);
+  tags = gtk_text_iter_get_tags(&start);
+  removed = g_str_has_suffix(code->text, "\n") ? 2 : 1;
+  end = start;
+  gtk_text_iter_forward_chars(&end, removed);
+  gtk_text_buffer_delete(buffer, &start, &end);
+
+  inserted = (gint)g_utf8_strlen(code->text, -1);
+  gtk_text_buffer_insert(buffer, &start, code->text, -1);
+  gtk_text_buffer_get_iter_at_offset(buffer, &end, offset);
+  for (GSList *node = tags; node; node = node->next) {
+    gtk_text_buffer_apply_tag(buffer, GTK_TEXT_TAG(node->data), &end, &start);
+  }
+  g_slist_free(tags);
+
+  g_ptr_array_remove_index(index->collapsed_code, position);
+  markdown_render_index_shift(index, offset + removed, inserted - removed);
+  requeue_expanded_code_block(buffer, index, offset, offset + inserted);
+  return TRUE;
+}
+
+/* Move count entries of from, starting at first, to the end of to without
+ * running from's free func on them. */
+static void ptr_array_move_range(GPtrArray *from, guint first, guint count,
+                                 GPtrArray *to) {
+  if (count == 0) {
+    return;
+  }
+  for (guint i = 0; i < count; i++) {
+    g_ptr_array_add(to, g_ptr_array_index(from, first + i));
+  }
+  memmove(&from->pdata[first], &from->pdata[first + count],
+          (from->len - first - count) * sizeof(gpointer));
+  /* The free funcs skip the NULL slots dropped from the end. */
+  memset(&from->pdata[from->len - count], 0, count * sizeof(gpointer));
+  g_ptr_array_set_size(from, from->len - count);
+}
+
+/* Insert every entry of from into to at position and leave from empty. */
+static void ptr_array_splice(GPtrArray *to, guint position, GPtrArray *from) {
+  guint count = from->len;
+  guint tail = to->len - position;
+
+  if (count == 0) {
+    return;
+  }
+  g_ptr_array_set_size(to, to->len + count);
+  memmove(&to->pdata[position + count], &to->pdata[position],
+          tail * sizeof(gpointer));
+  memcpy(&to->pdata[position], from->pdata, count * sizeof(gpointer));
+  memset(from->pdata, 0, count * sizeof(gpointer));
+  g_ptr_array_set_size(from, 0);
+}
+
+static void ptr_array_move_offsets(GPtrArray *from, gint start_offset,
+                                   gint end_offset,
+                                   RenderIndexOffsetFunc entry_offset,
+                                   GPtrArray *to) {
+  guint first = ptr_array_lower_bound(from, start_offset, entry_offset);
+  guint last = ptr_array_lower_bound(from, end_offset, entry_offset);
+  ptr_array_move_range(from, first, last - first, to);
+}
+
+static void ptr_array_splice_sorted(GPtrArray *to, GPtrArray *from,
+                                    RenderIndexOffsetFunc entry_offset) {
+  if (from->len > 0) {
+    ptr_array_splice(
+        to,
+        ptr_array_lower_bound(to, entry_offset(g_ptr_array_index(from, 0)),
+                              entry_offset),
+        from);
+  }
+}
+
+/* Move the entries of from lying in [start_offset, end_offset) to the end of
+ * to. Sections end at headings, so no entry straddles the range. */
+static void render_index_move_range(ViewmdRenderIndex *from, gint start_offset,
+                                    gint end_offset, ViewmdRenderIndex *to) {
+  guint first = heading_lower_bound(from->headings, start_offset);
+  guint count = heading_lower_bound(from->headings, end_offset) - first;
+
+  ptr_array_move_offsets(from->tables, start_offset, end_offset,
+                         table_entry_offset, to->tables);
+  if (count > 0) {
+    g_array_append_vals(to->headings,
+                        &g_array_index(from->headings, ViewmdRenderHeading,
+                                       first),
+                        count);
+    /* The strings now belong to to; clear them before the removal frees. */
+    memset(&g_array_index(from->headings, ViewmdRenderHeading, first), 0,
+           count * sizeof(ViewmdRenderHeading));
+    g_array_remove_range(from->headings, first, count);
+    from->anchors_stale = TRUE;
+    to->anchors_stale = TRUE;
+  }
+  ptr_array_move_offsets(from->code_blocks, start_offset, end_offset,
+                         code_block_entry_offset, to->code_blocks);
+  ptr_array_move_offsets(from->collapsed_code, start_offset, end_offset,
+                         collapsed_code_entry_offset, to->collapsed_code);
+  ptr_array_move_offsets(from->folded_sections, start_offset, end_offset,
+                         folded_section_entry_offset, to->folded_sections);
+}
+
+/* Merge every entry of from into to and leave from empty. The entries must
+ * fall in a range of to that holds none. */
+static void render_index_splice(ViewmdRenderIndex *to, ViewmdRenderIndex *from) {
+  ptr_array_splice_sorted(to->tables, from->tables, table_entry_offset);
+  if (from->headings->len > 0) {
+    g_array_insert_vals(
+        to->headings,
+        heading_lower_bound(
+            to->headings,
+            g_array_index(from->headings, ViewmdRenderHeading, 0).start_offset),
+        from->headings->data, from->headings->len);
+    memset(from->headings->data, 0,
+           from->headings->len * sizeof(ViewmdRenderHeading));
+    g_array_set_size(from->headings, 0);
+    to->anchors_stale = TRUE;
+  }
+  ptr_array_splice_sorted(to->code_blocks, from->code_blocks,
+                          code_block_entry_offset);
+  ptr_array_splice_sorted(to->collapsed_code, from->collapsed_code,
+                          collapsed_code_entry_offset);
+  ptr_array_splice_sorted(to->folded_sections, from->folded_sections,
+                          folded_section_entry_offset);
+}
+
+static void folded_section_free(gpointer data) {
+  ViewmdFoldedSection *fold = (ViewmdFoldedSection *)data;
+
+  if (!fold) {
+    return;
+  }
+  g_object_unref(fold->anchor);
+  g_free(fold->text);
+  g_array_free(fold->tag_runs, TRUE);
+  for (guint i = 0; i < fold->anchors->len; i++) {
+    g_object_unref(g_array_index(fold->anchors, ViewmdFoldAnchor, i).anchor);
+  }
+  g_array_free(fold->anchors, TRUE);
+  markdown_render_index_free(fold->index);
+  g_free(fold);
+}
+
+ViewmdFoldedSection *
+markdown_render_index_lookup_fold(const ViewmdRenderIndex *index,
+                                  GtkTextChildAnchor *anchor) {
+  if (!index || !anchor) {
+    return NULL;
+  }
+  for (guint i = 0; i < index->folded_sections->len; i++) {
+    ViewmdFoldedSection *fold = g_ptr_array_index(index->folded_sections, i);
+    if (fold->anchor == anchor) {
+      return fold;
+    }
+  }
+  return NULL;
+}
+
+ViewmdFoldedSection *markdown_render_index_fold_at(const ViewmdRenderIndex *index,
+                                                   gint offset) {
+  guint i;
+  ViewmdFoldedSection *fold;
+
+  if (!index) {
+    return NULL;
+  }
+  i = ptr_array_lower_bound(index->folded_sections, offset,
+                            folded_section_entry_offset);
+  if (i >= index->folded_sections->len) {
+    return NULL;
+  }
+  fold = g_ptr_array_index(index->folded_sections, i);
+  return fold->offset == offset ? fold : NULL;
+}
+
+ViewmdFoldedSection *
+markdown_render_index_fold_with_anchor(ViewmdRenderIndex *index,
+                                       const gchar *fragment) {
+  if (!index || !fragment) {
+    return NULL;
+  }
+  for (guint i = 0; i < index->folded_sections->len; i++) {
+    ViewmdFoldedSection *fold = g_ptr_array_index(index->folded_sections, i);
+    if (markdown_render_index_lookup_anchor(fold->index, fragment) >= 0 ||
+        markdown_render_index_fold_with_anchor(fold->index, fragment)) {
+      return fold;
+    }
+  }
+  return NULL;
+}
+
+static void fold_open_tag(GHashTable *open, GtkTextTag *tag, gint offset) {
+  if (!g_object_get_data(G_OBJECT(tag), VIEWMD_TRANSIENT_TAG_DATA)) {
+    g_hash_table_insert(open, tag, GINT_TO_POINTER(offset + 1));
+  }
+}
+
+static void fold_close_tag(GHashTable *open, GtkTextTag *tag, gint offset,
+                           GArray *runs) {
+  gpointer start = g_hash_table_lookup(open, tag);
+  ViewmdFoldTagRun run;
+
+  if (!start) {
+    return;
+  }
+  run.start_offset = GPOINTER_TO_INT(start) - 1;
+  run.end_offset = offset;
+  run.tag = tag;
+  if (run.end_offset > run.start_offset) {
+    g_array_append_val(runs, run);
+  }
+  g_hash_table_remove(open, tag);
+}
+
+/* Record tag ranges over [start, end) relative to start by walking toggles,
+ * so the cost follows the number of tag changes rather than characters. */
+static void fold_capture_tags(const GtkTextIter *start, const GtkTextIter *end,
+                              GArray *runs) {
+  GHashTable *open = g_hash_table_new(NULL, NULL);
+  gint base = gtk_text_iter_get_offset(start);
+  gint length = gtk_text_iter_get_offset(end) - base;
+  GtkTextIter iter = *start;
+  GHashTableIter it;
+  gpointer tag;
+  gpointer opened;
+  GSList *tags;
+
+  tags = gtk_text_iter_get_tags(&iter);
+  for (GSList *node = tags; node; node = node->next) {
+    fold_open_tag(open, GTK_TEXT_TAG(node->data), 0);
+  }
+  g_slist_free(tags);
+
+  while (gtk_text_iter_forward_to_tag_toggle(&iter, NULL) &&
+         gtk_text_iter_compare(&iter, end) < 0) {
+    gint at = gtk_text_iter_get_offset(&iter) - base;
+
+    tags = gtk_text_iter_get_toggled_tags(&iter, FALSE);
+    for (GSList *node = tags; node; node = node->next) {
+      fold_close_tag(open, GTK_TEXT_TAG(node->data), at, runs);
+    }
+    g_slist_free(tags);
+    tags = gtk_text_iter_get_toggled_tags(&iter, TRUE);
+    for (GSList *node = tags; node; node = node->next) {
+      fold_open_tag(open, GTK_TEXT_TAG(node->data), at);
+    }
+    g_slist_free(tags);
+  }
+
+  g_hash_table_iter_init(&it, open);
+  while (g_hash_table_iter_next(&it, &tag, &opened)) {
+    ViewmdFoldTagRun run;
+    run.start_offset = GPOINTER_TO_INT(opened) - 1;
+    run.end_offset = length;
+    run.tag = GTK_TEXT_TAG(tag);
+    if (run.end_offset > run.start_offset) {
+      g_array_append_val(runs, run);
+    }
+  }
+  g_hash_table_destroy(open);
+}
+
+/* Child anchors show up in the slice as U+FFFC; a literal U+FFFC in the
+ * text has no anchor at its position and stays text. */
+static void fold_capture_anchors(GtkTextBuffer *buffer, ViewmdFoldedSection *fold) {
+  const gchar *p = fold->text;
+  const gchar *hit;
+  gint offset = fold->offset;
+  GtkTextIter iter;
+
+  while ((hit = strstr(p, "\xEF\xBF\xBC")) != NULL) {
+    GtkTextChildAnchor *anchor;
+
+    offset += (gint)g_utf8_strlen(p, hit - p);
+    gtk_text_buffer_get_iter_at_offset(buffer, &iter, offset);
+    anchor = gtk_text_iter_get_child_anchor(&iter);
+    if (anchor) {
+      ViewmdFoldAnchor record;
+      record.byte_offset = (gsize)(hit - fold->text);
+      record.anchor = g_object_ref(anchor);
+      g_array_append_val(fold->anchors, record);
+    }
+    offset++;
+    p = hit + 3;
+  }
+}
+
+gboolean markdown_fold_section(GtkTextBuffer *buffer, ViewmdRenderIndex *index,
+                               guint heading) {
+  ViewmdRenderHeading *owner;
+  ViewmdFoldedSection *fold;
+  GtkTextChildAnchor *anchor;
+  GtkTextIter start;
+  GtkTextIter end;
+  gint start_offset;
+  gint end_offset;
+  guint next;
+
+  if (!buffer || !index || heading >= index->headings->len) {
+    return FALSE;
+  }
+
+  owner = &g_array_index(index->headings, ViewmdRenderHeading, heading);
+  gtk_text_buffer_get_iter_at_offset(buffer, &start, owner->start_offset);
+  if (!gtk_text_iter_forward_line(&start)) {
+    return FALSE;
+  }
+  start_offset = gtk_text_iter_get_offset(&start);
+  for (next = heading + 1; next < index->headings->len &&
+                           g_array_index(index->headings, ViewmdRenderHeading,
+                                         next).level > owner->level;
+       next++) {
+  }
+  end_offset = next < index->headings->len
+                   ? g_array_index(index->headings, ViewmdRenderHeading, next)
+                         .start_offset
+                   : gtk_text_buffer_get_char_count(buffer);
+  if (end_offset <= start_offset ||
+      markdown_render_index_fold_at(index, start_offset)) {
+    return FALSE;
+  }
+  gtk_text_buffer_get_iter_at_offset(buffer, &end, end_offset);
+
+  fold = g_new0(ViewmdFoldedSection, 1);
+  fold->offset = start_offset;
+  fold->level = owner->level;
+  fold->text = gtk_text_buffer_get_slice(buffer, &start, &end, TRUE);
+  for (const gchar *p = fold->text; *p != '\0'; p++) {
+    if (*p == '\n') {
+      fold->line_count++;
+    }
+  }
+  fold->tag_runs = g_array_new(FALSE, FALSE, sizeof(ViewmdFoldTagRun));
+  fold_capture_tags(&start, &end, fold->tag_runs);
+  fold->anchors = g_array_new(FALSE, FALSE, sizeof(ViewmdFoldAnchor));
+  fold_capture_anchors(buffer, fold);
+  fold->index = markdown_render_index_new();
+  render_index_move_range(index, start_offset, end_offset, fold->index);
+  markdown_render_index_shift(fold->index, G_MININT, -start_offset);
+
+  gtk_text_buffer_delete(buffer, &start, &end);
+  anchor = gtk_text_buffer_create_child_anchor(buffer, &start);
+  g_object_set_data(G_OBJECT(anchor), VIEWMD_SECTION_FOLD_ANCHOR_DATA,
+                    GINT_TO_POINTER(1));
+  fold->anchor = g_object_ref(anchor);
+  gtk_text_buffer_insert(buffer, &start, "\n", 1);
+
+  markdown_render_index_shift(
+      index, end_offset, FOLD_PLACEHOLDER_CHARS - (end_offset - start_offset));
+  g_ptr_array_insert(index->folded_sections,
+                     (gint)ptr_array_lower_bound(index->folded_sections,
+                                                 start_offset,
+                                                 folded_section_entry_offset),
+                     fold);
+  return TRUE;
+}
+
+/* Anchor data describing rendered content; widgets are built again. */
+static const struct {
+  const gchar *key;
+  GDestroyNotify destroy;
+} fold_anchor_data[] = {
+    {VIEWMD_TABLE_ANCHOR_DATA, NULL},
+    {TABLE_MODEL_DATA_KEY, viewmd_table_free},
+    {VIEWMD_TABLE_SEARCH_INDEX_DATA, table_search_index_free},
+    {VIEWMD_IMAGE_ANCHOR_DATA, NULL},
+    {VIEWMD_IMAGE_SRC_DATA, g_free},
+    {VIEWMD_IMAGE_ALT_DATA, g_free},
+    {VIEWMD_CODE_FOLD_ANCHOR_DATA, NULL},
+    {VIEWMD_SECTION_FOLD_ANCHOR_DATA, NULL},
+};
+
+/* A deleted anchor cannot go back into a buffer: hand its data and the index
+ * references over to the anchor replacing it. */
+static void fold_adopt_anchor(ViewmdFoldedSection *fold,
+                              GtkTextChildAnchor *old_anchor,
+                              GtkTextChildAnchor *anchor) {
+  ViewmdTableSearchIndex *table;
+
+  for (guint i = 0; i < G_N_ELEMENTS(fold_anchor_data); i++) {
+    gpointer data = g_object_steal_data(G_OBJECT(old_anchor),
+                                        fold_anchor_data[i].key);
+    if (data) {
+      g_object_set_data_full(G_OBJECT(anchor), fold_anchor_data[i].key, data,
+                             fold_anchor_data[i].destroy);
+    }
+  }
+
+  table = g_object_get_data(G_OBJECT(anchor), VIEWMD_TABLE_SEARCH_INDEX_DATA);
+  if (table && table->anchor == old_anchor) {
+    table->anchor = g_object_ref(anchor);
+    g_object_unref(old_anchor);
+  }
+  if (g_object_get_data(G_OBJECT(anchor), VIEWMD_CODE_FOLD_ANCHOR_DATA)) {
+    for (guint i = 0; i < fold->index->collapsed_code->len; i++) {
+      ViewmdCollapsedCode *code =
+          g_ptr_array_index(fold->index->collapsed_code, i);
+      if (code->anchor == old_anchor) {
+        code->anchor = g_object_ref(anchor);
+        g_object_unref(old_anchor);
+      }
+    }
+  }
+  if (g_object_get_data(G_OBJECT(anchor), VIEWMD_SECTION_FOLD_ANCHOR_DATA)) {
+    for (guint i = 0; i < fold->index->folded_sections->len; i++) {
+      ViewmdFoldedSection *nested =
+          g_ptr_array_index(fold->index->folded_sections, i);
+      if (nested->anchor == old_anchor) {
+        nested->anchor = g_object_ref(anchor);
+        g_object_unref(old_anchor);
+      }
+    }
+  }
+}
+
+gboolean markdown_unfold_section(GtkTextBuffer *buffer, ViewmdRenderIndex *index,
+                                 ViewmdFoldedSection *fold, gint *out_length) {
+  GtkTextIter start;
+  GtkTextIter end;
+  guint position;
+  gsize done = 0;
+  gint offset;
+  gint length;
+
+  if (!buffer || !index || !fold) {
+    return FALSE;
+  }
+  position = ptr_array_lower_bound(index->folded_sections, fold->offset,
+                                   folded_section_entry_offset);
+  if (position >= index->folded_sections->len ||
+      g_ptr_array_index(index->folded_sections, position) != fold) {
+    return FALSE;
+  }
+
+  gtk_text_buffer_get_iter_at_child_anchor(buffer, &start, fold->anchor);
+  offset = gtk_text_iter_get_offset(&start);
+  end = start;
+  gtk_text_iter_forward_chars(&end, FOLD_PLACEHOLDER_CHARS);
+  gtk_text_buffer_delete(buffer, &start, &end);
+
+  for (guint i = 0; i < fold->anchors->len; i++) {
+    ViewmdFoldAnchor *record = &g_array_index(fold->anchors, ViewmdFoldAnchor, i);
+    GtkTextChildAnchor *anchor;
+
+    gtk_text_buffer_insert(buffer, &start, fold->text + done,
+                           (gint)(record->byte_offset - done));
+    anchor = gtk_text_buffer_create_child_anchor(buffer, &start);
+    fold_adopt_anchor(fold, record->anchor, anchor);
+    done = record->byte_offset + 3;
+  }
+  gtk_text_buffer_insert(buffer, &start, fold->text + done, -1);
+  length = gtk_text_iter_get_offset(&start) - offset;
+
+  for (guint i = 0; i < fold->tag_runs->len; i++) {
+    ViewmdFoldTagRun *run = &g_array_index(fold->tag_runs, ViewmdFoldTagRun, i);
+    apply_tag_by_offsets(buffer, run->tag, offset + run->start_offset,
+                         offset + run->end_offset);
+  }
+
+  /* Drop the fold from the index first so its nested folds sort in cleanly. */
+  g_ptr_array_index(index->folded_sections, position) = NULL;
+  g_ptr_array_remove_index(index->folded_sections, position);
+  markdown_render_index_shift(index, offset + FOLD_PLACEHOLDER_CHARS,
+                              length - FOLD_PLACEHOLDER_CHARS);
+  markdown_render_index_shift(fold->index, G_MININT, offset);
+  render_index_splice(index, fold->index);
+  folded_section_free(fold);
+  if (out_length) {
+    *out_length = length;
+  }
+  return TRUE;
+}
+
 static void table_emit_hidden_search_text(RenderCtx *ctx, ViewmdTable *table,
                                           GtkTextChildAnchor *anchor) {
   ViewmdTableSearchIndex *index;
@@ -753,8 +2128,13 @@ static void table_emit_hidden_search_text(RenderCtx *ctx, ViewmdTable *table,
   if (index->end_offset > index->start_offset) {
     apply_tag_by_name_offsets(ctx->buffer, TAG_INVISIBLE, index->start_offset,
                               index->end_offset);
+    index->anchor = anchor;
     g_object_set_data_full(G_OBJECT(anchor), VIEWMD_TABLE_SEARCH_INDEX_DATA, index,
                            table_search_index_free);
+    if (ctx->index) {
+      g_object_ref(anchor);
+      g_ptr_array_add(ctx->index->tables, index);
+    }
   } else {
     table_search_index_free(index);
   }
@@ -868,6 +2248,29 @@ static void table_finish_row(RenderCtx *ctx) {
   ctx->table_current_row = NULL;
 }
 
+/* Past the deadline the rest of the document is rendered the cheap way. */
+static void render_check_budget(RenderCtx *ctx) {
+  if (ctx->render_deadline > 0 &&
+      g_get_monotonic_time() > ctx->render_deadline) {
+    ctx->degraded |= VIEWMD_DEGRADED_RENDER;
+    ctx->render_deadline = 0;
+  }
+}
+
+/* Degraded tables are inserted as visible monospace text, which also keeps
+ * them searchable without the hidden copy. */
+static void table_emit_plain(RenderCtx *ctx) {
+  gchar *text = table_format_plain(ctx->table_model);
+  guint pushed = 0;
+
+  push_active_tag_by_name(ctx, TAG_TABLE, &pushed);
+  insert_cstr(ctx, text);
+  pop_active_tags(ctx, pushed);
+  g_free(text);
+  viewmd_table_free(ctx->table_model);
+  ctx->table_model = NULL;
+}
+
 static void table_emit_anchor(RenderCtx *ctx) {
   GtkTextChildAnchor *anchor;
 
@@ -879,6 +2282,10 @@ static void table_emit_anchor(RenderCtx *ctx) {
     ctx->table_model = NULL;
     return;
   }
+  if (ctx->degraded) {
+    table_emit_plain(ctx);
+    return;
+  }
 
   anchor = gtk_text_buffer_create_child_anchor(ctx->buffer, &ctx->iter);
   note_non_newline_output(ctx);
@@ -892,6 +2299,33 @@ static void table_emit_anchor(RenderCtx *ctx) {
   ctx->table_model = NULL;
 }
 
+/* Degraded images become their alt text styled as a link. Only absolute
+ * sources can be opened; relative ones need the document directory. */
+static void image_emit_link(RenderCtx *ctx) {
+  const gchar *label = ctx->image_alt && ctx->image_alt->len > 0
+                           ? ctx->image_alt->str
+                           : ctx->image_src;
+  gchar *scheme = g_uri_parse_scheme(ctx->image_src);
+  gchar *uri = NULL;
+  guint pushed = 0;
+
+  if (scheme) {
+    uri = g_strdup(ctx->image_src);
+  } else if (g_path_is_absolute(ctx->image_src)) {
+    uri = g_filename_to_uri(ctx->image_src, NULL, NULL);
+  }
+  g_free(scheme);
+
+  push_active_tag_by_name(ctx, TAG_LINK, &pushed);
+  if (uri) {
+    GtkTextTag *url_tag = gtk_text_buffer_create_tag(ctx->buffer, NULL, NULL);
+    g_object_set_data_full(G_OBJECT(url_tag), VIEWMD_LINK_URL_DATA, uri, g_free);
+    push_active_tag(ctx, url_tag, &pushed);
+  }
+  insert_cstr(ctx, label);
+  pop_active_tags(ctx, pushed);
+}
+
 static void image_emit_anchor(RenderCtx *ctx) {
   GtkTextChildAnchor *anchor;
   gchar *alt = NULL;
@@ -899,7 +2333,12 @@ static void image_emit_anchor(RenderCtx *ctx) {
   if (!ctx || !ctx->buffer || !ctx->image_src || ctx->image_src[0] == '\0') {
     return;
   }
+  if (ctx->degraded) {
+    image_emit_link(ctx);
+    return;
+  }
 
+  line_emit_truncated_tail(ctx);
   anchor = gtk_text_buffer_create_child_anchor(ctx->buffer, &ctx->iter);
   note_non_newline_output(ctx);
   g_object_set_data(G_OBJECT(anchor), VIEWMD_IMAGE_ANCHOR_DATA, GINT_TO_POINTER(1));
@@ -917,6 +2356,58 @@ static void image_emit_anchor(RenderCtx *ctx) {
   insert_cstr(ctx, "\n");
 }
 
+/* Code text goes to the buffer until the preview is full, then to code_tail
+ * since the block's length is not known before it ends. */
+static void code_block_insert(RenderCtx *ctx, const gchar *text) {
+  const gchar *p = text;
+
+  while (*p && !ctx->code_tail) {
+    const gchar *nl = strchr(p, '\n');
+    if (!nl) {
+      insert_cstr(ctx, p);
+      return;
+    }
+    insert_text(ctx, p, (gsize)(nl + 1 - p));
+    p = nl + 1;
+    if (++ctx->code_lines >= ctx->code_preview_lines) {
+      ctx->code_tail = g_string_new(NULL);
+    }
+  }
+
+  if (ctx->code_tail) {
+    for (const gchar *q = p; (q = strchr(q, '\n')) != NULL; q++) {
+      ctx->code_tail_lines++;
+    }
+    g_string_append(ctx->code_tail, p);
+  }
+}
+
+/* Stands in for the held-back lines; the editor puts an expand button on the
+ * anchor. Emitted after the code block is recorded so the block covers only
+ * the preview. */
+static void code_emit_collapsed_tail(RenderCtx *ctx) {
+  ViewmdCollapsedCode *code = g_new0(ViewmdCollapsedCode, 1);
+  GtkTextChildAnchor *anchor;
+
+  code->offset = gtk_text_iter_get_offset(&ctx->iter);
+  code->line_count = ctx->code_tail_lines;
+  if (ctx->code_tail->len > 0 &&
+      ctx->code_tail->str[ctx->code_tail->len - 1] != '\n') {
+    code->line_count++;
+  }
+  code->text = g_string_free(ctx->code_tail, FALSE);
+  ctx->code_tail = NULL;
+
+  anchor = gtk_text_buffer_create_child_anchor(ctx->buffer, &ctx->iter);
+  g_object_set_data(G_OBJECT(anchor), VIEWMD_CODE_FOLD_ANCHOR_DATA,
+                    GINT_TO_POINTER(1));
+  code->anchor = g_object_ref(anchor);
+  apply_active_tags(ctx, code->offset, code->offset + 1);
+  note_non_newline_output(ctx);
+  insert_cstr(ctx, "\n");
+  g_ptr_array_add(ctx->index->collapsed_code, code);
+}
+
 static void insert_list_marker(RenderCtx *ctx) {
   ListState *list;
   gchar *ordered = NULL;
@@ -948,6 +2439,7 @@ static int on_enter_block(MD_BLOCKTYPE type, void *detail, void *userdata) {
   RenderCtx *ctx = (RenderCtx *)userdata;
   BlockState state = {type, 0};
 
+  render_check_budget(ctx);
   g_array_append_val(ctx->block_stack, state);
 
   switch (type) {
@@ -966,6 +2458,7 @@ static int on_enter_block(MD_BLOCKTYPE type, void *detail, void *userdata) {
     MD_BLOCK_H_DETAIL *h = (MD_BLOCK_H_DETAIL *)detail;
     ensure_newlines(ctx, 2);
     ctx->heading_start_offset = gtk_text_iter_get_offset(&ctx->iter);
+    ctx->heading_level = h ? (gint)h->level : 1;
     ctx->in_heading = TRUE;
     if (!ctx->heading_text) {
       ctx->heading_text = g_string_new(NULL);
@@ -1046,10 +2539,18 @@ static int on_enter_block(MD_BLOCKTYPE type, void *detail, void *userdata) {
 
   case MD_BLOCK_CODE:
     ctx->current_code_start_offset = gtk_text_iter_get_offset(&ctx->iter);
+    ctx->code_line_chars = 0;
     {
       gchar *language =
           extract_code_language_from_detail((MD_BLOCK_CODE_DETAIL *)detail);
       ctx->current_code_language = markyd_code_lookup_language(language);
+      /* Unlabeled blocks are kept for guessing; unknown labels are not.
+       * Degraded renders skip highlighting altogether. */
+      if (!ctx->degraded &&
+          (ctx->current_code_language ||
+           (!language && ctx->code_guess_confidence <= 1.0))) {
+        ctx->code_text = g_string_new(NULL);
+      }
       g_free(language);
     }
     ensure_newlines(ctx, 2);
@@ -1116,14 +2617,35 @@ static int on_leave_block(MD_BLOCKTYPE type, void *detail, void *userdata) {
     ctx->list_item_prefix_pending = FALSE;
     ensure_newlines(ctx, 1);
   } else if (type == MD_BLOCK_CODE) {
-    if (ctx->code_blocks && ctx->current_code_start_offset >= 0) {
-      CodeBlockRange range = {ctx->current_code_start_offset,
-                              gtk_text_iter_get_offset(&ctx->iter),
-                              ctx->current_code_language};
-      if (range.end_offset > range.start_offset) {
-        g_array_append_val(ctx->code_blocks, range);
+    gboolean collapse = FALSE;
+
+    if (ctx->code_tail) {
+      collapse =
+          ctx->code_lines + ctx->code_tail_lines > ctx->code_collapse_lines;
+      if (!collapse) {
+        insert_text(ctx, ctx->code_tail->str, ctx->code_tail->len);
+        g_string_free(ctx->code_tail, TRUE);
+        ctx->code_tail = NULL;
       }
     }
+    if (ctx->code_text) {
+      ViewmdCodeBlock *block = g_new0(ViewmdCodeBlock, 1);
+      block->ref_count = 1;
+      block->state = VIEWMD_CODE_BLOCK_PENDING;
+      block->start_offset = ctx->current_code_start_offset;
+      block->end_offset = gtk_text_iter_get_offset(&ctx->iter);
+      block->language = ctx->current_code_language;
+      block->fence_language = ctx->current_code_language;
+      block->guess_confidence = ctx->code_guess_confidence;
+      block->text = g_string_free(ctx->code_text, FALSE);
+      ctx->code_text = NULL;
+      g_ptr_array_add(ctx->code_blocks, block);
+    }
+    if (collapse) {
+      code_emit_collapsed_tail(ctx);
+    }
+    ctx->code_lines = 0;
+    ctx->code_tail_lines = 0;
     ctx->current_code_start_offset = -1;
     ctx->current_code_language = NULL;
   } else if (type == MD_BLOCK_TH || type == MD_BLOCK_TD) {
@@ -1255,6 +2777,7 @@ static int on_text(MD_TEXTTYPE type, const MD_CHAR *text, MD_SIZE size,
                    void *userdata) {
   RenderCtx *ctx = (RenderCtx *)userdata;
   gchar *rendered = NULL;
+  gchar *broken;
 
   if (type == MD_TEXT_BR || type == MD_TEXT_SOFTBR) {
     rendered = g_strdup("\n");
@@ -1272,6 +2795,17 @@ static int on_text(MD_TEXTTYPE type, const MD_CHAR *text, MD_SIZE size,
     g_string_append(ctx->image_alt, rendered);
   } else if (ctx->table_cell_text) {
     table_capture_append(ctx, rendered);
+  } else if (ctx->current_code_start_offset >= 0) {
+    broken = code_break_long_lines(ctx, rendered);
+    if (ctx->code_collapse_lines > 0) {
+      code_block_insert(ctx, broken ? broken : rendered);
+    } else {
+      insert_cstr(ctx, broken ? broken : rendered);
+    }
+    g_free(broken);
+  } else if (ctx->long_line_limit > 0) {
+    insert_guarded_text(ctx, rendered);
+    capture_heading_text(ctx, rendered);
   } else {
     insert_cstr(ctx, rendered);
     capture_heading_text(ctx, rendered);
@@ -1500,7 +3034,37 @@ GtkWidget *markdown_create_table_widget(GtkTextChildAnchor *anchor) {
   return wrapper;
 }
 
-void markdown_apply_tags(GtkTextBuffer *buffer, const gchar *source) {
+GtkWidget *markdown_create_table_text_widget(GtkTextChildAnchor *anchor) {
+  ViewmdTable *table;
+  GtkWidget *label;
+  gchar *text;
+
+  if (!anchor) {
+    return NULL;
+  }
+
+  table = (ViewmdTable *)g_object_get_data(G_OBJECT(anchor), TABLE_MODEL_DATA_KEY);
+  if (!table || table->col_count == 0 || !table->rows || table->rows->len == 0) {
+    return NULL;
+  }
+
+  text = table_format_plain(table);
+  label = gtk_label_new(text);
+  g_free(text);
+  gtk_style_context_add_class(gtk_widget_get_style_context(label),
+                              "viewmd-table");
+  gtk_style_context_add_class(gtk_widget_get_style_context(label), "monospace");
+  gtk_label_set_xalign(GTK_LABEL(label), 0.0f);
+  gtk_widget_set_halign(label, GTK_ALIGN_START);
+  gtk_widget_set_margin_top(label, 6);
+  gtk_widget_set_margin_bottom(label, 6);
+  gtk_widget_set_margin_start(label, 8);
+  gtk_widget_set_margin_end(label, 8);
+  return label;
+}
+
+void markdown_apply_tags(GtkTextBuffer *buffer, const gchar *source,
+                         ViewmdRenderIndex *index) {
   RenderCtx ctx;
   MD_PARSER parser = {0};
   gchar *normalized_source;
@@ -1510,7 +3074,9 @@ void markdown_apply_tags(GtkTextBuffer *buffer, const gchar *source) {
   if (!buffer) {
     return;
   }
+  g_return_if_fail(index != NULL);
 
+  markdown_render_index_clear(index);
   gtk_text_buffer_set_text(buffer, "", -1);
   input = source ? source : "";
   normalized_source = normalize_markdown_source(input);
@@ -1521,13 +3087,32 @@ void markdown_apply_tags(GtkTextBuffer *buffer, const gchar *source) {
   ctx.block_stack = g_array_new(FALSE, FALSE, sizeof(BlockState));
   ctx.span_stack = g_array_new(FALSE, FALSE, sizeof(SpanState));
   ctx.list_stack = g_array_new(FALSE, FALSE, sizeof(ListState));
-  ctx.code_blocks = g_array_new(FALSE, FALSE, sizeof(CodeBlockRange));
+  ctx.code_blocks = index->code_blocks;
   ctx.anchor_counts = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
   ctx.current_code_start_offset = -1;
   ctx.current_code_language = NULL;
+  ctx.code_guess_confidence = config ? config->code_language_confidence : 2.0;
+  if (config && config->code_collapse_lines > 0) {
+    ctx.code_collapse_lines = (guint)config->code_collapse_lines;
+    ctx.code_preview_lines = (guint)CLAMP(config->code_preview_lines, 1,
+                                          config->code_collapse_lines);
+  }
+  /* Code lines are broken instead of held back. */
+  ctx.long_line_limit =
+      config && config->long_line_limit > 0 ? (guint)config->long_line_limit : 0;
+  if (config && !index->full_render) {
+    if (config->degrade_source_kb > 0 &&
+        strlen(input) > (gsize)config->degrade_source_kb * 1024) {
+      ctx.degraded |= VIEWMD_DEGRADED_SIZE;
+    } else if (config->render_budget_ms > 0) {
+      ctx.render_deadline =
+          g_get_monotonic_time() + (gint64)config->render_budget_ms * 1000;
+    }
+  }
   ctx.heading_start_offset = 0;
   ctx.has_output = FALSE;
   ctx.trailing_newlines = 0;
+  ctx.index = index;
   gtk_text_buffer_get_start_iter(buffer, &ctx.iter);
 
   parser.abi_version = 0;
@@ -1542,10 +3127,13 @@ void markdown_apply_tags(GtkTextBuffer *buffer, const gchar *source) {
 
   rc = md_parse(normalized_source, (MD_SIZE)strlen(normalized_source), &parser,
                 &ctx);
+  if (rc == 0) {
+    line_emit_truncated_tail(&ctx);
+  }
+  index->degraded = ctx.degraded;
   if (rc != 0) {
+    markdown_render_index_clear(index);
     gtk_text_buffer_set_text(buffer, input, -1);
-  } else {
-    apply_code_highlighting(buffer, ctx.code_blocks);
   }
 
   if (ctx.table_cell_text) {
@@ -1563,7 +3151,15 @@ void markdown_apply_tags(GtkTextBuffer *buffer, const gchar *source) {
   }
   g_hash_table_destroy(ctx.anchor_counts);
   g_array_free(ctx.list_stack, TRUE);
-  g_array_free(ctx.code_blocks, TRUE);
+  if (ctx.code_text) {
+    g_string_free(ctx.code_text, TRUE);
+  }
+  if (ctx.code_tail) {
+    g_string_free(ctx.code_tail, TRUE);
+  }
+  if (ctx.line_tail) {
+    g_string_free(ctx.line_tail, TRUE);
+  }
   g_array_free(ctx.span_stack, TRUE);
   g_array_free(ctx.block_stack, TRUE);
   g_ptr_array_free(ctx.active_tags, TRUE);
@@ -1,6 +1,8 @@
 #ifndef MARKYD_MARKDOWN_H
 #define MARKYD_MARKDOWN_H
 
+#include "code_highlight.h"
+#include "text_snapshot.h"
 #include <gtk/gtk.h>
 
 /* GObject data key used to mark hrule child anchors inserted into the buffer. */
@@ -15,9 +17,6 @@ void markdown_update_accent_tags(GtkTextBuffer *buffer);
 /* Data key set on per-link metadata tags to store resolved URL/href. */
 #define VIEWMD_LINK_URL_DATA "viewmd-link-url"
 
-/* Prefix for named text marks used as internal heading anchors. */
-#define VIEWMD_ANCHOR_MARK_PREFIX "viewmd-anchor-"
-
 /* GObject data key used to mark table child anchors with parsed table data. */
 #define VIEWMD_TABLE_ANCHOR_DATA "viewmd-table-anchor"
 /* GObject data key set on table anchors for hidden searchable index metadata. */
@@ -37,6 +36,18 @@ void markdown_update_accent_tags(GtkTextBuffer *buffer);
 #define VIEWMD_IMAGE_ALT_DATA "viewmd-image-alt"
 #define VIEWMD_IMAGE_WIDGET_DATA "viewmd-image-widget"
 
+/* GObject data keys for the expand control of a collapsed code block. */
+#define VIEWMD_CODE_FOLD_ANCHOR_DATA "viewmd-code-fold-anchor"
+#define VIEWMD_CODE_FOLD_WIDGET_DATA "viewmd-code-fold-widget"
+
+/* GObject data keys for the placeholder of a folded heading section. */
+#define VIEWMD_SECTION_FOLD_ANCHOR_DATA "viewmd-section-fold-anchor"
+#define VIEWMD_SECTION_FOLD_WIDGET_DATA "viewmd-section-fold-widget"
+
+/* Set on tags that mark view state (such as search hits) rather than rendered
+ * content; folded sections do not keep them. */
+#define VIEWMD_TRANSIENT_TAG_DATA "viewmd-transient-tag"
+
 typedef struct {
   gint row;
   gint col;
@@ -47,19 +58,210 @@ typedef struct {
 typedef struct {
   gint start_offset;
   gint end_offset;
-  GArray *cells; /* ViewmdTableSearchCellRange */
+  GArray *cells; /* ViewmdTableSearchCellRange, sorted by start_offset */
+  GtkTextChildAnchor *anchor; /* Owning table anchor (not referenced). */
 } ViewmdTableSearchIndex;
 
+typedef struct {
+  gint start_offset;
+  gint level;
+  gchar *text;
+  gchar *slug;     /* Anchor fragment, or NULL when the text has none. */
+  gchar *folded;   /* Casefolded text for fuzzy matching. */
+  guint64 char_mask; /* markyd_fuzzy_char_mask() of folded. */
+} ViewmdRenderHeading;
+
+/* Code block life cycle; state is read and advanced atomically since blocks
+ * are tokenized on worker threads. */
+enum {
+  VIEWMD_CODE_BLOCK_PENDING,
+  VIEWMD_CODE_BLOCK_TOKENIZING,
+  VIEWMD_CODE_BLOCK_TOKENIZED,
+  VIEWMD_CODE_BLOCK_APPLIED,
+  VIEWMD_CODE_BLOCK_CANCELLED
+};
+
+typedef struct {
+  gint ref_count;
+  gint state;
+  gint start_offset;
+  gint end_offset;
+  /* NULL for unlabeled blocks; guessed on the worker when tokenizing. */
+  const MarkydLanguageHighlight *language;
+  /* From the fence label; set on the main thread and never changed, so it can
+   * be read while a worker is guessing language. */
+  const MarkydLanguageHighlight *fence_language;
+  gdouble guess_confidence; /* Threshold for the guess; above 1 skips it. */
+  gchar *text;    /* Rendered block text; freed once tokenized. */
+  /* ViewmdCodeToken relative to start_offset, valid once TOKENIZED; shared
+   * read-only with the token cache. */
+  GArray *tokens;
+} ViewmdCodeBlock;
+
+/* Text held back from the buffer until expanded: the lines of a long code
+ * block past its preview, or the end of an over-long line. */
+typedef struct {
+  gint offset; /* Expand control; the tail is inserted here. */
+  GtkTextChildAnchor *anchor;
+  gchar *text; /* Hidden text as rendered. */
+  guint line_count;
+  gboolean truncated_line; /* text is the rest of one line, without "\n". */
+  /* Search snapshot of text, built on first use; offsets are tail-relative. */
+  MarkydTextSnapshot *snapshot;
+} ViewmdCollapsedCode;
+
+/* Why a render fell back to cheaper output: code is left unhighlighted,
+ * tables become monospace text and images links from that point on. */
+enum {
+  VIEWMD_DEGRADED_SIZE = 1 << 0,      /* Source over degrade_source_kb. */
+  VIEWMD_DEGRADED_RENDER = 1 << 1,    /* Parsing and inserting over budget. */
+  VIEWMD_DEGRADED_HIGHLIGHT = 1 << 2, /* Code highlighting over budget. */
+  VIEWMD_DEGRADED_WIDGETS = 1 << 3    /* Widget creation over budget. */
+};
+
+/* Offset-sorted lookup tables filled while rendering a buffer. */
+typedef struct _ViewmdRenderIndex ViewmdRenderIndex;
+
+struct _ViewmdRenderIndex {
+  /* ViewmdTableSearchIndex*, sorted by start_offset; holds a ref on each anchor. */
+  GPtrArray *tables;
+  GArray *headings; /* ViewmdRenderHeading, sorted by start_offset */
+  GHashTable *anchors; /* slug -> heading index + 1 */
+  /* ViewmdCodeBlock*, sorted; one ref each, plus one per queued worker task. */
+  GPtrArray *code_blocks;
+  /* ViewmdCollapsedCode*, sorted by offset; holds a ref on each anchor. */
+  GPtrArray *collapsed_code;
+  /* ViewmdFoldedSection*, sorted by offset; nested folds live in their parent. */
+  GPtrArray *folded_sections;
+  gboolean anchors_stale; /* Rebuild anchors from headings before lookups. */
+  gboolean full_render; /* Set by the caller to ignore the render budget. */
+  guint degraded;       /* VIEWMD_DEGRADED_* reasons for the current render. */
+};
+
+typedef struct {
+  gint start_offset;
+  gint end_offset;
+  GtkTextTag *tag;
+} ViewmdFoldTagRun;
+
+typedef struct {
+  gsize byte_offset; /* Of the U+FFFC in the section text. */
+  GtkTextChildAnchor *anchor; /* Removed anchor still holding its data. */
+} ViewmdFoldAnchor;
+
+/* Render output of a folded heading section, kept out of the buffer so that
+ * unfolding re-inserts it without parsing again. */
+typedef struct {
+  gint offset; /* Placeholder; the section is re-inserted here. */
+  GtkTextChildAnchor *anchor;
+  gint level; /* Of the heading owning the section. */
+  guint line_count;
+  gchar *text; /* Buffer slice, child anchors included as U+FFFC. */
+  GArray *tag_runs; /* ViewmdFoldTagRun, section-relative */
+  GArray *anchors;  /* ViewmdFoldAnchor, in text order; one ref each */
+  /* Index entries of the section, offsets section-relative. */
+  ViewmdRenderIndex *index;
+} ViewmdFoldedSection;
+
+ViewmdRenderIndex *markdown_render_index_new(void);
+void markdown_render_index_free(ViewmdRenderIndex *index);
+void markdown_render_index_clear(ViewmdRenderIndex *index);
+
+/* Table whose hidden search text overlaps [start_offset, end_offset), or NULL. */
+ViewmdTableSearchIndex *markdown_render_index_lookup_table(
+    const ViewmdRenderIndex *index, gint start_offset, gint end_offset);
+
+/* Index of the heading whose anchor matches fragment (normalized), or -1.
+ * Headings inside folded sections are not found; see
+ * markdown_render_index_fold_with_anchor(). */
+gint markdown_render_index_lookup_anchor(ViewmdRenderIndex *index,
+                                         const gchar *fragment);
+
+/* Index of the last heading starting at or before offset, or -1. */
+gint markdown_render_index_heading_at(const ViewmdRenderIndex *index,
+                                      gint offset);
+
+/* Index of the first code block ending after offset (code_blocks->len if none). */
+guint markdown_render_index_first_code_block(const ViewmdRenderIndex *index,
+                                             gint offset);
+
+/* Move every stored offset at or after from_offset by delta, after text was
+ * inserted or removed there. */
+void markdown_render_index_shift(ViewmdRenderIndex *index, gint from_offset,
+                                 gint delta);
+
+/* Tail whose expand control is anchor, or NULL. */
+ViewmdCollapsedCode *
+markdown_render_index_lookup_collapsed(const ViewmdRenderIndex *index,
+                                       GtkTextChildAnchor *anchor);
+
+/* Search snapshot of a collapsed tail, built on first use. */
+MarkydTextSnapshot *markdown_collapsed_code_snapshot(ViewmdCollapsedCode *code);
+
+/* Replace the expand control with the hidden lines, shift the index past them
+ * and reset the owning code block to PENDING so it is highlighted in full.
+ * code is freed. FALSE if code is not in index. */
+gboolean markdown_expand_collapsed_code(GtkTextBuffer *buffer,
+                                        ViewmdRenderIndex *index,
+                                        ViewmdCollapsedCode *code);
+
+/* Folded section whose placeholder is anchor, or NULL. */
+ViewmdFoldedSection *
+markdown_render_index_lookup_fold(const ViewmdRenderIndex *index,
+                                  GtkTextChildAnchor *anchor);
+
+/* Folded section whose placeholder sits at offset, or NULL. */
+ViewmdFoldedSection *markdown_render_index_fold_at(const ViewmdRenderIndex *index,
+                                                   gint offset);
+
+/* Top-level folded section holding the heading whose anchor matches fragment,
+ * at any nesting depth, or NULL. */
+ViewmdFoldedSection *
+markdown_render_index_fold_with_anchor(ViewmdRenderIndex *index,
+                                       const gchar *fragment);
+
+/* Move the lines below heading (an index into index->headings), up to the
+ * next heading of the same or a higher level, out of the buffer and replace
+ * them with a placeholder anchor and newline. Their text, tags, child anchors
+ * and index entries are kept in a ViewmdFoldedSection. FALSE if the section
+ * is empty or already folded. */
+gboolean markdown_fold_section(GtkTextBuffer *buffer, ViewmdRenderIndex *index,
+                               guint heading);
+
+/* Put a folded section back in place of its placeholder. Child anchors are
+ * recreated with the old anchors' data, widgets excluded. fold is freed.
+ * out_length (may be NULL) receives the chars inserted at the old placeholder
+ * offset. FALSE if fold is not in index. */
+gboolean markdown_unfold_section(GtkTextBuffer *buffer, ViewmdRenderIndex *index,
+                                 ViewmdFoldedSection *fold, gint *out_length);
+
+/* Queue every pending code block of index on the shared tokenizer pool. */
+void markdown_tokenize_code_blocks_async(ViewmdRenderIndex *index);
+
+/* Apply syntax tags to a rendered code block, tokenizing it here if no worker
+ * has claimed it yet. FALSE while a worker is still tokenizing it. */
+gboolean markdown_highlight_code_block(GtkTextBuffer *buffer,
+                                       ViewmdCodeBlock *block);
+
+/* Cell containing start_offset, else the last cell overlapping the range. */
+const ViewmdTableSearchCellRange *
+markdown_table_search_index_lookup_cell(const ViewmdTableSearchIndex *table,
+                                        gint start_offset, gint end_offset);
+
 /* Normalize heading/link text into anchor slug form. Caller owns result. */
 gchar *markdown_normalize_anchor_slug(const gchar *text);
 
-/* Build full text-mark name for an anchor fragment. Caller owns result. */
-gchar *markdown_anchor_mark_name(const gchar *fragment);
-
-/* Render markdown source into the buffer and apply markdown styling. */
-void markdown_apply_tags(GtkTextBuffer *buffer, const gchar *source);
+/* Render markdown source into the buffer and apply markdown styling. index is
+ * required; it is cleared and refilled for the new contents, and code blocks
+ * are left plain in index->code_blocks for the caller to highlight. The render
+ * budget applies unless index->full_render. */
+void markdown_apply_tags(GtkTextBuffer *buffer, const gchar *source,
+                         ViewmdRenderIndex *index);
 
 /* Build a GTK widget for a table anchor, or NULL if not a table anchor. */
 GtkWidget *markdown_create_table_widget(GtkTextChildAnchor *anchor);
 
+/* Cheaper stand-in for markdown_create_table_widget: one monospace label. */
+GtkWidget *markdown_create_table_text_widget(GtkTextChildAnchor *anchor);
+
 #endif /* MARKYD_MARKDOWN_H */
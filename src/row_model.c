@@ -0,0 +1,163 @@
+#include "row_model.h"
+
+struct _MarkydRowModel {
+  GObject parent_instance;
+  guint n_rows;
+  gint stamp;
+};
+
+static void row_model_tree_model_init(GtkTreeModelIface *iface);
+
+G_DEFINE_TYPE_WITH_CODE(MarkydRowModel, markyd_row_model, G_TYPE_OBJECT,
+                        G_IMPLEMENT_INTERFACE(GTK_TYPE_TREE_MODEL,
+                                              row_model_tree_model_init))
+
+/* Iters carry the row number in user_data. */
+static gboolean row_model_set_iter(MarkydRowModel *self, GtkTreeIter *iter,
+                                   guint row) {
+  if (row >= self->n_rows) {
+    iter->stamp = 0;
+    return FALSE;
+  }
+  iter->stamp = self->stamp;
+  iter->user_data = GUINT_TO_POINTER(row);
+  iter->user_data2 = NULL;
+  iter->user_data3 = NULL;
+  return TRUE;
+}
+
+static guint row_model_iter_row(GtkTreeIter *iter) {
+  return GPOINTER_TO_UINT(iter->user_data);
+}
+
+static GtkTreeModelFlags row_model_get_flags(GtkTreeModel *model) {
+  (void)model;
+  return GTK_TREE_MODEL_LIST_ONLY | GTK_TREE_MODEL_ITERS_PERSIST;
+}
+
+static gint row_model_get_n_columns(GtkTreeModel *model) {
+  (void)model;
+  return 1;
+}
+
+static GType row_model_get_column_type(GtkTreeModel *model, gint column) {
+  (void)model;
+  (void)column;
+  return G_TYPE_INT;
+}
+
+static gboolean row_model_get_iter(GtkTreeModel *model, GtkTreeIter *iter,
+                                   GtkTreePath *path) {
+  MarkydRowModel *self = MARKYD_ROW_MODEL(model);
+  gint *indices = gtk_tree_path_get_indices(path);
+
+  if (gtk_tree_path_get_depth(path) != 1 || !indices || indices[0] < 0) {
+    iter->stamp = 0;
+    return FALSE;
+  }
+  return row_model_set_iter(self, iter, (guint)indices[0]);
+}
+
+static GtkTreePath *row_model_get_path(GtkTreeModel *model, GtkTreeIter *iter) {
+  (void)model;
+  return gtk_tree_path_new_from_indices((gint)row_model_iter_row(iter), -1);
+}
+
+static void row_model_get_value(GtkTreeModel *model, GtkTreeIter *iter,
+                                gint column, GValue *value) {
+  (void)model;
+  (void)column;
+  g_value_init(value, G_TYPE_INT);
+  g_value_set_int(value, (gint)row_model_iter_row(iter));
+}
+
+static gboolean row_model_iter_next(GtkTreeModel *model, GtkTreeIter *iter) {
+  return row_model_set_iter(MARKYD_ROW_MODEL(model), iter,
+                            row_model_iter_row(iter) + 1);
+}
+
+static gboolean row_model_iter_previous(GtkTreeModel *model,
+                                        GtkTreeIter *iter) {
+  guint row = row_model_iter_row(iter);
+
+  if (row == 0) {
+    iter->stamp = 0;
+    return FALSE;
+  }
+  return row_model_set_iter(MARKYD_ROW_MODEL(model), iter, row - 1);
+}
+
+static gboolean row_model_iter_children(GtkTreeModel *model, GtkTreeIter *iter,
+                                        GtkTreeIter *parent) {
+  if (parent) {
+    iter->stamp = 0;
+    return FALSE;
+  }
+  return row_model_set_iter(MARKYD_ROW_MODEL(model), iter, 0);
+}
+
+static gboolean row_model_iter_has_child(GtkTreeModel *model,
+                                         GtkTreeIter *iter) {
+  (void)model;
+  (void)iter;
+  return FALSE;
+}
+
+static gint row_model_iter_n_children(GtkTreeModel *model, GtkTreeIter *iter) {
+  return iter ? 0 : (gint)MARKYD_ROW_MODEL(model)->n_rows;
+}
+
+static gboolean row_model_iter_nth_child(GtkTreeModel *model, GtkTreeIter *iter,
+                                         GtkTreeIter *parent, gint n) {
+  if (parent || n < 0) {
+    iter->stamp = 0;
+    return FALSE;
+  }
+  return row_model_set_iter(MARKYD_ROW_MODEL(model), iter, (guint)n);
+}
+
+static gboolean row_model_iter_parent(GtkTreeModel *model, GtkTreeIter *iter,
+                                      GtkTreeIter *child) {
+  (void)model;
+  (void)child;
+  iter->stamp = 0;
+  return FALSE;
+}
+
+static void row_model_tree_model_init(GtkTreeModelIface *iface) {
+  iface->get_flags = row_model_get_flags;
+  iface->get_n_columns = row_model_get_n_columns;
+  iface->get_column_type = row_model_get_column_type;
+  iface->get_iter = row_model_get_iter;
+  iface->get_path = row_model_get_path;
+  iface->get_value = row_model_get_value;
+  iface->iter_next = row_model_iter_next;
+  iface->iter_previous = row_model_iter_previous;
+  iface->iter_children = row_model_iter_children;
+  iface->iter_has_child = row_model_iter_has_child;
+  iface->iter_n_children = row_model_iter_n_children;
+  iface->iter_nth_child = row_model_iter_nth_child;
+  iface->iter_parent = row_model_iter_parent;
+}
+
+static void markyd_row_model_class_init(MarkydRowModelClass *klass) {
+  (void)klass;
+}
+
+static void markyd_row_model_init(MarkydRowModel *self) {
+  self->stamp = 1;
+}
+
+MarkydRowModel *markyd_row_model_new(void) {
+  return g_object_new(MARKYD_TYPE_ROW_MODEL, NULL);
+}
+
+void markyd_row_model_set_rows(MarkydRowModel *model, guint n_rows) {
+  g_return_if_fail(MARKYD_IS_ROW_MODEL(model));
+
+  model->n_rows = n_rows;
+  /* Never 0, which marks an invalid iter. */
+  do {
+    model->stamp++;
+  } while (model->stamp == 0);
+}
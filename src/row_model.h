@@ -0,0 +1,19 @@
+#ifndef MARKYD_ROW_MODEL_H
+#define MARKYD_ROW_MODEL_H
+
+#include <gtk/gtk.h>
+
+/* Flat GtkTreeModel of n rows whose only column (G_TYPE_INT) is the row
+ * number, for views that render each row from an array the caller owns.
+ * Resizing is O(1) since no per-row storage exists. */
+#define MARKYD_TYPE_ROW_MODEL (markyd_row_model_get_type())
+G_DECLARE_FINAL_TYPE(MarkydRowModel, markyd_row_model, MARKYD, ROW_MODEL,
+                     GObject)
+
+MarkydRowModel *markyd_row_model_new(void);
+
+/* Set the row count without emitting per-row signals, so detach the model
+ * from its views first. Invalidates existing iters. */
+void markyd_row_model_set_rows(MarkydRowModel *model, guint n_rows);
+
+#endif /* MARKYD_ROW_MODEL_H */
@@ -0,0 +1,393 @@
+#include "text_snapshot.h"
+#include <string.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define MARKYD_HAVE_X86_SIMD 1
+#endif
+
+static void append_adjust(MarkydTextSnapshot *snapshot, gsize folded_offset,
+                          gint delta) {
+  MarkydTextSnapshotAdjust adjust = {folded_offset, delta};
+  g_array_append_val(snapshot->adjustments, adjust);
+}
+
+static gboolean is_utf8_lead_byte(guchar c) { return (c & 0xC0) != 0x80; }
+
+static void build_checkpoints(MarkydTextSnapshot *snapshot) {
+  gint chars = 0;
+  guint next_adjust = 0;
+  gsize count = snapshot->folded_len / MARKYD_TEXT_SNAPSHOT_CHECKPOINT + 1;
+
+  g_array_set_size(snapshot->checkpoints, (guint)count);
+
+  for (gsize i = 0; i < count; i++) {
+    gsize at = i * MARKYD_TEXT_SNAPSHOT_CHECKPOINT;
+    gsize from = (i == 0) ? 0 : at - MARKYD_TEXT_SNAPSHOT_CHECKPOINT;
+
+    if (i > 0) {
+      for (gsize b = from; b < at; b++) {
+        if (is_utf8_lead_byte((guchar)snapshot->folded[b])) {
+          chars++;
+        }
+      }
+    }
+    while (next_adjust < snapshot->adjustments->len) {
+      MarkydTextSnapshotAdjust *adjust = &g_array_index(
+          snapshot->adjustments, MarkydTextSnapshotAdjust, next_adjust);
+      if (adjust->folded_offset > at) {
+        break;
+      }
+      chars += adjust->delta;
+      next_adjust++;
+    }
+    g_array_index(snapshot->checkpoints, gint, i) = chars;
+  }
+}
+
+static void build_text_checkpoints(MarkydTextSnapshot *snapshot) {
+  gint chars = 0;
+  gsize count = snapshot->text_len / MARKYD_TEXT_SNAPSHOT_CHECKPOINT + 1;
+
+  g_array_set_size(snapshot->text_checkpoints, (guint)count);
+  for (gsize i = 0; i < count; i++) {
+    gsize at = i * MARKYD_TEXT_SNAPSHOT_CHECKPOINT;
+
+    if (i > 0) {
+      for (gsize b = at - MARKYD_TEXT_SNAPSHOT_CHECKPOINT; b < at; b++) {
+        if (is_utf8_lead_byte((guchar)snapshot->text[b])) {
+          chars++;
+        }
+      }
+    }
+    g_array_index(snapshot->text_checkpoints, gint, i) = chars;
+  }
+}
+
+static void set_word_bit(MarkydTextSnapshot *snapshot, gint char_offset) {
+  snapshot->word_bits[char_offset >> 3] |= (guint8)(1u << (char_offset & 7));
+}
+
+MarkydTextSnapshot *markyd_text_snapshot_new(const gchar *text, gssize len,
+                                             guint generation) {
+  MarkydTextSnapshot *snapshot;
+  GString *out;
+  const gchar *p;
+  const gchar *end;
+
+  if (!text) {
+    text = "";
+    len = 0;
+  }
+  if (len < 0) {
+    len = (gssize)strlen(text);
+  }
+
+  snapshot = g_new0(MarkydTextSnapshot, 1);
+  snapshot->ref_count = 1;
+  snapshot->generation = generation;
+  snapshot->text = g_strndup(text, (gsize)len);
+  snapshot->text_len = (gsize)len;
+  snapshot->text_checkpoints = g_array_new(FALSE, FALSE, sizeof(gint));
+  /* Chars never outnumber bytes. */
+  snapshot->word_bits = g_new0(guint8, (gsize)len / 8 + 1);
+  snapshot->checkpoints = g_array_new(FALSE, FALSE, sizeof(gint));
+  snapshot->adjustments =
+      g_array_new(FALSE, FALSE, sizeof(MarkydTextSnapshotAdjust));
+
+  out = g_string_sized_new((gsize)len + 1);
+  p = text;
+  end = text + len;
+  while (p < end) {
+    guchar c = (guchar)*p;
+
+    snapshot->char_count++;
+    if (c < 0x80) {
+      if (g_ascii_isalnum((gchar)c) || c == '_') {
+        set_word_bit(snapshot, snapshot->char_count - 1);
+      }
+      g_string_append_c(out, g_ascii_tolower((gchar)c));
+      p++;
+      continue;
+    }
+
+    {
+      const gchar *next = g_utf8_next_char(p);
+      gunichar uc = g_utf8_get_char(p);
+
+      if (next > end) {
+        next = end;
+      }
+      if (g_unichar_isalnum(uc)) {
+        set_word_bit(snapshot, snapshot->char_count - 1);
+      }
+      if (uc == MARKYD_TEXT_SNAPSHOT_ANCHOR_CHAR) {
+        append_adjust(snapshot, out->len, 1);
+      } else {
+        gchar *folded = g_utf8_casefold(p, next - p);
+        const gchar *f = folded;
+        gboolean first = TRUE;
+
+        while (*f) {
+          if (!first) {
+            append_adjust(snapshot, out->len + (gsize)(f - folded), -1);
+          }
+          first = FALSE;
+          f = g_utf8_next_char(f);
+        }
+        if (first) {
+          append_adjust(snapshot, out->len, 1);
+        }
+        g_string_append(out, folded);
+        g_free(folded);
+      }
+      p = next;
+    }
+  }
+
+  snapshot->folded_len = out->len;
+  snapshot->folded = g_string_free(out, FALSE);
+  build_checkpoints(snapshot);
+  build_text_checkpoints(snapshot);
+  return snapshot;
+}
+
+MarkydTextSnapshot *markyd_text_snapshot_ref(MarkydTextSnapshot *snapshot) {
+  if (snapshot) {
+    g_atomic_int_inc(&snapshot->ref_count);
+  }
+  return snapshot;
+}
+
+void markyd_text_snapshot_unref(MarkydTextSnapshot *snapshot) {
+  if (!snapshot || !g_atomic_int_dec_and_test(&snapshot->ref_count)) {
+    return;
+  }
+  g_free(snapshot->text);
+  g_array_free(snapshot->text_checkpoints, TRUE);
+  g_free(snapshot->word_bits);
+  g_free(snapshot->folded);
+  g_array_free(snapshot->checkpoints, TRUE);
+  g_array_free(snapshot->adjustments, TRUE);
+  g_free(snapshot);
+}
+
+static guint first_adjust_after(const MarkydTextSnapshot *snapshot, gsize at) {
+  guint lo = 0;
+  guint hi = snapshot->adjustments->len;
+
+  while (lo < hi) {
+    guint mid = lo + (hi - lo) / 2;
+    if (g_array_index(snapshot->adjustments, MarkydTextSnapshotAdjust, mid)
+            .folded_offset <= at) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  return lo;
+}
+
+gint markyd_text_snapshot_char_offset(const MarkydTextSnapshot *snapshot,
+                                      gsize folded_offset) {
+  gsize cp;
+  gsize at;
+  gint chars;
+
+  if (!snapshot) {
+    return 0;
+  }
+  if (folded_offset >= snapshot->folded_len) {
+    return snapshot->char_count;
+  }
+
+  cp = folded_offset / MARKYD_TEXT_SNAPSHOT_CHECKPOINT;
+  at = cp * MARKYD_TEXT_SNAPSHOT_CHECKPOINT;
+  chars = g_array_index(snapshot->checkpoints, gint, cp);
+
+  for (gsize b = at; b < folded_offset; b++) {
+    if (is_utf8_lead_byte((guchar)snapshot->folded[b])) {
+      chars++;
+    }
+  }
+
+  for (guint i = first_adjust_after(snapshot, at); i < snapshot->adjustments->len;
+       i++) {
+    MarkydTextSnapshotAdjust *adjust =
+        &g_array_index(snapshot->adjustments, MarkydTextSnapshotAdjust, i);
+    if (adjust->folded_offset > folded_offset) {
+      break;
+    }
+    chars += adjust->delta;
+  }
+
+  return chars;
+}
+
+gint markyd_text_snapshot_text_char_offset(const MarkydTextSnapshot *snapshot,
+                                           gsize text_offset) {
+  gsize cp;
+  gint chars;
+
+  if (!snapshot) {
+    return 0;
+  }
+  if (text_offset >= snapshot->text_len) {
+    return snapshot->char_count;
+  }
+
+  cp = text_offset / MARKYD_TEXT_SNAPSHOT_CHECKPOINT;
+  chars = g_array_index(snapshot->text_checkpoints, gint, cp);
+  for (gsize b = cp * MARKYD_TEXT_SNAPSHOT_CHECKPOINT; b < text_offset; b++) {
+    if (is_utf8_lead_byte((guchar)snapshot->text[b])) {
+      chars++;
+    }
+  }
+  return chars;
+}
+
+gboolean markyd_text_snapshot_is_word_char(const MarkydTextSnapshot *snapshot,
+                                           gint char_offset) {
+  if (!snapshot || char_offset < 0 || char_offset >= snapshot->char_count) {
+    return FALSE;
+  }
+  return (snapshot->word_bits[char_offset >> 3] >> (char_offset & 7)) & 1;
+}
+
+gboolean markyd_text_snapshot_is_whole_word(const MarkydTextSnapshot *snapshot,
+                                            gint start_offset, gint end_offset) {
+  /* A boundary sits between two chars that differ in word-ness. */
+  return markyd_text_snapshot_is_word_char(snapshot, start_offset - 1) !=
+             markyd_text_snapshot_is_word_char(snapshot, start_offset) &&
+         markyd_text_snapshot_is_word_char(snapshot, end_offset - 1) !=
+             markyd_text_snapshot_is_word_char(snapshot, end_offset);
+}
+
+gboolean markyd_text_snapshot_word_bounds(const MarkydTextSnapshot *snapshot,
+                                          gint char_offset, gint *out_start,
+                                          gint *out_end) {
+  gint start = char_offset;
+  gint end = char_offset;
+
+  if (!markyd_text_snapshot_is_word_char(snapshot, char_offset)) {
+    return FALSE;
+  }
+
+  while (markyd_text_snapshot_is_word_char(snapshot, start - 1)) {
+    start--;
+  }
+  while (markyd_text_snapshot_is_word_char(snapshot, end)) {
+    end++;
+  }
+  if (out_start) {
+    *out_start = start;
+  }
+  if (out_end) {
+    *out_end = end;
+  }
+  return TRUE;
+}
+
+static gssize find_scalar(const gchar *haystack, gsize haystack_len, gsize from,
+                          const gchar *needle, gsize needle_len) {
+  const gchar first = needle[0];
+  const gchar last = needle[needle_len - 1];
+
+  for (gsize i = from; i + needle_len <= haystack_len; i++) {
+    if (haystack[i] == first && haystack[i + needle_len - 1] == last &&
+        memcmp(haystack + i, needle, needle_len) == 0) {
+      return (gssize)i;
+    }
+  }
+  return -1;
+}
+
+#ifdef MARKYD_HAVE_X86_SIMD
+/* Compare the first and last needle bytes against 16/32 candidate positions at
+ * once and only memcmp where both agree. */
+__attribute__((target("sse2"))) static gssize
+find_sse2(const gchar *haystack, gsize haystack_len, gsize from,
+          const gchar *needle, gsize needle_len) {
+  const __m128i first = _mm_set1_epi8(needle[0]);
+  const __m128i last = _mm_set1_epi8(needle[needle_len - 1]);
+  gsize i = from;
+
+  for (; i + needle_len - 1 + 16 <= haystack_len; i += 16) {
+    __m128i block_first = _mm_loadu_si128((const __m128i *)(haystack + i));
+    __m128i block_last =
+        _mm_loadu_si128((const __m128i *)(haystack + i + needle_len - 1));
+    guint mask = (guint)_mm_movemask_epi8(_mm_and_si128(
+        _mm_cmpeq_epi8(first, block_first), _mm_cmpeq_epi8(last, block_last)));
+
+    while (mask != 0) {
+      guint bit = (guint)__builtin_ctz(mask);
+      if (memcmp(haystack + i + bit + 1, needle + 1, needle_len - 1) == 0) {
+        return (gssize)(i + bit);
+      }
+      mask &= mask - 1;
+    }
+  }
+
+  return find_scalar(haystack, haystack_len, i, needle, needle_len);
+}
+
+__attribute__((target("avx2"))) static gssize
+find_avx2(const gchar *haystack, gsize haystack_len, gsize from,
+          const gchar *needle, gsize needle_len) {
+  const __m256i first = _mm256_set1_epi8(needle[0]);
+  const __m256i last = _mm256_set1_epi8(needle[needle_len - 1]);
+  gsize i = from;
+
+  for (; i + needle_len - 1 + 32 <= haystack_len; i += 32) {
+    __m256i block_first = _mm256_loadu_si256((const __m256i *)(haystack + i));
+    __m256i block_last =
+        _mm256_loadu_si256((const __m256i *)(haystack + i + needle_len - 1));
+    guint mask = (guint)_mm256_movemask_epi8(
+        _mm256_and_si256(_mm256_cmpeq_epi8(first, block_first),
+                         _mm256_cmpeq_epi8(last, block_last)));
+
+    while (mask != 0) {
+      guint bit = (guint)__builtin_ctz(mask);
+      if (memcmp(haystack + i + bit + 1, needle + 1, needle_len - 1) == 0) {
+        return (gssize)(i + bit);
+      }
+      mask &= mask - 1;
+    }
+  }
+
+  return find_sse2(haystack, haystack_len, i, needle, needle_len);
+}
+
+/* Search can run on worker threads, so probe the CPU exactly once. */
+static gboolean find_use_avx2(void) {
+  static gsize level = 0;
+
+  if (g_once_init_enter(&level)) {
+    __builtin_cpu_init();
+    g_once_init_leave(&level, __builtin_cpu_supports("avx2") ? 2 : 1);
+  }
+  return level == 2;
+}
+#endif
+
+gssize markyd_text_find(const gchar *haystack, gsize haystack_len, gsize from,
+                        const gchar *needle, gsize needle_len) {
+  if (!haystack || !needle || needle_len == 0 || from >= haystack_len ||
+      needle_len > haystack_len - from) {
+    return -1;
+  }
+
+  if (needle_len == 1) {
+    const gchar *hit = memchr(haystack + from, needle[0], haystack_len - from);
+    return hit ? (gssize)(hit - haystack) : -1;
+  }
+
+#ifdef MARKYD_HAVE_X86_SIMD
+  if (find_use_avx2()) {
+    return find_avx2(haystack, haystack_len, from, needle, needle_len);
+  }
+  return find_sse2(haystack, haystack_len, from, needle, needle_len);
+#else
+  return find_scalar(haystack, haystack_len, from, needle, needle_len);
+#endif
+}
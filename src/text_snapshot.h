@@ -0,0 +1,67 @@
+#ifndef MARKYD_TEXT_SNAPSHOT_H
+#define MARKYD_TEXT_SNAPSHOT_H
+
+#include <glib.h>
+
+/* Character GTK uses for child anchors in buffer slices. */
+#define MARKYD_TEXT_SNAPSHOT_ANCHOR_CHAR 0xFFFC
+
+/* Casefolded copy of rendered buffer text used for fast case-insensitive search.
+ * Child anchors are dropped, matching GTK_TEXT_SEARCH_TEXT_ONLY. Snapshots are
+ * immutable once built and may be shared with worker threads by reference. */
+typedef struct _MarkydTextSnapshot {
+  gint ref_count;
+  guint generation;
+  /* Unmodified slice; char offsets equal buffer offsets. */
+  gchar *text;
+  gsize text_len;
+  /* Char offset at every MARKYD_TEXT_SNAPSHOT_CHECKPOINT bytes of text. */
+  GArray *text_checkpoints; /* gint */
+  /* One bit per char: set for word chars (alphanumerics and '_'). */
+  guint8 *word_bits;
+  gchar *folded;
+  gsize folded_len;
+  gint char_count;
+  /* Source char offset at every MARKYD_TEXT_SNAPSHOT_CHECKPOINT folded bytes. */
+  GArray *checkpoints; /* gint */
+  /* Places where one source char does not fold to exactly one char. */
+  GArray *adjustments; /* MarkydTextSnapshotAdjust */
+} MarkydTextSnapshot;
+
+typedef struct {
+  gsize folded_offset;
+  gint delta;
+} MarkydTextSnapshotAdjust;
+
+#define MARKYD_TEXT_SNAPSHOT_CHECKPOINT 256
+
+/* Build a snapshot from a buffer slice (hidden chars included). */
+MarkydTextSnapshot *markyd_text_snapshot_new(const gchar *text, gssize len,
+                                             guint generation);
+MarkydTextSnapshot *markyd_text_snapshot_ref(MarkydTextSnapshot *snapshot);
+void markyd_text_snapshot_unref(MarkydTextSnapshot *snapshot);
+
+/* Map a byte offset into snapshot->folded back to a buffer char offset. */
+gint markyd_text_snapshot_char_offset(const MarkydTextSnapshot *snapshot,
+                                      gsize folded_offset);
+
+/* Map a byte offset into snapshot->text to a buffer char offset. */
+gint markyd_text_snapshot_text_char_offset(const MarkydTextSnapshot *snapshot,
+                                           gsize text_offset);
+
+/* Word-boundary queries answered from the word bitmap. */
+gboolean markyd_text_snapshot_is_word_char(const MarkydTextSnapshot *snapshot,
+                                           gint char_offset);
+gboolean markyd_text_snapshot_is_whole_word(const MarkydTextSnapshot *snapshot,
+                                            gint start_offset, gint end_offset);
+/* Extent of the word containing char_offset; FALSE if it is not a word char. */
+gboolean markyd_text_snapshot_word_bounds(const MarkydTextSnapshot *snapshot,
+                                          gint char_offset, gint *out_start,
+                                          gint *out_end);
+
+/* Find needle in haystack at or after from; returns byte offset or -1.
+ * Uses a vectorized first/last byte filter when the CPU supports it. */
+gssize markyd_text_find(const gchar *haystack, gsize haystack_len, gsize from,
+                        const gchar *needle, gsize needle_len);
+
+#endif /* MARKYD_TEXT_SNAPSHOT_H */
@@ -2,7 +2,10 @@
 #include "app.h"
 #include "config.h"
 #include "editor.h"
+#include "fuzzy_match.h"
 #include "markdown.h"
+#include "row_model.h"
+#include <string.h>
 
 typedef struct {
   gint start_offset;
@@ -10,20 +13,102 @@ typedef struct {
   GtkTextChildAnchor *table_anchor;
   gint table_row;
   gint table_col;
+  /* Match in the hidden lines of a collapsed code block: the offsets above
+   * cover its expand control and these are chars into the tail. */
+  ViewmdCollapsedCode *collapsed;
+  gint collapsed_start;
+  gint collapsed_end;
+  /* Byte range in the snapshot text searched (folded, or raw when matching
+   * case); the tail's own snapshot for collapsed matches. */
+  gsize haystack_start;
+  gsize haystack_end;
 } SearchMatch;
 
+typedef struct {
+  gint start_offset;
+  gint end_offset;
+} SearchTagSpan;
+
+/* Regex scan state shared with a worker thread. The worker only reads the
+ * snapshot and regex and fills the result fields; everything else happens on
+ * the main thread. */
+typedef struct {
+  MarkydWindow *window;
+  GRegex *regex;
+  MarkydTextSnapshot *snapshot;
+  gint64 deadline;
+  gint anchor_offset;
+  gboolean whole_word;
+  gint cancelled;
+  GArray *matches; /* SearchMatch */
+  gboolean timed_out;
+  gboolean limit_hit;  /* A regex call gave up on backtracking. */
+  gboolean lines_split; /* A line was matched in chunks. */
+  /* Collapsed code tails, scanned after the buffer text. The tails are only
+   * dereferenced on the main thread, the snapshots are ref'd. */
+  GPtrArray *tails;          /* ViewmdCollapsedCode* */
+  GPtrArray *tail_snapshots; /* MarkydTextSnapshot* */
+} RegexSearchJob;
+
 #define TAG_SEARCH_MATCH "viewmd_search_match"
 #define TAG_SEARCH_CURRENT "viewmd_search_current"
 
+/* Chars of context shown on each side of a match in the results panel. */
+#define SEARCH_RESULT_CONTEXT_CHARS 40
+
+typedef struct {
+  gint heading;
+  gint score;
+} HeadingCandidate;
+
+/* A heading of the render index (top is its position there) or of a folded
+ * section (top is -1). */
+typedef struct {
+  ViewmdRenderHeading *heading;
+  gint top;
+} HeadingRow;
+
+/* Rows shown in the heading palette; ranking still covers every heading. */
+#define HEADING_PALETTE_MAX_ROWS 200
+
+/* Heading level whose sections Ctrl+[ folds. */
+#define FOLD_ALL_LEVEL 2
+
+/* Width in pixels of the scrollbar match marker strip. */
+#define MATCH_MARKER_WIDTH 6
+
+/* Wall-clock budget for one regex scan before partial results are shown. */
+#define SEARCH_REGEX_TIME_LIMIT_US (2 * G_TIME_SPAN_SECOND)
+
+/* Longest subject handed to one regex call; longer lines are matched in
+ * pieces of at most this many bytes. */
+#define SEARCH_REGEX_CHUNK_BYTES (4 * 1024)
+
+/* Backtracking steps one regex call may take before PCRE gives up, so a
+ * pathological pattern cannot hold the worker past the time limit. Applied
+ * with an inline (*LIMIT_MATCH=n) since GRegex has no API for it. */
+#define SEARCH_REGEX_MATCH_LIMIT 1000000
+
 static void on_open_clicked(GtkButton *button, gpointer user_data);
 static void on_refresh_clicked(GtkButton *button, gpointer user_data);
 static void on_settings_clicked(GtkButton *button, gpointer user_data);
 static void on_search_changed(GtkEditable *editable, gpointer user_data);
+static void on_search_option_toggled(GtkToggleButton *button, gpointer user_data);
+static void cancel_regex_search(MarkydWindow *self);
+static void refresh_search_results_panel(MarkydWindow *self);
+static void invalidate_match_markers(MarkydWindow *self);
+static gboolean on_match_markers_draw(GtkWidget *widget, cairo_t *cr,
+                                      gpointer user_data);
+static void on_search_results_toggled(GtkToggleButton *button, gpointer user_data);
+static void on_search_result_activated(GtkTreeView *view, GtkTreePath *path,
+                                       GtkTreeViewColumn *column,
+                                       gpointer user_data);
 static void on_search_prev_clicked(GtkButton *button, gpointer user_data);
 static void on_search_next_clicked(GtkButton *button, gpointer user_data);
 static gboolean on_search_entry_key_press(GtkWidget *widget, GdkEventKey *event,
                                           gpointer user_data);
-static void on_editor_buffer_changed(GtkTextBuffer *buffer, gpointer user_data);
+static void on_editor_rendered(MarkydEditor *editor, guint generation,
+                               gpointer user_data);
 static void ensure_search_tags(MarkydWindow *self);
 static void update_search_tag_styles(MarkydWindow *self, const gchar *match_bg,
                                      const gchar *match_fg,
@@ -31,6 +116,11 @@ static void update_search_tag_styles(MarkydWindow *self, const gchar *match_bg,
                                      const gchar *current_fg);
 static void clear_search_matches(MarkydWindow *self);
 static void update_search_matches(MarkydWindow *self);
+static void update_search_matches_near(MarkydWindow *self, gint anchor_offset);
+static void refresh_visible_search_tags(MarkydWindow *self);
+static void on_scroll_adjustment_changed(GtkAdjustment *adjustment,
+                                         gpointer user_data);
+static void sync_outline_current(MarkydWindow *self);
 static void jump_to_search_match(MarkydWindow *self, gint index,
                                  gboolean scroll_to_match);
 static void clear_table_search_highlight(MarkydWindow *self, gboolean clear_match,
@@ -46,6 +136,8 @@ static void set_table_cell_highlight(GtkWidget *cell, gboolean match,
                                      gboolean current);
 static gboolean scroll_to_table_cell(MarkydWindow *self, GtkWidget *cell);
 static void show_search_ui(MarkydWindow *self);
+static void show_heading_palette(MarkydWindow *self);
+static GtkWidget *create_heading_palette(MarkydWindow *self);
 static void hide_search_ui(MarkydWindow *self);
 static gboolean on_key_press_event(GtkWidget *widget, GdkEventKey *event,
                                    gpointer user_data);
@@ -73,6 +165,7 @@ static gboolean geometry_debug_enabled(void) {
 
 static void ensure_search_tags(MarkydWindow *self) {
   GtkTextTagTable *table;
+  GtkTextTag *tag;
 
   if (!self || !self->editor || !self->editor->buffer) {
     return;
@@ -83,13 +176,18 @@ static void ensure_search_tags(MarkydWindow *self) {
     return;
   }
 
+  /* Hits are recomputed after folding, so folds need not keep them. */
   if (!gtk_text_tag_table_lookup(table, TAG_SEARCH_MATCH)) {
-    gtk_text_buffer_create_tag(self->editor->buffer, TAG_SEARCH_MATCH, "weight",
-                               PANGO_WEIGHT_BOLD, NULL);
+    tag = gtk_text_buffer_create_tag(self->editor->buffer, TAG_SEARCH_MATCH,
+                                     "weight", PANGO_WEIGHT_BOLD, NULL);
+    g_object_set_data(G_OBJECT(tag), VIEWMD_TRANSIENT_TAG_DATA,
+                      GINT_TO_POINTER(1));
   }
   if (!gtk_text_tag_table_lookup(table, TAG_SEARCH_CURRENT)) {
-    gtk_text_buffer_create_tag(self->editor->buffer, TAG_SEARCH_CURRENT, "weight",
-                               PANGO_WEIGHT_BOLD, NULL);
+    tag = gtk_text_buffer_create_tag(self->editor->buffer, TAG_SEARCH_CURRENT,
+                                     "weight", PANGO_WEIGHT_BOLD, NULL);
+    g_object_set_data(G_OBJECT(tag), VIEWMD_TRANSIENT_TAG_DATA,
+                      GINT_TO_POINTER(1));
   }
 }
 
@@ -120,7 +218,35 @@ static void update_search_tag_styles(MarkydWindow *self, const gchar *match_bg,
   }
 }
 
-static void clear_search_matches(MarkydWindow *self) {
+static void set_search_tag_span(MarkydWindow *self, const gchar *tag_name,
+                                gint start_offset, gint end_offset,
+                                gboolean apply) {
+  GtkTextIter start;
+  GtkTextIter end;
+
+  gtk_text_buffer_get_iter_at_offset(self->editor->buffer, &start, start_offset);
+  gtk_text_buffer_get_iter_at_offset(self->editor->buffer, &end, end_offset);
+  if (apply) {
+    gtk_text_buffer_apply_tag_by_name(self->editor->buffer, tag_name, &start,
+                                      &end);
+  } else {
+    gtk_text_buffer_remove_tag_by_name(self->editor->buffer, tag_name, &start,
+                                       &end);
+  }
+}
+
+static void clear_current_search_tag(MarkydWindow *self) {
+  if (self->search_current_tag_start < 0) {
+    return;
+  }
+  set_search_tag_span(self, TAG_SEARCH_CURRENT, self->search_current_tag_start,
+                      self->search_current_tag_end, FALSE);
+  self->search_current_tag_start = -1;
+  self->search_current_tag_end = -1;
+}
+
+/* Forget tag bookkeeping after the buffer contents changed underneath it. */
+static void reset_search_tags(MarkydWindow *self) {
   GtkTextIter start;
   GtkTextIter end;
 
@@ -128,17 +254,253 @@ static void clear_search_matches(MarkydWindow *self) {
     return;
   }
 
-  gtk_text_buffer_get_bounds(self->editor->buffer, &start, &end);
-  gtk_text_buffer_remove_tag_by_name(self->editor->buffer, TAG_SEARCH_MATCH,
-                                     &start, &end);
-  gtk_text_buffer_remove_tag_by_name(self->editor->buffer, TAG_SEARCH_CURRENT,
-                                     &start, &end);
+  if (self->search_tagged && self->search_tagged->len > 0) {
+    gtk_text_buffer_get_bounds(self->editor->buffer, &start, &end);
+    gtk_text_buffer_remove_tag_by_name(self->editor->buffer, TAG_SEARCH_MATCH,
+                                       &start, &end);
+    g_array_set_size(self->search_tagged, 0);
+  }
+  if (self->search_current_tag_start >= 0) {
+    gtk_text_buffer_get_bounds(self->editor->buffer, &start, &end);
+    gtk_text_buffer_remove_tag_by_name(self->editor->buffer, TAG_SEARCH_CURRENT,
+                                       &start, &end);
+    self->search_current_tag_start = -1;
+    self->search_current_tag_end = -1;
+  }
+}
+
+/* Char range worth tagging: the visible rect plus one page above and below. */
+static gboolean get_search_tag_window(MarkydWindow *self, gint *out_start,
+                                      gint *out_end) {
+  GtkTextView *view;
+  GdkRectangle rect;
+  GtkTextIter iter;
+
+  if (!self->editor->text_view ||
+      !gtk_widget_get_realized(self->editor->text_view)) {
+    return FALSE;
+  }
+
+  view = GTK_TEXT_VIEW(self->editor->text_view);
+  gtk_text_view_get_visible_rect(view, &rect);
+  if (rect.height <= 0) {
+    return FALSE;
+  }
+
+  gtk_text_view_get_iter_at_location(view, &iter, 0, MAX(rect.y - rect.height, 0));
+  gtk_text_iter_set_line_offset(&iter, 0);
+  *out_start = gtk_text_iter_get_offset(&iter);
+
+  gtk_text_view_get_iter_at_location(view, &iter, 0, rect.y + 2 * rect.height);
+  if (!gtk_text_iter_ends_line(&iter)) {
+    gtk_text_iter_forward_to_line_end(&iter);
+  }
+  *out_end = gtk_text_iter_get_offset(&iter);
+  return TRUE;
+}
+
+static guint first_search_match_ending_after(MarkydWindow *self, gint offset) {
+  guint lo = 0;
+  guint hi = self->search_matches->len;
+
+  while (lo < hi) {
+    guint mid = lo + (hi - lo) / 2;
+    if (g_array_index(self->search_matches, SearchMatch, mid).end_offset <= offset) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  return lo;
+}
+
+/* Apply or remove the spans of `spans` that are not present in `other`.
+ * Both arrays are sorted by start offset. */
+static void diff_search_tag_spans(MarkydWindow *self, GArray *spans,
+                                  GArray *other, gboolean apply) {
+  guint j = 0;
+
+  for (guint i = 0; i < spans->len; i++) {
+    SearchTagSpan *span = &g_array_index(spans, SearchTagSpan, i);
+    SearchTagSpan *peer = NULL;
+
+    while (j < other->len &&
+           g_array_index(other, SearchTagSpan, j).start_offset <
+               span->start_offset) {
+      j++;
+    }
+    if (j < other->len) {
+      peer = &g_array_index(other, SearchTagSpan, j);
+    }
+    if (peer && peer->start_offset == span->start_offset &&
+        peer->end_offset == span->end_offset) {
+      continue;
+    }
+    set_search_tag_span(self, TAG_SEARCH_MATCH, span->start_offset,
+                        span->end_offset, apply);
+  }
+}
+
+/* Matches are kept as offsets; only those near the viewport carry a tag. */
+static void refresh_visible_search_tags(MarkydWindow *self) {
+  GArray *wanted;
+  gint window_start;
+  gint window_end;
+
+  if (!self || !self->editor || !self->editor->buffer || !self->search_tagged) {
+    return;
+  }
+
+  wanted = g_array_new(FALSE, FALSE, sizeof(SearchTagSpan));
+  if (self->search_matches && self->search_matches->len > 0 &&
+      get_search_tag_window(self, &window_start, &window_end)) {
+    for (guint i = first_search_match_ending_after(self, window_start);
+         i < self->search_matches->len; i++) {
+      SearchMatch *match = &g_array_index(self->search_matches, SearchMatch, i);
+      SearchTagSpan span;
+
+      if (match->start_offset >= window_end) {
+        break;
+      }
+      if (match->table_anchor || match->collapsed) {
+        /* Table matches live in hidden text and are shown via cell CSS;
+         * collapsed ones are not in the buffer yet. */
+        continue;
+      }
+      span.start_offset = match->start_offset;
+      span.end_offset = match->end_offset;
+      g_array_append_val(wanted, span);
+    }
+  }
+
+  if (wanted->len > 0 || self->search_tagged->len > 0) {
+    ensure_search_tags(self);
+    /* Remove first so a retained neighbour is not punched by a removal. */
+    diff_search_tag_spans(self, self->search_tagged, wanted, FALSE);
+    diff_search_tag_spans(self, wanted, self->search_tagged, TRUE);
+  }
+
+  g_array_free(self->search_tagged, TRUE);
+  self->search_tagged = wanted;
+}
+
+static void on_scroll_adjustment_changed(GtkAdjustment *adjustment,
+                                         gpointer user_data) {
+  MarkydWindow *self = (MarkydWindow *)user_data;
+  refresh_visible_search_tags(self);
+  sync_outline_current(self);
+
+  /* Bins only depend on the document height, not on the scroll position. */
+  if (self->match_markers && self->search_matches &&
+      self->search_matches->len > 0 &&
+      gtk_adjustment_get_upper(adjustment) != self->markers_upper) {
+    invalidate_match_markers(self);
+  }
+}
+
+static void invalidate_match_markers(MarkydWindow *self) {
+  if (!self || !self->match_markers) {
+    return;
+  }
+  self->markers_dirty = TRUE;
+  gtk_widget_queue_draw(self->match_markers);
+}
+
+/* Bin match positions into pixel rows. Line y-ranges come from the text
+ * view's layout, which reports estimated heights for lines not yet validated.
+ * Matches sharing a line are binned once. */
+static void rebuild_match_marker_bins(MarkydWindow *self, gint height) {
+  GtkTextView *view = GTK_TEXT_VIEW(self->editor->text_view);
+  GtkAdjustment *vadj =
+      gtk_scrolled_window_get_vadjustment(GTK_SCROLLED_WINDOW(self->scroll));
+  gdouble upper = gtk_adjustment_get_upper(vadj);
+  gint line_end_offset = -1;
+  GtkTextIter iter;
+
+  g_byte_array_set_size(self->marker_bins, (guint)MAX(height, 0));
+  if (height > 0) {
+    memset(self->marker_bins->data, 0, (gsize)height);
+  }
+  self->markers_upper = upper;
+  self->markers_dirty = FALSE;
+
+  if (height <= 0 || upper <= 0.0 || !self->search_matches) {
+    return;
+  }
+
+  gtk_text_buffer_get_start_iter(self->editor->buffer, &iter);
+  for (guint i = 0; i < self->search_matches->len; i++) {
+    SearchMatch *match = &g_array_index(self->search_matches, SearchMatch, i);
+    gint y;
+    gint line_height;
+    gint row;
+
+    if (match->start_offset < line_end_offset) {
+      continue;
+    }
+
+    gtk_text_iter_set_offset(&iter, match->start_offset);
+    gtk_text_view_get_line_yrange(view, &iter, &y, &line_height);
+    row = (gint)((gdouble)y * height / upper);
+    self->marker_bins->data[CLAMP(row, 0, height - 1)] = 1;
+
+    if (!gtk_text_iter_ends_line(&iter)) {
+      gtk_text_iter_forward_to_line_end(&iter);
+    }
+    line_end_offset = gtk_text_iter_get_offset(&iter) + 1;
+  }
+}
+
+static gboolean on_match_markers_draw(GtkWidget *widget, cairo_t *cr,
+                                      gpointer user_data) {
+  MarkydWindow *self = (MarkydWindow *)user_data;
+  gint width = gtk_widget_get_allocated_width(widget);
+  gint height = gtk_widget_get_allocated_height(widget);
+  GdkRGBA color;
+  gint run_start = -1;
+
+  if (!self->search_matches || self->search_matches->len == 0) {
+    return FALSE;
+  }
+
+  if (self->markers_dirty || (gint)self->marker_bins->len != height) {
+    rebuild_match_marker_bins(self, height);
+  }
+
+  gtk_style_context_get_color(gtk_widget_get_style_context(widget),
+                              gtk_widget_get_state_flags(widget), &color);
+  gdk_cairo_set_source_rgba(cr, &color);
+
+  /* Paint runs of set bins as single rectangles; isolated hits get 2px. */
+  for (gint row = 0; row <= height; row++) {
+    gboolean set = row < height && self->marker_bins->data[row];
+    if (set && run_start < 0) {
+      run_start = row;
+    } else if (!set && run_start >= 0) {
+      cairo_rectangle(cr, 0, run_start, width, MAX(row - run_start, 2));
+      run_start = -1;
+    }
+  }
+  cairo_fill(cr);
+  return FALSE;
+}
+
+static void clear_search_matches(MarkydWindow *self) {
+  if (!self || !self->editor || !self->editor->buffer) {
+    return;
+  }
+
+  cancel_regex_search(self);
   clear_table_search_highlight(self, TRUE, TRUE);
+  clear_current_search_tag(self);
 
   if (self->search_matches) {
     g_array_set_size(self->search_matches, 0);
   }
   self->search_current_index = -1;
+  refresh_visible_search_tags(self);
+  refresh_search_results_panel(self);
+  invalidate_match_markers(self);
 
   if (self->lbl_search_status) {
     gtk_label_set_text(GTK_LABEL(self->lbl_search_status), "");
@@ -242,272 +604,1413 @@ static GtkWidget *lookup_table_cell_widget(GtkWidget *table_widget, gint row,
         break;
       }
     }
-    g_list_free(grid_children);
+    g_list_free(grid_children);
+  }
+  g_list_free(wrapper_children);
+
+  return found;
+}
+
+static void clear_table_search_highlight(MarkydWindow *self, gboolean clear_match,
+                                         gboolean clear_current) {
+  ViewmdRenderIndex *render_index;
+
+  if (!self || !self->editor || !self->editor->render_index) {
+    return;
+  }
+
+  render_index = self->editor->render_index;
+  for (guint t = 0; t < render_index->tables->len; t++) {
+    ViewmdTableSearchIndex *index = g_ptr_array_index(render_index->tables, t);
+    GtkWidget *table_widget =
+        g_object_get_data(G_OBJECT(index->anchor), VIEWMD_TABLE_WIDGET_DATA);
+    if (table_widget && GTK_IS_CONTAINER(table_widget)) {
+      GList *wrapper_children =
+          gtk_container_get_children(GTK_CONTAINER(table_widget));
+      for (GList *w = wrapper_children; w != NULL; w = w->next) {
+        GtkWidget *child = GTK_WIDGET(w->data);
+        if (!GTK_IS_GRID(child)) {
+          continue;
+        }
+        GList *grid_children = gtk_container_get_children(GTK_CONTAINER(child));
+        for (GList *g = grid_children; g != NULL; g = g->next) {
+          GtkWidget *cell = GTK_WIDGET(g->data);
+          if (clear_match) {
+            gtk_style_context_remove_class(gtk_widget_get_style_context(cell),
+                                           VIEWMD_TABLE_CELL_MATCH_CLASS);
+          }
+          if (clear_current) {
+            gtk_style_context_remove_class(gtk_widget_get_style_context(cell),
+                                           VIEWMD_TABLE_CELL_CURRENT_CLASS);
+          }
+        }
+        g_list_free(grid_children);
+      }
+      g_list_free(wrapper_children);
+    }
+  }
+}
+
+static gboolean resolve_table_match_location(MarkydWindow *self, gint start_offset,
+                                             gint end_offset,
+                                             GtkTextChildAnchor **out_anchor,
+                                             gint *out_row, gint *out_col) {
+  ViewmdTableSearchIndex *index;
+  const ViewmdTableSearchCellRange *cell;
+
+  if (out_anchor) {
+    *out_anchor = NULL;
+  }
+  if (out_row) {
+    *out_row = -1;
+  }
+  if (out_col) {
+    *out_col = -1;
+  }
+
+  if (!self || !self->editor || end_offset <= start_offset) {
+    return FALSE;
+  }
+
+  index = markdown_render_index_lookup_table(self->editor->render_index,
+                                             start_offset, end_offset);
+  if (!index) {
+    return FALSE;
+  }
+
+  if (out_anchor) {
+    *out_anchor = index->anchor;
+  }
+  cell = markdown_table_search_index_lookup_cell(index, start_offset, end_offset);
+  if (cell) {
+    if (out_row) {
+      *out_row = cell->row;
+    }
+    if (out_col) {
+      *out_col = cell->col;
+    }
+  }
+  return TRUE;
+}
+
+static void apply_table_search_match_highlight(MarkydWindow *self) {
+  if (!self || !self->search_matches) {
+    return;
+  }
+
+  clear_table_search_highlight(self, TRUE, FALSE);
+
+  for (guint i = 0; i < self->search_matches->len; i++) {
+    SearchMatch *match = &g_array_index(self->search_matches, SearchMatch, i);
+    GtkWidget *table_widget;
+    GtkWidget *cell;
+
+    if (!match->table_anchor || match->table_row < 0 || match->table_col < 0) {
+      continue;
+    }
+
+    table_widget =
+        g_object_get_data(G_OBJECT(match->table_anchor), VIEWMD_TABLE_WIDGET_DATA);
+    cell = lookup_table_cell_widget(table_widget, match->table_row, match->table_col);
+    if (cell) {
+      set_table_cell_highlight(cell, TRUE, FALSE);
+    }
+  }
+}
+
+static void jump_to_search_match(MarkydWindow *self, gint index,
+                                 gboolean scroll_to_match) {
+  GtkTextIter start;
+  GtkTextIter end;
+  SearchMatch *match;
+  gchar *status;
+
+  if (!self || !self->editor || !self->editor->buffer || !self->search_matches ||
+      self->search_matches->len == 0) {
+    return;
+  }
+
+  if (index < 0 || index >= (gint)self->search_matches->len) {
+    return;
+  }
+
+  clear_current_search_tag(self);
+  clear_table_search_highlight(self, FALSE, TRUE);
+
+  match = &g_array_index(self->search_matches, SearchMatch, index);
+  if (match->collapsed) {
+    /* Expanding reruns the search near the current match, so point that at
+     * where this match lands once the tail is in the buffer. */
+    match->start_offset += match->collapsed_start;
+    self->search_current_index = index;
+    markyd_editor_expand_code(self->editor, match->collapsed);
+    return;
+  }
+  if (match->table_anchor && match->table_row >= 0 && match->table_col >= 0) {
+    GtkWidget *table_widget =
+        g_object_get_data(G_OBJECT(match->table_anchor), VIEWMD_TABLE_WIDGET_DATA);
+    GtkWidget *cell =
+        lookup_table_cell_widget(table_widget, match->table_row, match->table_col);
+    if (cell) {
+      set_table_cell_highlight(cell, TRUE, TRUE);
+    }
+  } else {
+    gtk_text_buffer_get_iter_at_offset(self->editor->buffer, &start,
+                                       match->start_offset);
+    gtk_text_buffer_get_iter_at_offset(self->editor->buffer, &end,
+                                       match->end_offset);
+    ensure_search_tags(self);
+    gtk_text_buffer_apply_tag_by_name(self->editor->buffer, TAG_SEARCH_CURRENT,
+                                      &start, &end);
+    self->search_current_tag_start = match->start_offset;
+    self->search_current_tag_end = match->end_offset;
+    gtk_text_buffer_place_cursor(self->editor->buffer, &start);
+  }
+
+  if (scroll_to_match && self->editor->text_view) {
+    if (match->table_anchor) {
+      gboolean scrolled_to_cell = FALSE;
+      if (match->table_row >= 0 && match->table_col >= 0) {
+        GtkWidget *table_widget = g_object_get_data(G_OBJECT(match->table_anchor),
+                                                    VIEWMD_TABLE_WIDGET_DATA);
+        GtkWidget *cell = lookup_table_cell_widget(table_widget, match->table_row,
+                                                   match->table_col);
+        if (cell) {
+          scrolled_to_cell = scroll_to_table_cell(self, cell);
+        }
+      }
+      if (!scrolled_to_cell) {
+        GtkTextIter anchor_iter;
+        gtk_text_buffer_get_iter_at_child_anchor(self->editor->buffer, &anchor_iter,
+                                                 match->table_anchor);
+        gtk_text_view_scroll_to_iter(GTK_TEXT_VIEW(self->editor->text_view),
+                                     &anchor_iter, 0.2, FALSE, 0.0, 0.0);
+      }
+    } else {
+      gtk_text_view_scroll_to_iter(GTK_TEXT_VIEW(self->editor->text_view), &start,
+                                   0.2, FALSE, 0.0, 0.0);
+    }
+  }
+
+  self->search_current_index = index;
+  if (self->results_scroll && gtk_widget_get_visible(self->results_scroll)) {
+    GtkTreePath *path = gtk_tree_path_new_from_indices(index, -1);
+    gtk_tree_selection_select_path(
+        gtk_tree_view_get_selection(GTK_TREE_VIEW(self->results_view)), path);
+    gtk_tree_view_scroll_to_cell(GTK_TREE_VIEW(self->results_view), path, NULL,
+                                 FALSE, 0.0, 0.0);
+    gtk_tree_path_free(path);
+  }
+  status = g_strdup_printf("%d/%u", index + 1, self->search_matches->len);
+  gtk_label_set_text(GTK_LABEL(self->lbl_search_status), status);
+  g_free(status);
+}
+
+static gboolean search_option_active(GtkWidget *toggle) {
+  return toggle && gtk_toggle_button_get_active(GTK_TOGGLE_BUTTON(toggle));
+}
+
+static gboolean search_query_self_overlaps(const gchar *needle) {
+  gsize len;
+
+  if (!needle) {
+    return FALSE;
+  }
+
+  /* A proper border (prefix equal to suffix) lets occurrences overlap, so the
+   * greedy non-overlapping scan may have skipped positions a longer query
+   * would match. */
+  len = strlen(needle);
+  for (gsize k = 1; k < len; k++) {
+    if (memcmp(needle, needle + len - k, k) == 0) {
+      return TRUE;
+    }
+  }
+  return FALSE;
+}
+
+static gboolean can_refine_search_matches(MarkydWindow *self,
+                                          const gchar *needle) {
+  if (!self || !self->search_refine_valid || !self->search_last_query ||
+      !needle) {
+    return FALSE;
+  }
+  /* Whole-word filtering drops prefixes that an extended query could match. */
+  if (search_option_active(self->btn_search_word)) {
+    return FALSE;
+  }
+  if (!g_str_has_prefix(needle, self->search_last_query)) {
+    return FALSE;
+  }
+  return !search_query_self_overlaps(self->search_last_query);
+}
+
+static gint search_haystack_char_offset(const MarkydTextSnapshot *snapshot,
+                                        gboolean case_sensitive, gsize offset) {
+  return case_sensitive
+             ? markyd_text_snapshot_text_char_offset(snapshot, offset)
+             : markyd_text_snapshot_char_offset(snapshot, offset);
+}
+
+/* Append the non-overlapping matches of needle in snapshot, with offsets in
+ * the snapshot's own chars. */
+static void find_snapshot_matches(const MarkydTextSnapshot *snapshot,
+                                  const gchar *needle, gboolean case_sensitive,
+                                  gboolean whole_word, GArray *out) {
+  gsize needle_len = strlen(needle);
+  const gchar *haystack;
+  gsize haystack_len;
+  gssize pos = 0;
+
+  haystack = case_sensitive ? snapshot->text : snapshot->folded;
+  haystack_len = case_sensitive ? snapshot->text_len : snapshot->folded_len;
+  while ((pos = markyd_text_find(haystack, haystack_len, (gsize)pos, needle,
+                                 needle_len)) >= 0) {
+    SearchMatch match = {0};
+
+    match.haystack_start = (gsize)pos;
+    match.haystack_end = (gsize)pos + needle_len;
+    match.start_offset =
+        search_haystack_char_offset(snapshot, case_sensitive, match.haystack_start);
+    match.end_offset =
+        MAX(search_haystack_char_offset(snapshot, case_sensitive,
+                                        match.haystack_end),
+            match.start_offset + 1);
+    if (whole_word && !markyd_text_snapshot_is_whole_word(
+                          snapshot, match.start_offset, match.end_offset)) {
+      pos++;
+      continue;
+    }
+    match.table_row = -1;
+    match.table_col = -1;
+    g_array_append_val(out, match);
+    pos = (gssize)match.haystack_end;
+  }
+}
+
+/* Turn tail-relative offsets into a match on the tail's expand control. */
+static void place_collapsed_match(SearchMatch *match, ViewmdCollapsedCode *code) {
+  match->collapsed = code;
+  match->collapsed_start = match->start_offset;
+  match->collapsed_end = match->end_offset;
+  match->start_offset = code->offset;
+  match->end_offset = code->offset + 1;
+}
+
+static gint compare_search_matches(gconstpointer a, gconstpointer b) {
+  const SearchMatch *ma = (const SearchMatch *)a;
+  const SearchMatch *mb = (const SearchMatch *)b;
+
+  if (ma->start_offset != mb->start_offset) {
+    return ma->start_offset < mb->start_offset ? -1 : 1;
+  }
+  return ma->collapsed_start < mb->collapsed_start
+             ? -1
+             : ma->collapsed_start > mb->collapsed_start;
+}
+
+static void collect_search_matches_full(MarkydWindow *self, const gchar *needle,
+                                        GArray *out) {
+  const MarkydTextSnapshot *snapshot =
+      markyd_editor_get_text_snapshot(self->editor);
+  GPtrArray *tails = self->editor->render_index->collapsed_code;
+  gboolean case_sensitive = search_option_active(self->btn_search_case);
+  gboolean whole_word = search_option_active(self->btn_search_word);
+  guint buffer_matches;
+
+  if (!snapshot) {
+    return;
+  }
+
+  find_snapshot_matches(snapshot, needle, case_sensitive, whole_word, out);
+  for (guint i = 0; i < out->len; i++) {
+    SearchMatch *match = &g_array_index(out, SearchMatch, i);
+    resolve_table_match_location(self, match->start_offset, match->end_offset,
+                                 &match->table_anchor, &match->table_row,
+                                 &match->table_col);
+  }
+
+  buffer_matches = out->len;
+  for (guint t = 0; t < tails->len; t++) {
+    ViewmdCollapsedCode *code = g_ptr_array_index(tails, t);
+    guint first = out->len;
+
+    find_snapshot_matches(markdown_collapsed_code_snapshot(code), needle,
+                          case_sensitive, whole_word, out);
+    for (guint i = first; i < out->len; i++) {
+      place_collapsed_match(&g_array_index(out, SearchMatch, i), code);
+    }
+  }
+  if (out->len > buffer_matches) {
+    g_array_sort(out, compare_search_matches);
+  }
+}
+
+/* Every match of an extended query starts at a match of the previous query, so
+ * only those candidates need to be verified. */
+static void collect_search_matches_refined(MarkydWindow *self,
+                                           const gchar *needle, GArray *out) {
+  const MarkydTextSnapshot *snapshot =
+      markyd_editor_get_text_snapshot(self->editor);
+  gboolean case_sensitive = search_option_active(self->btn_search_case);
+  gsize needle_len = strlen(needle);
+  const MarkydTextSnapshot *last_snapshot = NULL;
+  const gchar *haystack;
+  gsize haystack_len;
+  gsize last_end = 0;
+
+  if (!snapshot) {
+    return;
+  }
+
+  for (guint i = 0; i < self->search_matches->len; i++) {
+    SearchMatch *candidate = &g_array_index(self->search_matches, SearchMatch, i);
+    const MarkydTextSnapshot *searched =
+        candidate->collapsed
+            ? markdown_collapsed_code_snapshot(candidate->collapsed)
+            : snapshot;
+    SearchMatch match;
+
+    /* Collapsed tails are contiguous runs with their own haystack. */
+    if (searched != last_snapshot) {
+      last_snapshot = searched;
+      last_end = 0;
+    }
+    haystack = case_sensitive ? searched->text : searched->folded;
+    haystack_len = case_sensitive ? searched->text_len : searched->folded_len;
+
+    /* Keep the greedy non-overlapping semantics of the full scan. */
+    if (candidate->haystack_start < last_end ||
+        candidate->haystack_start + needle_len > haystack_len ||
+        memcmp(haystack + candidate->haystack_start, needle, needle_len) != 0) {
+      continue;
+    }
+
+    match = *candidate;
+    match.haystack_end = match.haystack_start + needle_len;
+    if (match.collapsed) {
+      match.collapsed_end =
+          MAX(search_haystack_char_offset(searched, case_sensitive,
+                                          match.haystack_end),
+              match.collapsed_start + 1);
+    } else {
+      match.end_offset =
+          MAX(search_haystack_char_offset(snapshot, case_sensitive,
+                                          match.haystack_end),
+              match.start_offset + 1);
+    }
+    g_array_append_val(out, match);
+    last_end = match.haystack_end;
+  }
+}
+
+static void invalidate_search_refinement(MarkydWindow *self) {
+  if (!self) {
+    return;
+  }
+  self->search_refine_valid = FALSE;
+  g_free(self->search_last_query);
+  self->search_last_query = NULL;
+}
+
+/* Index of the match starting closest to offset; 0 when offset is negative. */
+static gint nearest_search_match(MarkydWindow *self, gint offset) {
+  guint lo = 0;
+  guint hi = self->search_matches->len;
+
+  if (offset < 0 || hi == 0) {
+    return 0;
+  }
+
+  while (lo < hi) {
+    guint mid = lo + (hi - lo) / 2;
+    if (g_array_index(self->search_matches, SearchMatch, mid).start_offset < offset) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+
+  if (lo == self->search_matches->len) {
+    return (gint)lo - 1;
+  }
+  if (lo > 0 &&
+      offset - g_array_index(self->search_matches, SearchMatch, lo - 1).start_offset <
+          g_array_index(self->search_matches, SearchMatch, lo).start_offset - offset) {
+    return (gint)lo - 1;
+  }
+  return (gint)lo;
+}
+
+static void update_search_matches(MarkydWindow *self) {
+  update_search_matches_near(self, -1);
+}
+
+/* Replace the current match set (takes ownership of found) and select the
+ * match nearest anchor_offset. */
+static void install_search_matches(MarkydWindow *self, GArray *found,
+                                   gint anchor_offset) {
+  if (found->len == 0) {
+    g_array_free(found, TRUE);
+    clear_search_matches(self);
+  } else {
+    clear_table_search_highlight(self, TRUE, TRUE);
+    clear_current_search_tag(self);
+    g_array_free(self->search_matches, TRUE);
+    self->search_matches = found;
+    self->search_current_index = -1;
+  }
+
+  if (self->search_matches->len == 0) {
+    gtk_label_set_text(GTK_LABEL(self->lbl_search_status), "0 matches");
+    return;
+  }
+
+  gtk_widget_set_sensitive(self->btn_search_prev, TRUE);
+  gtk_widget_set_sensitive(self->btn_search_next, TRUE);
+  apply_table_search_match_highlight(self);
+  refresh_search_results_panel(self);
+  invalidate_match_markers(self);
+  jump_to_search_match(self, nearest_search_match(self, anchor_offset), TRUE);
+  refresh_visible_search_tags(self);
+}
+
+static void regex_search_job_free(RegexSearchJob *job) {
+  if (!job) {
+    return;
+  }
+  g_regex_unref(job->regex);
+  markyd_text_snapshot_unref(job->snapshot);
+  if (job->matches) {
+    g_array_free(job->matches, TRUE);
+  }
+  g_ptr_array_free(job->tails, TRUE);
+  g_ptr_array_free(job->tail_snapshots, TRUE);
+  g_free(job);
+}
+
+static void cancel_regex_search(MarkydWindow *self) {
+  RegexSearchJob *job;
+
+  if (!self || !self->search_regex_job) {
+    return;
+  }
+  job = (RegexSearchJob *)self->search_regex_job;
+  g_atomic_int_set(&job->cancelled, 1);
+  self->search_regex_job = NULL;
+}
+
+static gboolean deliver_regex_search(gpointer user_data) {
+  RegexSearchJob *job = (RegexSearchJob *)user_data;
+  MarkydWindow *self = job->window;
+  GArray *found;
+
+  if (g_atomic_int_get(&job->cancelled) || self->search_regex_job != job) {
+    regex_search_job_free(job);
+    return G_SOURCE_REMOVE;
+  }
+  self->search_regex_job = NULL;
+
+  found = job->matches;
+  job->matches = NULL;
+  for (guint i = 0; i < found->len; i++) {
+    SearchMatch *match = &g_array_index(found, SearchMatch, i);
+    if (match->collapsed) {
+      place_collapsed_match(match, match->collapsed);
+      continue;
+    }
+    resolve_table_match_location(self, match->start_offset, match->end_offset,
+                                 &match->table_anchor, &match->table_row,
+                                 &match->table_col);
+  }
+  if (job->tails->len > 0) {
+    g_array_sort(found, compare_search_matches);
+  }
+  install_search_matches(self, found, job->anchor_offset);
+
+  if (job->timed_out || job->limit_hit || job->lines_split) {
+    gchar *status = g_strdup_printf(
+        "%s (%s)", gtk_label_get_text(GTK_LABEL(self->lbl_search_status)),
+        job->timed_out   ? "timed out, results incomplete"
+        : job->limit_hit ? "pattern too complex for some lines, results "
+                           "may be incomplete"
+                         : "long lines split, results may be incomplete");
+    gtk_label_set_text(GTK_LABEL(self->lbl_search_status), status);
+    g_free(status);
+  }
+
+  regex_search_job_free(job);
+  return G_SOURCE_REMOVE;
+}
+
+/* Lines are matched one at a time and over-long lines in chunks of at most
+ * SEARCH_REGEX_CHUNK_BYTES, so each regex call sees a bounded subject; a match
+ * cannot span a chunk boundary. Each call is also bounded by
+ * SEARCH_REGEX_MATCH_LIMIT, and a chunk that exceeds it is skipped. The
+ * deadline and cancellation are checked before every call and between
+ * matches. FALSE once cancelled or out of time. */
+static gboolean regex_scan_snapshot(RegexSearchJob *job,
+                                    const MarkydTextSnapshot *snapshot,
+                                    ViewmdCollapsedCode *tail) {
+  const gchar *text = snapshot->text;
+  gsize text_len = snapshot->text_len;
+  const gchar *offset_at = text;
+  glong char_offset = 0;
+  gsize line_start = 0;
+
+  for (;;) {
+    const gchar *newline;
+    gsize line_end;
+    gsize chunk_start;
+
+    newline = memchr(text + line_start, '\n', text_len - line_start);
+    line_end = newline ? (gsize)(newline - text) : text_len;
+
+    chunk_start = line_start;
+    do {
+      gsize chunk_end = MIN(line_end, chunk_start + SEARCH_REGEX_CHUNK_BYTES);
+      GRegexMatchFlags flags = 0;
+      GMatchInfo *info = NULL;
+      GError *error = NULL;
+
+      /* Never split a UTF-8 sequence. */
+      while (chunk_end < line_end && chunk_end > chunk_start + 1 &&
+             ((guchar)text[chunk_end] & 0xC0) == 0x80) {
+        chunk_end--;
+      }
+      if (chunk_start > line_start) {
+        flags |= G_REGEX_MATCH_NOTBOL;
+      }
+      if (chunk_end < line_end) {
+        flags |= G_REGEX_MATCH_NOTEOL;
+        job->lines_split = TRUE;
+      }
+
+      if (g_atomic_int_get(&job->cancelled)) {
+        return FALSE;
+      }
+      if (g_get_monotonic_time() > job->deadline) {
+        job->timed_out = TRUE;
+        return FALSE;
+      }
+
+      g_regex_match_full(job->regex, text + chunk_start,
+                         (gssize)(chunk_end - chunk_start), 0, flags, &info,
+                         &error);
+      while (!error && g_match_info_matches(info)) {
+        gint match_start;
+        gint match_end;
+
+        if (g_match_info_fetch_pos(info, 0, &match_start, &match_end) &&
+            match_end > match_start) {
+          SearchMatch match = {0};
+          const gchar *at = text + chunk_start + match_start;
+
+          char_offset += g_utf8_pointer_to_offset(offset_at, at);
+          offset_at = at;
+          match.start_offset = (gint)char_offset;
+          at = text + chunk_start + match_end;
+          char_offset += g_utf8_pointer_to_offset(offset_at, at);
+          offset_at = at;
+          match.end_offset = (gint)char_offset;
+          match.table_row = -1;
+          match.table_col = -1;
+          /* Placed on the expand control once back on the main thread. */
+          match.collapsed = tail;
+          if (!job->whole_word ||
+              markyd_text_snapshot_is_whole_word(snapshot, match.start_offset,
+                                                 match.end_offset)) {
+            g_array_append_val(job->matches, match);
+          }
+        }
+        if (g_atomic_int_get(&job->cancelled) ||
+            g_get_monotonic_time() > job->deadline) {
+          break;
+        }
+        g_match_info_next(info, &error);
+      }
+      g_match_info_free(info);
+      if (error) {
+        /* Only matching errors are expected here: the match limit. */
+        job->limit_hit = TRUE;
+        g_error_free(error);
+      }
+      chunk_start = chunk_end;
+    } while (chunk_start < line_end);
+
+    if (!newline) {
+      return TRUE;
+    }
+    line_start = line_end + 1;
+  }
+}
+
+static void regex_search_worker(gpointer data, gpointer user_data) {
+  RegexSearchJob *job = (RegexSearchJob *)data;
+  (void)user_data;
+
+  /* Jobs superseded while queued are handed straight back to be freed. */
+  if (!g_atomic_int_get(&job->cancelled) &&
+      regex_scan_snapshot(job, job->snapshot, NULL)) {
+    for (guint i = 0; i < job->tails->len; i++) {
+      if (!regex_scan_snapshot(job, g_ptr_array_index(job->tail_snapshots, i),
+                               g_ptr_array_index(job->tails, i))) {
+        break;
+      }
+    }
+  }
+
+  g_idle_add(deliver_regex_search, job);
+}
+
+/* One worker: a new keystroke queues behind the cancelled scan instead of
+ * starting another thread. Every regex call is bounded by the match limit,
+ * so the cancelled scan gives the worker up quickly. */
+static GThreadPool *regex_search_pool(void) {
+  static GThreadPool *pool = NULL;
+
+  if (g_once_init_enter(&pool)) {
+    GThreadPool *created =
+        g_thread_pool_new(regex_search_worker, NULL, 1, FALSE, NULL);
+    g_once_init_leave(&pool, created);
+  }
+  return pool;
+}
+
+static void start_regex_search(MarkydWindow *self, const gchar *pattern,
+                               gint anchor_offset) {
+  RegexSearchJob *job;
+  GRegex *regex;
+  GRegexCompileFlags flags = G_REGEX_OPTIMIZE;
+  MarkydTextSnapshot *snapshot;
+  GError *error = NULL;
+  gchar *limited;
+
+  if (!search_option_active(self->btn_search_case)) {
+    flags |= G_REGEX_CASELESS;
+  }
+  limited = g_strdup_printf("(*LIMIT_MATCH=%d)%s", SEARCH_REGEX_MATCH_LIMIT,
+                            pattern);
+  regex = g_regex_new(limited, flags, 0, &error);
+  g_free(limited);
+  if (!regex) {
+    clear_search_matches(self);
+    gtk_label_set_text(GTK_LABEL(self->lbl_search_status), "Invalid pattern");
+    if (error) {
+      g_error_free(error);
+    }
+    return;
+  }
+
+  snapshot = markyd_editor_get_text_snapshot(self->editor);
+  if (!snapshot) {
+    g_regex_unref(regex);
+    return;
+  }
+
+  job = g_new0(RegexSearchJob, 1);
+  job->window = self;
+  job->regex = regex;
+  job->snapshot = markyd_text_snapshot_ref(snapshot);
+  job->deadline = g_get_monotonic_time() + SEARCH_REGEX_TIME_LIMIT_US;
+  job->anchor_offset = anchor_offset;
+  job->whole_word = search_option_active(self->btn_search_word);
+  job->matches = g_array_new(FALSE, FALSE, sizeof(SearchMatch));
+  job->tails = g_ptr_array_new();
+  job->tail_snapshots = g_ptr_array_new_with_free_func(
+      (GDestroyNotify)markyd_text_snapshot_unref);
+  for (guint i = 0; i < self->editor->render_index->collapsed_code->len; i++) {
+    ViewmdCollapsedCode *code =
+        g_ptr_array_index(self->editor->render_index->collapsed_code, i);
+    g_ptr_array_add(job->tails, code);
+    g_ptr_array_add(job->tail_snapshots, markyd_text_snapshot_ref(
+                                             markdown_collapsed_code_snapshot(code)));
+  }
+  self->search_regex_job = job;
+  gtk_label_set_text(GTK_LABEL(self->lbl_search_status), "Searching...");
+
+  g_thread_pool_push(regex_search_pool(), job, NULL);
+}
+
+/* Recompute matches and select the one nearest anchor_offset (-1: first). */
+static void update_search_matches_near(MarkydWindow *self, gint anchor_offset) {
+  const gchar *query;
+  gchar *needle;
+  GArray *found;
+
+  if (!self || !self->editor || !self->editor->buffer || !self->search_entry) {
+    return;
+  }
+
+  query = gtk_entry_get_text(GTK_ENTRY(self->search_entry));
+
+  if (!query || query[0] == '\0') {
+    clear_search_matches(self);
+    invalidate_search_refinement(self);
+    return;
+  }
+
+  cancel_regex_search(self);
+  if (search_option_active(self->btn_search_regex)) {
+    /* Drop the old set now: its table anchors may not outlive the scan. */
+    clear_search_matches(self);
+    invalidate_search_refinement(self);
+    start_regex_search(self, query, anchor_offset);
+    return;
+  }
+
+  needle = search_option_active(self->btn_search_case)
+               ? g_strdup(query)
+               : g_utf8_casefold(query, -1);
+  found = g_array_new(FALSE, FALSE, sizeof(SearchMatch));
+  if (can_refine_search_matches(self, needle)) {
+    collect_search_matches_refined(self, needle, found);
+  } else {
+    collect_search_matches_full(self, needle, found);
+  }
+
+  install_search_matches(self, found, anchor_offset);
+
+  g_free(self->search_last_query);
+  self->search_last_query = needle;
+  self->search_refine_valid = TRUE;
+}
+
+static void append_escaped_range(GString *markup, const gchar *start,
+                                 const gchar *end, gboolean bold) {
+  gchar *escaped = g_markup_escape_text(start, (gssize)(end - start));
+  g_string_append_printf(markup, bold ? "<b>%s</b>" : "%s", escaped);
+  g_free(escaped);
+}
+
+/* Snippet for a match still inside a collapsed tail, cut the same way as a
+ * buffer snippet: the match line, at most the context width on each side. */
+static void append_collapsed_match_snippet(GString *markup,
+                                           const SearchMatch *match) {
+  const gchar *text = match->collapsed->text;
+  const gchar *start = g_utf8_offset_to_pointer(text, match->collapsed_start);
+  const gchar *end = g_utf8_offset_to_pointer(
+      start, match->collapsed_end - match->collapsed_start);
+  const gchar *context_start = start;
+  const gchar *context_end = end;
+
+  for (gint i = 0; i < SEARCH_RESULT_CONTEXT_CHARS && context_start > text &&
+                   context_start[-1] != '\n';
+       i++) {
+    context_start = g_utf8_prev_char(context_start);
+  }
+  for (gint i = 0; i < SEARCH_RESULT_CONTEXT_CHARS && *context_end &&
+                   *context_end != '\n';
+       i++) {
+    context_end = g_utf8_next_char(context_end);
+  }
+
+  append_escaped_range(markup, context_start, start, FALSE);
+  append_escaped_range(markup, start, end, TRUE);
+  append_escaped_range(markup, end, context_end, FALSE);
+}
+
+/* Rows only hold the match index; snippet markup is produced when a row is
+ * drawn, so only the visible rows of a large result set cost anything. */
+static gchar *build_search_result_markup(MarkydWindow *self, gint index) {
+  SearchMatch *match;
+  GtkTextBuffer *buffer = self->editor->buffer;
+  GtkTextIter start;
+  GtkTextIter end;
+  GtkTextIter context_start;
+  GtkTextIter context_end;
+  GString *markup;
+  gint heading;
+  gchar *text;
+  gchar *escaped;
+
+  if (!self->search_matches || index < 0 ||
+      index >= (gint)self->search_matches->len) {
+    return g_strdup("");
+  }
+  match = &g_array_index(self->search_matches, SearchMatch, index);
+  markup = g_string_new(NULL);
+
+  heading = markdown_render_index_heading_at(self->editor->render_index,
+                                             match->start_offset);
+  if (heading >= 0) {
+    ViewmdRenderHeading *h = &g_array_index(
+        self->editor->render_index->headings, ViewmdRenderHeading, heading);
+    escaped = g_markup_escape_text(h->text, -1);
+    g_string_append_printf(markup, "<span alpha=\"60%%\">%s \u203A</span> ",
+                           escaped);
+    g_free(escaped);
+  }
+
+  if (match->collapsed) {
+    append_collapsed_match_snippet(markup, match);
+    return g_string_free(markup, FALSE);
+  }
+
+  gtk_text_buffer_get_iter_at_offset(buffer, &start, match->start_offset);
+  gtk_text_buffer_get_iter_at_offset(buffer, &end, match->end_offset);
+
+  context_start = start;
+  gtk_text_iter_set_line_offset(&context_start, 0);
+  if (match->start_offset - gtk_text_iter_get_offset(&context_start) >
+      SEARCH_RESULT_CONTEXT_CHARS) {
+    gtk_text_buffer_get_iter_at_offset(
+        buffer, &context_start, match->start_offset - SEARCH_RESULT_CONTEXT_CHARS);
+  }
+  context_end = end;
+  if (!gtk_text_iter_ends_line(&context_end)) {
+    gtk_text_iter_forward_to_line_end(&context_end);
+  }
+  if (gtk_text_iter_get_offset(&context_end) - match->end_offset >
+      SEARCH_RESULT_CONTEXT_CHARS) {
+    gtk_text_buffer_get_iter_at_offset(
+        buffer, &context_end, match->end_offset + SEARCH_RESULT_CONTEXT_CHARS);
+  }
+
+  text = gtk_text_buffer_get_text(buffer, &context_start, &start, TRUE);
+  escaped = g_markup_escape_text(text, -1);
+  g_string_append(markup, escaped);
+  g_free(escaped);
+  g_free(text);
+
+  text = gtk_text_buffer_get_text(buffer, &start, &end, TRUE);
+  escaped = g_markup_escape_text(text, -1);
+  g_string_append_printf(markup, "<b>%s</b>", escaped);
+  g_free(escaped);
+  g_free(text);
+
+  text = gtk_text_buffer_get_text(buffer, &end, &context_end, TRUE);
+  escaped = g_markup_escape_text(text, -1);
+  g_string_append(markup, escaped);
+  g_free(escaped);
+  g_free(text);
+
+  return g_string_free(markup, FALSE);
+}
+
+static void search_result_cell_data(GtkTreeViewColumn *column,
+                                    GtkCellRenderer *cell, GtkTreeModel *model,
+                                    GtkTreeIter *iter, gpointer user_data) {
+  MarkydWindow *self = (MarkydWindow *)user_data;
+  gint index = -1;
+  gchar *markup;
+  (void)column;
+
+  gtk_tree_model_get(model, iter, 0, &index, -1);
+  markup = build_search_result_markup(self, index);
+  g_object_set(cell, "markup", markup, NULL);
+  g_free(markup);
+}
+
+/* Row i is match i, so this only resizes the model. */
+static void refresh_search_results_panel(MarkydWindow *self) {
+  GtkTreeView *view;
+  guint count;
+
+  if (!self || !self->results_model) {
+    return;
+  }
+
+  view = GTK_TREE_VIEW(self->results_view);
+  count = gtk_widget_get_visible(self->results_scroll) && self->search_matches
+              ? self->search_matches->len
+              : 0;
+
+  /* Detach so the view rebuilds its rows instead of expecting signals. */
+  gtk_tree_view_set_model(view, NULL);
+  markyd_row_model_set_rows(self->results_model, count);
+  gtk_tree_view_set_model(view, GTK_TREE_MODEL(self->results_model));
+}
+
+static void on_search_results_toggled(GtkToggleButton *button, gpointer user_data) {
+  MarkydWindow *self = (MarkydWindow *)user_data;
+
+  gtk_widget_set_visible(self->results_scroll,
+                         gtk_toggle_button_get_active(button));
+  refresh_search_results_panel(self);
+  if (gtk_toggle_button_get_active(button) && self->search_current_index >= 0) {
+    jump_to_search_match(self, self->search_current_index, FALSE);
+  }
+}
+
+static void on_search_result_activated(GtkTreeView *view, GtkTreePath *path,
+                                       GtkTreeViewColumn *column,
+                                       gpointer user_data) {
+  MarkydWindow *self = (MarkydWindow *)user_data;
+  gint *indices = gtk_tree_path_get_indices(path);
+  (void)view;
+  (void)column;
+
+  if (indices) {
+    jump_to_search_match(self, indices[0], TRUE);
+  }
+}
+
+static gint compare_heading_candidates(gconstpointer a, gconstpointer b) {
+  const HeadingCandidate *ca = (const HeadingCandidate *)a;
+  const HeadingCandidate *cb = (const HeadingCandidate *)b;
+
+  if (ca->score != cb->score) {
+    return cb->score - ca->score;
+  }
+  return ca->heading - cb->heading;
+}
+
+/* Headings of index in document order, descending into each folded section
+ * at its placeholder. row_of is NULL inside folds. */
+static void append_heading_rows(GArray *rows, GArray *row_of,
+                                ViewmdRenderIndex *index) {
+  guint f = 0;
+
+  for (guint h = 0; h <= index->headings->len; h++) {
+    ViewmdRenderHeading *heading =
+        h < index->headings->len
+            ? &g_array_index(index->headings, ViewmdRenderHeading, h)
+            : NULL;
+    HeadingRow row;
+
+    for (; f < index->folded_sections->len; f++) {
+      ViewmdFoldedSection *fold = g_ptr_array_index(index->folded_sections, f);
+      if (heading && fold->offset >= heading->start_offset) {
+        break;
+      }
+      append_heading_rows(rows, NULL, fold->index);
+    }
+    if (!heading) {
+      break;
+    }
+
+    row.heading = heading;
+    row.top = row_of ? (gint)h : -1;
+    if (row_of) {
+      gint at = (gint)rows->len;
+      g_array_append_val(row_of, at);
+    }
+    g_array_append_val(rows, row);
   }
-  g_list_free(wrapper_children);
+}
 
-  return found;
+/* Row pointers go stale with every render, so rebuild on each one. */
+static void rebuild_heading_rows(MarkydWindow *self) {
+  g_array_set_size(self->heading_rows, 0);
+  g_array_set_size(self->heading_row_of, 0);
+  if (self->editor && self->editor->render_index) {
+    append_heading_rows(self->heading_rows, self->heading_row_of,
+                        self->editor->render_index);
+  }
 }
 
-static void clear_table_search_highlight(MarkydWindow *self, gboolean clear_match,
-                                         gboolean clear_current) {
-  GtkTextIter iter;
-  GtkTextIter end;
+static void update_heading_palette(MarkydWindow *self) {
+  const gchar *query = gtk_entry_get_text(GTK_ENTRY(self->heading_entry));
+  gchar *folded = g_utf8_casefold(query ? query : "", -1);
+  guint64 mask = markyd_fuzzy_char_mask(folded);
+  GArray *candidates = g_array_new(FALSE, FALSE, sizeof(HeadingCandidate));
+  GtkTreeView *view = GTK_TREE_VIEW(self->heading_view);
+  GtkTreePath *path;
 
-  if (!self || !self->editor || !self->editor->buffer) {
-    return;
-  }
+  for (guint i = 0; i < self->heading_rows->len; i++) {
+    ViewmdRenderHeading *heading =
+        g_array_index(self->heading_rows, HeadingRow, i).heading;
+    HeadingCandidate candidate = {(gint)i, 0};
 
-  gtk_text_buffer_get_bounds(self->editor->buffer, &iter, &end);
-  while (!gtk_text_iter_equal(&iter, &end)) {
-    GtkTextChildAnchor *anchor = gtk_text_iter_get_child_anchor(&iter);
-    if (anchor &&
-        g_object_get_data(G_OBJECT(anchor), VIEWMD_TABLE_ANCHOR_DATA) != NULL) {
-      GtkWidget *table_widget =
-          g_object_get_data(G_OBJECT(anchor), VIEWMD_TABLE_WIDGET_DATA);
-      if (table_widget && GTK_IS_CONTAINER(table_widget)) {
-        GList *wrapper_children =
-            gtk_container_get_children(GTK_CONTAINER(table_widget));
-        for (GList *w = wrapper_children; w != NULL; w = w->next) {
-          GtkWidget *child = GTK_WIDGET(w->data);
-          if (!GTK_IS_GRID(child)) {
-            continue;
-          }
-          GList *grid_children = gtk_container_get_children(GTK_CONTAINER(child));
-          for (GList *g = grid_children; g != NULL; g = g->next) {
-            GtkWidget *cell = GTK_WIDGET(g->data);
-            if (clear_match) {
-              gtk_style_context_remove_class(gtk_widget_get_style_context(cell),
-                                             VIEWMD_TABLE_CELL_MATCH_CLASS);
-            }
-            if (clear_current) {
-              gtk_style_context_remove_class(gtk_widget_get_style_context(cell),
-                                             VIEWMD_TABLE_CELL_CURRENT_CLASS);
-            }
-          }
-          g_list_free(grid_children);
-        }
-        g_list_free(wrapper_children);
+    if (!heading->slug || (mask & ~heading->char_mask) != 0) {
+      continue;
+    }
+    if (folded[0] != '\0') {
+      candidate.score = markyd_fuzzy_score(folded, heading->folded);
+      if (candidate.score < 0) {
+        continue;
       }
     }
-    gtk_text_iter_forward_char(&iter);
+    g_array_append_val(candidates, candidate);
   }
+  if (folded[0] != '\0') {
+    g_array_sort(candidates, compare_heading_candidates);
+  }
+
+  gtk_tree_view_set_model(view, NULL);
+  gtk_list_store_clear(self->heading_store);
+  for (guint i = 0; i < MIN(candidates->len, HEADING_PALETTE_MAX_ROWS); i++) {
+    gtk_list_store_insert_with_values(
+        self->heading_store, NULL, -1, 0,
+        g_array_index(candidates, HeadingCandidate, i).heading, -1);
+  }
+  gtk_tree_view_set_model(view, GTK_TREE_MODEL(self->heading_store));
+
+  if (candidates->len > 0) {
+    path = gtk_tree_path_new_first();
+    gtk_tree_view_set_cursor(view, path, NULL, FALSE);
+    gtk_tree_path_free(path);
+  }
+
+  g_array_free(candidates, TRUE);
+  g_free(folded);
 }
 
-static gboolean resolve_table_match_location(MarkydWindow *self, gint start_offset,
-                                             gint end_offset,
-                                             GtkTextChildAnchor **out_anchor,
-                                             gint *out_row, gint *out_col) {
-  GtkTextIter iter;
-  GtkTextIter end;
+static void heading_row_cell_data(GtkTreeViewColumn *column,
+                                  GtkCellRenderer *cell, GtkTreeModel *model,
+                                  GtkTreeIter *iter, gpointer user_data) {
+  MarkydWindow *self = (MarkydWindow *)user_data;
+  ViewmdRenderHeading *heading;
+  gint row = -1;
+  gchar *indent;
+  gchar *escaped;
+  gchar *markup;
+  (void)column;
+
+  gtk_tree_model_get(model, iter, 0, &row, -1);
+  if (row < 0 || row >= (gint)self->heading_rows->len) {
+    g_object_set(cell, "markup", "", NULL);
+    return;
+  }
 
-  if (out_anchor) {
-    *out_anchor = NULL;
+  heading = g_array_index(self->heading_rows, HeadingRow, row).heading;
+  indent = g_strnfill((gsize)MAX(heading->level - 1, 0) * 2, ' ');
+  escaped = g_markup_escape_text(heading->text, -1);
+  markup = g_strdup_printf("%s%s", indent, escaped);
+  g_object_set(cell, "markup", markup, NULL);
+  g_free(markup);
+  g_free(escaped);
+  g_free(indent);
+}
+
+static void jump_to_heading_palette_row(MarkydWindow *self, GtkTreePath *path) {
+  GtkTreeModel *model = GTK_TREE_MODEL(self->heading_store);
+  GtkTreeIter iter;
+  gint row = -1;
+
+  if (!path || !gtk_tree_model_get_iter(model, &iter, path)) {
+    return;
   }
-  if (out_row) {
-    *out_row = -1;
+  gtk_tree_model_get(model, &iter, 0, &row, -1);
+  if (row < 0 || row >= (gint)self->heading_rows->len) {
+    return;
   }
-  if (out_col) {
-    *out_col = -1;
+
+  gtk_popover_popdown(GTK_POPOVER(self->heading_popover));
+  /* Unfolds the enclosing sections when the heading is folded away. */
+  markyd_editor_scroll_to_anchor(
+      self->editor,
+      g_array_index(self->heading_rows, HeadingRow, row).heading->slug);
+  markyd_editor_focus(self->editor);
+}
+
+static void on_heading_entry_changed(GtkEditable *editable, gpointer user_data) {
+  MarkydWindow *self = (MarkydWindow *)user_data;
+  (void)editable;
+  update_heading_palette(self);
+}
+
+static void on_heading_entry_activate(GtkEntry *entry, gpointer user_data) {
+  MarkydWindow *self = (MarkydWindow *)user_data;
+  GtkTreePath *path = NULL;
+  (void)entry;
+
+  gtk_tree_view_get_cursor(GTK_TREE_VIEW(self->heading_view), &path, NULL);
+  jump_to_heading_palette_row(self, path);
+  if (path) {
+    gtk_tree_path_free(path);
   }
+}
+
+static gboolean on_heading_entry_key_press(GtkWidget *widget, GdkEventKey *event,
+                                           gpointer user_data) {
+  MarkydWindow *self = (MarkydWindow *)user_data;
+  GtkTreeView *view = GTK_TREE_VIEW(self->heading_view);
+  GtkTreePath *path = NULL;
+  gint rows;
+  gint row = 0;
+  (void)widget;
 
-  if (!self || !self->editor || !self->editor->buffer ||
-      end_offset <= start_offset) {
+  if (event->keyval != GDK_KEY_Down && event->keyval != GDK_KEY_Up) {
     return FALSE;
   }
 
-  gtk_text_buffer_get_bounds(self->editor->buffer, &iter, &end);
-  while (!gtk_text_iter_equal(&iter, &end)) {
-    GtkTextChildAnchor *anchor = gtk_text_iter_get_child_anchor(&iter);
-    if (anchor) {
-      ViewmdTableSearchIndex *index = g_object_get_data(
-          G_OBJECT(anchor), VIEWMD_TABLE_SEARCH_INDEX_DATA);
-      if (index && start_offset < index->end_offset &&
-          end_offset > index->start_offset) {
-        if (out_anchor) {
-          *out_anchor = anchor;
-        }
-
-        if (index->cells) {
-          ViewmdTableSearchCellRange *overlap_cell = NULL;
-          for (guint i = 0; i < index->cells->len; i++) {
-            ViewmdTableSearchCellRange *cell =
-                &g_array_index(index->cells, ViewmdTableSearchCellRange, i);
-            if (start_offset >= cell->start_offset && start_offset < cell->end_offset) {
-              if (out_row) {
-                *out_row = cell->row;
-              }
-              if (out_col) {
-                *out_col = cell->col;
-              }
-              return TRUE;
-            }
-            if (start_offset < cell->end_offset && end_offset > cell->start_offset) {
-              overlap_cell = cell;
-            }
-          }
-          if (overlap_cell) {
-            if (out_row) {
-              *out_row = overlap_cell->row;
-            }
-            if (out_col) {
-              *out_col = overlap_cell->col;
-            }
-            return TRUE;
-          }
-        }
+  rows = gtk_tree_model_iter_n_children(GTK_TREE_MODEL(self->heading_store), NULL);
+  if (rows == 0) {
+    return TRUE;
+  }
 
-        return TRUE;
-      }
-    }
-    gtk_text_iter_forward_char(&iter);
+  gtk_tree_view_get_cursor(view, &path, NULL);
+  if (path) {
+    gint *indices = gtk_tree_path_get_indices(path);
+    row = indices ? indices[0] : 0;
+    gtk_tree_path_free(path);
+    row += (event->keyval == GDK_KEY_Down) ? 1 : -1;
   }
+  row = CLAMP(row, 0, rows - 1);
 
-  return FALSE;
+  path = gtk_tree_path_new_from_indices(row, -1);
+  gtk_tree_view_set_cursor(view, path, NULL, FALSE);
+  gtk_tree_view_scroll_to_cell(view, path, NULL, FALSE, 0.0, 0.0);
+  gtk_tree_path_free(path);
+  return TRUE;
 }
 
-static void apply_table_search_match_highlight(MarkydWindow *self) {
-  if (!self || !self->search_matches) {
+static void on_heading_row_activated(GtkTreeView *view, GtkTreePath *path,
+                                     GtkTreeViewColumn *column,
+                                     gpointer user_data) {
+  MarkydWindow *self = (MarkydWindow *)user_data;
+  (void)view;
+  (void)column;
+  jump_to_heading_palette_row(self, path);
+}
+
+static GtkWidget *create_heading_palette(MarkydWindow *self) {
+  GtkWidget *popover;
+  GtkWidget *box;
+  GtkWidget *scroll;
+  GtkTreeViewColumn *column;
+  GtkCellRenderer *renderer;
+
+  popover = gtk_popover_new(self->lbl_title);
+  gtk_popover_set_position(GTK_POPOVER(popover), GTK_POS_BOTTOM);
+
+  box = gtk_box_new(GTK_ORIENTATION_VERTICAL, 6);
+  gtk_container_set_border_width(GTK_CONTAINER(box), 6);
+  gtk_container_add(GTK_CONTAINER(popover), box);
+
+  self->heading_entry = gtk_search_entry_new();
+  gtk_entry_set_placeholder_text(GTK_ENTRY(self->heading_entry), "Go to heading");
+  g_signal_connect(self->heading_entry, "changed",
+                   G_CALLBACK(on_heading_entry_changed), self);
+  g_signal_connect(self->heading_entry, "activate",
+                   G_CALLBACK(on_heading_entry_activate), self);
+  g_signal_connect(self->heading_entry, "key-press-event",
+                   G_CALLBACK(on_heading_entry_key_press), self);
+  gtk_box_pack_start(GTK_BOX(box), self->heading_entry, FALSE, FALSE, 0);
+
+  self->heading_store = gtk_list_store_new(1, G_TYPE_INT);
+  self->heading_view =
+      gtk_tree_view_new_with_model(GTK_TREE_MODEL(self->heading_store));
+  gtk_tree_view_set_headers_visible(GTK_TREE_VIEW(self->heading_view), FALSE);
+  gtk_tree_view_set_activate_on_single_click(GTK_TREE_VIEW(self->heading_view),
+                                             TRUE);
+  renderer = gtk_cell_renderer_text_new();
+  g_object_set(renderer, "ellipsize", PANGO_ELLIPSIZE_END, NULL);
+  column = gtk_tree_view_column_new();
+  gtk_tree_view_column_set_sizing(column, GTK_TREE_VIEW_COLUMN_FIXED);
+  gtk_tree_view_column_pack_start(column, renderer, TRUE);
+  gtk_tree_view_column_set_cell_data_func(column, renderer,
+                                          heading_row_cell_data, self, NULL);
+  gtk_tree_view_append_column(GTK_TREE_VIEW(self->heading_view), column);
+  gtk_tree_view_set_fixed_height_mode(GTK_TREE_VIEW(self->heading_view), TRUE);
+  g_signal_connect(self->heading_view, "row-activated",
+                   G_CALLBACK(on_heading_row_activated), self);
+
+  scroll = gtk_scrolled_window_new(NULL, NULL);
+  gtk_scrolled_window_set_policy(GTK_SCROLLED_WINDOW(scroll), GTK_POLICY_NEVER,
+                                 GTK_POLICY_AUTOMATIC);
+  gtk_widget_set_size_request(scroll, 420, 360);
+  gtk_container_add(GTK_CONTAINER(scroll), self->heading_view);
+  gtk_box_pack_start(GTK_BOX(box), scroll, TRUE, TRUE, 0);
+
+  gtk_widget_show_all(box);
+  return popover;
+}
+
+static void show_heading_palette(MarkydWindow *self) {
+  if (!self || !self->editor) {
     return;
   }
 
-  clear_table_search_highlight(self, TRUE, FALSE);
+  if (!self->heading_popover) {
+    self->heading_popover = create_heading_palette(self);
+  }
 
-  for (guint i = 0; i < self->search_matches->len; i++) {
-    SearchMatch *match = &g_array_index(self->search_matches, SearchMatch, i);
-    GtkWidget *table_widget;
-    GtkWidget *cell;
+  if (gtk_entry_get_text_length(GTK_ENTRY(self->heading_entry)) > 0) {
+    gtk_entry_set_text(GTK_ENTRY(self->heading_entry), "");
+  } else {
+    update_heading_palette(self);
+  }
+  gtk_popover_popup(GTK_POPOVER(self->heading_popover));
+  gtk_widget_grab_focus(self->heading_entry);
+}
 
-    if (!match->table_anchor || match->table_row < 0 || match->table_col < 0) {
-      continue;
-    }
+static gboolean outline_visible(MarkydWindow *self) {
+  return self && self->outline_scroll &&
+         gtk_widget_get_visible(self->outline_scroll);
+}
 
-    table_widget =
-        g_object_get_data(G_OBJECT(match->table_anchor), VIEWMD_TABLE_WIDGET_DATA);
-    cell = lookup_table_cell_widget(table_widget, match->table_row, match->table_col);
-    if (cell) {
-      set_table_cell_highlight(cell, TRUE, FALSE);
-    }
+/* Rows map one-to-one onto heading_rows. */
+static void refresh_outline(MarkydWindow *self) {
+  GtkTreeView *view = GTK_TREE_VIEW(self->outline_view);
+  guint count = self->heading_rows->len;
+
+  g_object_ref(self->outline_store);
+  gtk_tree_view_set_model(view, NULL);
+  gtk_list_store_clear(self->outline_store);
+  for (guint i = 0; i < count; i++) {
+    gtk_list_store_insert_with_values(self->outline_store, NULL, -1, 0, (gint)i,
+                                      -1);
   }
+  gtk_tree_view_set_model(view, GTK_TREE_MODEL(self->outline_store));
+  g_object_unref(self->outline_store);
+
+  self->outline_current = -1;
+  sync_outline_current(self);
 }
 
-static void jump_to_search_match(MarkydWindow *self, gint index,
-                                 gboolean scroll_to_match) {
-  GtkTextIter start;
-  GtkTextIter end;
-  SearchMatch *match;
-  gchar *status;
+/* Highlight the section containing the top of the viewport. The heading
+ * offsets are sorted, so this is a binary search per scroll step. */
+static void sync_outline_current(MarkydWindow *self) {
+  GtkTextView *text_view;
+  GtkTreeSelection *selection;
+  GdkRectangle visible;
+  GtkTextIter iter;
+  gint current;
 
-  if (!self || !self->editor || !self->editor->buffer || !self->search_matches ||
-      self->search_matches->len == 0) {
+  if (!outline_visible(self) || !self->editor || !self->editor->render_index) {
     return;
   }
 
-  if (index < 0 || index >= (gint)self->search_matches->len) {
+  text_view = GTK_TEXT_VIEW(self->editor->text_view);
+  gtk_text_view_get_visible_rect(text_view, &visible);
+  gtk_text_view_get_iter_at_location(text_view, &iter, visible.x, visible.y);
+  current = markdown_render_index_heading_at(self->editor->render_index,
+                                             gtk_text_iter_get_offset(&iter));
+  if (current >= 0 && current < (gint)self->heading_row_of->len) {
+    current = g_array_index(self->heading_row_of, gint, current);
+  } else {
+    current = -1;
+  }
+  if (current == self->outline_current) {
     return;
   }
+  self->outline_current = current;
 
-  gtk_text_buffer_get_bounds(self->editor->buffer, &start, &end);
-  gtk_text_buffer_remove_tag_by_name(self->editor->buffer, TAG_SEARCH_CURRENT,
-                                     &start, &end);
-  clear_table_search_highlight(self, FALSE, TRUE);
-
-  match = &g_array_index(self->search_matches, SearchMatch, index);
-  if (match->table_anchor && match->table_row >= 0 && match->table_col >= 0) {
-    GtkWidget *table_widget =
-        g_object_get_data(G_OBJECT(match->table_anchor), VIEWMD_TABLE_WIDGET_DATA);
-    GtkWidget *cell =
-        lookup_table_cell_widget(table_widget, match->table_row, match->table_col);
-    if (cell) {
-      set_table_cell_highlight(cell, TRUE, TRUE);
-    }
-  } else {
-    gtk_text_buffer_get_iter_at_offset(self->editor->buffer, &start,
-                                       match->start_offset);
-    gtk_text_buffer_get_iter_at_offset(self->editor->buffer, &end,
-                                       match->end_offset);
-    gtk_text_buffer_apply_tag_by_name(self->editor->buffer, TAG_SEARCH_CURRENT,
-                                      &start, &end);
-    gtk_text_buffer_place_cursor(self->editor->buffer, &start);
+  selection = gtk_tree_view_get_selection(GTK_TREE_VIEW(self->outline_view));
+  if (current < 0) {
+    gtk_tree_selection_unselect_all(selection);
+    return;
   }
 
-  if (scroll_to_match && self->editor->text_view) {
-    if (match->table_anchor) {
-      gboolean scrolled_to_cell = FALSE;
-      if (match->table_row >= 0 && match->table_col >= 0) {
-        GtkWidget *table_widget = g_object_get_data(G_OBJECT(match->table_anchor),
-                                                    VIEWMD_TABLE_WIDGET_DATA);
-        GtkWidget *cell = lookup_table_cell_widget(table_widget, match->table_row,
-                                                   match->table_col);
-        if (cell) {
-          scrolled_to_cell = scroll_to_table_cell(self, cell);
-        }
-      }
-      if (!scrolled_to_cell) {
-        GtkTextIter anchor_iter;
-        gtk_text_buffer_get_iter_at_child_anchor(self->editor->buffer, &anchor_iter,
-                                                 match->table_anchor);
-        gtk_text_view_scroll_to_iter(GTK_TEXT_VIEW(self->editor->text_view),
-                                     &anchor_iter, 0.2, FALSE, 0.0, 0.0);
-      }
-    } else {
-      gtk_text_view_scroll_to_iter(GTK_TEXT_VIEW(self->editor->text_view), &start,
-                                   0.2, FALSE, 0.0, 0.0);
-    }
+  {
+    GtkTreePath *path = gtk_tree_path_new_from_indices(current, -1);
+    gtk_tree_selection_select_path(selection, path);
+    gtk_tree_view_scroll_to_cell(GTK_TREE_VIEW(self->outline_view), path, NULL,
+                                 FALSE, 0.0, 0.0);
+    gtk_tree_path_free(path);
   }
-
-  self->search_current_index = index;
-  status = g_strdup_printf("%d/%u", index + 1, self->search_matches->len);
-  gtk_label_set_text(GTK_LABEL(self->lbl_search_status), status);
-  g_free(status);
 }
 
-static void update_search_matches(MarkydWindow *self) {
-  const gchar *query;
+static void on_outline_row_activated(GtkTreeView *view, GtkTreePath *path,
+                                     GtkTreeViewColumn *column,
+                                     gpointer user_data) {
+  MarkydWindow *self = (MarkydWindow *)user_data;
+  gint *indices = gtk_tree_path_get_indices(path);
+  gint row = indices ? indices[0] : -1;
+  HeadingRow *heading_row;
   GtkTextIter iter;
-  GtkTextIter match_start;
-  GtkTextIter match_end;
-  GtkTextIter end;
+  (void)view;
+  (void)column;
 
-  if (!self || !self->editor || !self->editor->buffer || !self->search_entry) {
+  if (row < 0 || row >= (gint)self->heading_rows->len) {
     return;
   }
 
-  query = gtk_entry_get_text(GTK_ENTRY(self->search_entry));
-  clear_search_matches(self);
+  heading_row = &g_array_index(self->heading_rows, HeadingRow, row);
+  if (heading_row->top < 0) {
+    markyd_editor_scroll_to_anchor(self->editor, heading_row->heading->slug);
+    return;
+  }
+  gtk_text_buffer_get_iter_at_offset(self->editor->buffer, &iter,
+                                     heading_row->heading->start_offset);
+  gtk_text_view_scroll_to_iter(GTK_TEXT_VIEW(self->editor->text_view), &iter,
+                               0.0, TRUE, 0.0, 0.0);
+}
 
-  if (!query || query[0] == '\0') {
+static void create_outline(MarkydWindow *self) {
+  GtkTreeViewColumn *column;
+  GtkCellRenderer *renderer;
+
+  self->outline_current = -1;
+  self->outline_store = gtk_list_store_new(1, G_TYPE_INT);
+  self->outline_view =
+      gtk_tree_view_new_with_model(GTK_TREE_MODEL(self->outline_store));
+  gtk_tree_view_set_headers_visible(GTK_TREE_VIEW(self->outline_view), FALSE);
+  gtk_tree_view_set_activate_on_single_click(GTK_TREE_VIEW(self->outline_view),
+                                             TRUE);
+  renderer = gtk_cell_renderer_text_new();
+  g_object_set(renderer, "ellipsize", PANGO_ELLIPSIZE_END, NULL);
+  column = gtk_tree_view_column_new();
+  gtk_tree_view_column_set_sizing(column, GTK_TREE_VIEW_COLUMN_FIXED);
+  gtk_tree_view_column_pack_start(column, renderer, TRUE);
+  gtk_tree_view_column_set_cell_data_func(column, renderer,
+                                          heading_row_cell_data, self, NULL);
+  gtk_tree_view_append_column(GTK_TREE_VIEW(self->outline_view), column);
+  gtk_tree_view_set_fixed_height_mode(GTK_TREE_VIEW(self->outline_view), TRUE);
+  g_signal_connect(self->outline_view, "row-activated",
+                   G_CALLBACK(on_outline_row_activated), self);
+
+  self->outline_scroll = gtk_scrolled_window_new(NULL, NULL);
+  gtk_scrolled_window_set_policy(GTK_SCROLLED_WINDOW(self->outline_scroll),
+                                 GTK_POLICY_NEVER, GTK_POLICY_AUTOMATIC);
+  gtk_widget_set_size_request(self->outline_scroll, 220, -1);
+  gtk_container_add(GTK_CONTAINER(self->outline_scroll), self->outline_view);
+  gtk_widget_show_all(self->outline_scroll);
+  gtk_widget_hide(self->outline_scroll);
+  gtk_widget_set_no_show_all(self->outline_scroll, TRUE);
+  gtk_paned_pack1(GTK_PANED(self->outline_paned), self->outline_scroll, FALSE,
+                  FALSE);
+}
+
+static void on_editor_degraded(MarkydEditor *editor, guint reasons,
+                               gpointer user_data) {
+  MarkydWindow *self = (MarkydWindow *)user_data;
+  GString *tooltip;
+  (void)editor;
+
+  if (!self->btn_render_fully) {
+    return;
+  }
+  if (reasons == 0) {
+    gtk_widget_hide(self->btn_render_fully);
     return;
   }
 
-  ensure_search_tags(self);
-  gtk_text_buffer_get_start_iter(self->editor->buffer, &iter);
-  gtk_text_buffer_get_end_iter(self->editor->buffer, &end);
-
-  while (gtk_text_iter_forward_search(&iter, query,
-                                      GTK_TEXT_SEARCH_CASE_INSENSITIVE |
-                                          GTK_TEXT_SEARCH_TEXT_ONLY,
-                                      &match_start, &match_end, &end)) {
-    SearchMatch match = {gtk_text_iter_get_offset(&match_start),
-                         gtk_text_iter_get_offset(&match_end), NULL, -1, -1};
-    gtk_text_buffer_apply_tag_by_name(self->editor->buffer, TAG_SEARCH_MATCH,
-                                      &match_start, &match_end);
-    resolve_table_match_location(self, match.start_offset, match.end_offset,
-                                 &match.table_anchor, &match.table_row,
-                                 &match.table_col);
-    g_array_append_val(self->search_matches, match);
-    iter = match_end;
+  tooltip = g_string_new("Part of this document is shown simplified: code "
+                         "without highlighting, tables as text, images as "
+                         "links.");
+  if (reasons & VIEWMD_DEGRADED_SIZE) {
+    g_string_append(tooltip, "\nThe document is larger than the size limit.");
   }
+  if (reasons & VIEWMD_DEGRADED_RENDER) {
+    g_string_append(tooltip, "\nRendering took longer than its budget.");
+  }
+  if (reasons & VIEWMD_DEGRADED_HIGHLIGHT) {
+    g_string_append(tooltip, "\nCode highlighting took longer than its budget.");
+  }
+  if (reasons & VIEWMD_DEGRADED_WIDGETS) {
+    g_string_append(tooltip, "\nTables and images took longer than their budget.");
+  }
+  gtk_widget_set_tooltip_text(self->btn_render_fully, tooltip->str);
+  g_string_free(tooltip, TRUE);
+  gtk_widget_show(self->btn_render_fully);
+}
 
-  if (self->search_matches->len == 0) {
-    gtk_label_set_text(GTK_LABEL(self->lbl_search_status), "0 matches");
+static void on_render_fully_clicked(GtkButton *button, gpointer user_data) {
+  MarkydWindow *self = (MarkydWindow *)user_data;
+
+  gtk_widget_hide(GTK_WIDGET(button));
+  markyd_editor_render_fully(self->editor);
+}
+
+static void on_outline_toggled(GtkToggleButton *button, gpointer user_data) {
+  MarkydWindow *self = (MarkydWindow *)user_data;
+
+  if (!gtk_toggle_button_get_active(button)) {
+    if (self->outline_scroll) {
+      gtk_widget_hide(self->outline_scroll);
+    }
     return;
   }
 
-  gtk_widget_set_sensitive(self->btn_search_prev, TRUE);
-  gtk_widget_set_sensitive(self->btn_search_next, TRUE);
-  apply_table_search_match_highlight(self);
-  jump_to_search_match(self, 0, TRUE);
+  if (!self->outline_scroll) {
+    create_outline(self);
+  }
+  gtk_widget_show(self->outline_scroll);
+  refresh_outline(self);
 }
 
 static void show_search_ui(MarkydWindow *self) {
@@ -531,7 +2034,9 @@ static void hide_search_ui(MarkydWindow *self) {
 
   gtk_revealer_set_reveal_child(GTK_REVEALER(self->search_revealer), FALSE);
   gtk_entry_set_text(GTK_ENTRY(self->search_entry), "");
+  gtk_toggle_button_set_active(GTK_TOGGLE_BUTTON(self->btn_search_results), FALSE);
   clear_search_matches(self);
+  invalidate_search_refinement(self);
   markyd_editor_focus(self->editor);
 }
 
@@ -541,6 +2046,16 @@ static void on_search_changed(GtkEditable *editable, gpointer user_data) {
   update_search_matches(self);
 }
 
+static void on_search_option_toggled(GtkToggleButton *button, gpointer user_data) {
+  MarkydWindow *self = (MarkydWindow *)user_data;
+  (void)button;
+
+  invalidate_search_refinement(self);
+  if (gtk_entry_get_text_length(GTK_ENTRY(self->search_entry)) > 0) {
+    update_search_matches(self);
+  }
+}
+
 static void on_search_prev_clicked(GtkButton *button, gpointer user_data) {
   MarkydWindow *self = (MarkydWindow *)user_data;
   gint index;
@@ -604,14 +2119,35 @@ static gboolean on_search_entry_key_press(GtkWidget *widget, GdkEventKey *event,
   return FALSE;
 }
 
-static void on_editor_buffer_changed(GtkTextBuffer *buffer, gpointer user_data) {
+static void on_editor_rendered(MarkydEditor *editor, guint generation,
+                               gpointer user_data) {
   MarkydWindow *self = (MarkydWindow *)user_data;
-  (void)buffer;
+  gint anchor_offset = -1;
+  (void)editor;
+  (void)generation;
+
+  rebuild_heading_rows(self);
+  if (outline_visible(self)) {
+    refresh_outline(self);
+  }
 
   if (!self || !self->search_revealer || !self->search_entry) {
     return;
   }
 
+  if (self->search_matches && self->search_current_index >= 0 &&
+      self->search_current_index < (gint)self->search_matches->len) {
+    anchor_offset = g_array_index(self->search_matches, SearchMatch,
+                                  self->search_current_index)
+                        .start_offset;
+  }
+
+  /* Stored match offsets no longer describe the buffer contents, and the
+   * collapsed tails and table anchors the matches point into may be gone. */
+  clear_search_matches(self);
+  invalidate_search_refinement(self);
+  reset_search_tags(self);
+
   if (!gtk_revealer_get_reveal_child(GTK_REVEALER(self->search_revealer))) {
     return;
   }
@@ -621,7 +2157,7 @@ static void on_editor_buffer_changed(GtkTextBuffer *buffer, gpointer user_data)
     return;
   }
 
-  update_search_matches(self);
+  update_search_matches_near(self, anchor_offset);
 }
 
 MarkydWindow *markyd_window_new(MarkydApp *app) {
@@ -686,12 +2222,32 @@ MarkydWindow *markyd_window_new(MarkydApp *app) {
   g_signal_connect(self->btn_settings, "clicked", G_CALLBACK(on_settings_clicked),
                    self);
 
+  self->btn_outline = gtk_toggle_button_new();
+  gtk_button_set_image(GTK_BUTTON(self->btn_outline),
+                       gtk_image_new_from_icon_name("view-list-bullet-symbolic",
+                                                    GTK_ICON_SIZE_BUTTON));
+  gtk_widget_set_tooltip_text(self->btn_outline, "Show Outline");
+  g_signal_connect(self->btn_outline, "toggled", G_CALLBACK(on_outline_toggled),
+                   self);
+
   left_buttons = gtk_box_new(GTK_ORIENTATION_HORIZONTAL, 0);
   gtk_box_pack_start(GTK_BOX(left_buttons), self->btn_open, FALSE, FALSE, 0);
   gtk_box_pack_start(GTK_BOX(left_buttons), self->btn_refresh, FALSE, FALSE, 0);
   gtk_box_pack_start(GTK_BOX(left_buttons), self->btn_settings, FALSE, FALSE, 0);
+  gtk_box_pack_start(GTK_BOX(left_buttons), self->btn_outline, FALSE, FALSE, 0);
   gtk_header_bar_pack_start(GTK_HEADER_BAR(self->header_bar), left_buttons);
 
+  self->btn_render_fully = gtk_button_new_with_label("Render Fully");
+  gtk_button_set_image(GTK_BUTTON(self->btn_render_fully),
+                       gtk_image_new_from_icon_name("dialog-warning-symbolic",
+                                                    GTK_ICON_SIZE_BUTTON));
+  gtk_button_set_always_show_image(GTK_BUTTON(self->btn_render_fully), TRUE);
+  gtk_widget_set_no_show_all(self->btn_render_fully, TRUE);
+  g_signal_connect(self->btn_render_fully, "clicked",
+                   G_CALLBACK(on_render_fully_clicked), self);
+  gtk_header_bar_pack_end(GTK_HEADER_BAR(self->header_bar),
+                          self->btn_render_fully);
+
   main_box = gtk_box_new(GTK_ORIENTATION_VERTICAL, 0);
   gtk_container_add(GTK_CONTAINER(self->window), main_box);
 
@@ -717,6 +2273,24 @@ MarkydWindow *markyd_window_new(MarkydApp *app) {
                    G_CALLBACK(on_search_entry_key_press), self);
   gtk_box_pack_start(GTK_BOX(search_box), self->search_entry, TRUE, TRUE, 0);
 
+  self->btn_search_regex = gtk_toggle_button_new_with_label(".*");
+  gtk_widget_set_tooltip_text(self->btn_search_regex, "Regular Expression");
+  g_signal_connect(self->btn_search_regex, "toggled",
+                   G_CALLBACK(on_search_option_toggled), self);
+  gtk_box_pack_start(GTK_BOX(search_box), self->btn_search_regex, FALSE, FALSE, 0);
+
+  self->btn_search_case = gtk_toggle_button_new_with_label("Aa");
+  gtk_widget_set_tooltip_text(self->btn_search_case, "Match Case");
+  g_signal_connect(self->btn_search_case, "toggled",
+                   G_CALLBACK(on_search_option_toggled), self);
+  gtk_box_pack_start(GTK_BOX(search_box), self->btn_search_case, FALSE, FALSE, 0);
+
+  self->btn_search_word = gtk_toggle_button_new_with_label("W");
+  gtk_widget_set_tooltip_text(self->btn_search_word, "Whole Word");
+  g_signal_connect(self->btn_search_word, "toggled",
+                   G_CALLBACK(on_search_option_toggled), self);
+  gtk_box_pack_start(GTK_BOX(search_box), self->btn_search_word, FALSE, FALSE, 0);
+
   self->btn_search_prev =
       gtk_button_new_from_icon_name("go-up-symbolic", GTK_ICON_SIZE_BUTTON);
   gtk_widget_set_tooltip_text(self->btn_search_prev, "Previous Match");
@@ -737,18 +2311,97 @@ MarkydWindow *markyd_window_new(MarkydApp *app) {
   gtk_widget_set_halign(self->lbl_search_status, GTK_ALIGN_END);
   gtk_box_pack_start(GTK_BOX(search_box), self->lbl_search_status, FALSE, FALSE, 0);
 
+  self->btn_search_results = gtk_toggle_button_new();
+  gtk_button_set_image(GTK_BUTTON(self->btn_search_results),
+                       gtk_image_new_from_icon_name("view-list-symbolic",
+                                                    GTK_ICON_SIZE_BUTTON));
+  gtk_widget_set_tooltip_text(self->btn_search_results, "Show All Matches");
+  g_signal_connect(self->btn_search_results, "toggled",
+                   G_CALLBACK(on_search_results_toggled), self);
+  gtk_box_pack_start(GTK_BOX(search_box), self->btn_search_results, FALSE, FALSE,
+                     0);
+
+  self->outline_paned = gtk_paned_new(GTK_ORIENTATION_HORIZONTAL);
+  gtk_box_pack_start(GTK_BOX(main_box), self->outline_paned, TRUE, TRUE, 0);
+
+  self->paned = gtk_paned_new(GTK_ORIENTATION_HORIZONTAL);
+  gtk_paned_pack2(GTK_PANED(self->outline_paned), self->paned, TRUE, FALSE);
+
   self->scroll = gtk_scrolled_window_new(NULL, NULL);
   gtk_scrolled_window_set_policy(GTK_SCROLLED_WINDOW(self->scroll),
                                  GTK_POLICY_AUTOMATIC, GTK_POLICY_AUTOMATIC);
-  gtk_box_pack_start(GTK_BOX(main_box), self->scroll, TRUE, TRUE, 0);
+  {
+    /* The strip sits beside the scrolled window rather than over it, so the
+     * vertical scrollbar stays visible and clickable. */
+    GtkWidget *editor_box = gtk_box_new(GTK_ORIENTATION_HORIZONTAL, 0);
+
+    gtk_box_pack_start(GTK_BOX(editor_box), self->scroll, TRUE, TRUE, 0);
+    self->match_markers = gtk_drawing_area_new();
+    self->marker_bins = g_byte_array_new();
+    gtk_widget_set_size_request(self->match_markers, MATCH_MARKER_WIDTH, -1);
+    gtk_style_context_add_class(gtk_widget_get_style_context(self->match_markers),
+                                "viewmd-match-markers");
+    g_signal_connect(self->match_markers, "draw",
+                     G_CALLBACK(on_match_markers_draw), self);
+    gtk_box_pack_end(GTK_BOX(editor_box), self->match_markers, FALSE, FALSE, 0);
+    gtk_paned_pack1(GTK_PANED(self->paned), editor_box, TRUE, FALSE);
+  }
+
+  {
+    GtkTreeViewColumn *column;
+    GtkCellRenderer *renderer;
+
+    self->results_model = markyd_row_model_new();
+    self->results_view =
+        gtk_tree_view_new_with_model(GTK_TREE_MODEL(self->results_model));
+    gtk_tree_view_set_headers_visible(GTK_TREE_VIEW(self->results_view), FALSE);
+    gtk_tree_view_set_activate_on_single_click(GTK_TREE_VIEW(self->results_view),
+                                               TRUE);
+    renderer = gtk_cell_renderer_text_new();
+    g_object_set(renderer, "ellipsize", PANGO_ELLIPSIZE_END, NULL);
+    column = gtk_tree_view_column_new();
+    gtk_tree_view_column_set_sizing(column, GTK_TREE_VIEW_COLUMN_FIXED);
+    gtk_tree_view_column_pack_start(column, renderer, TRUE);
+    gtk_tree_view_column_set_cell_data_func(column, renderer,
+                                            search_result_cell_data, self, NULL);
+    gtk_tree_view_append_column(GTK_TREE_VIEW(self->results_view), column);
+    /* Uniform rows let the view skip measuring off-screen rows. */
+    gtk_tree_view_set_fixed_height_mode(GTK_TREE_VIEW(self->results_view), TRUE);
+    g_signal_connect(self->results_view, "row-activated",
+                     G_CALLBACK(on_search_result_activated), self);
+
+    self->results_scroll = gtk_scrolled_window_new(NULL, NULL);
+    gtk_scrolled_window_set_policy(GTK_SCROLLED_WINDOW(self->results_scroll),
+                                   GTK_POLICY_NEVER, GTK_POLICY_AUTOMATIC);
+    gtk_widget_set_size_request(self->results_scroll, 280, -1);
+    gtk_container_add(GTK_CONTAINER(self->results_scroll), self->results_view);
+    gtk_widget_show_all(self->results_scroll);
+    gtk_widget_hide(self->results_scroll);
+    gtk_widget_set_no_show_all(self->results_scroll, TRUE);
+    gtk_paned_pack2(GTK_PANED(self->paned), self->results_scroll, FALSE, FALSE);
+  }
 
   self->editor = markyd_editor_new(app);
   gtk_container_add(GTK_CONTAINER(self->scroll),
                     markyd_editor_get_widget(self->editor));
   self->search_matches = g_array_new(FALSE, FALSE, sizeof(SearchMatch));
   self->search_current_index = -1;
-  g_signal_connect(self->editor->buffer, "changed",
-                   G_CALLBACK(on_editor_buffer_changed), self);
+  self->search_tagged = g_array_new(FALSE, FALSE, sizeof(SearchTagSpan));
+  self->search_current_tag_start = -1;
+  self->search_current_tag_end = -1;
+  self->heading_rows = g_array_new(FALSE, FALSE, sizeof(HeadingRow));
+  self->heading_row_of = g_array_new(FALSE, FALSE, sizeof(gint));
+  rebuild_heading_rows(self);
+  markyd_editor_set_render_callback(self->editor, on_editor_rendered, self);
+  markyd_editor_set_degraded_callback(self->editor, on_editor_degraded, self);
+  {
+    GtkAdjustment *vadj =
+        gtk_scrolled_window_get_vadjustment(GTK_SCROLLED_WINDOW(self->scroll));
+    g_signal_connect(vadj, "value-changed",
+                     G_CALLBACK(on_scroll_adjustment_changed), self);
+    g_signal_connect(vadj, "changed", G_CALLBACK(on_scroll_adjustment_changed),
+                     self);
+  }
   ensure_search_tags(self);
 
   markyd_window_apply_css(self);
@@ -859,10 +2512,13 @@ void markyd_window_apply_css(MarkydWindow *self) {
       "}"
       ".viewmd-table-cell." VIEWMD_TABLE_CELL_CURRENT_CLASS " label {"
       "  color: %s;"
+      "}"
+      ".viewmd-match-markers {"
+      "  color: %s;"
       "}",
       config->font_family, config->font_size, bg, fg, fg, bg, fg, fg, sel_bg, bg,
       bg, table_bg, table_border, table_header_bg, table_fg, search_match_bg,
-      search_match_fg, search_current_bg, search_current_fg);
+      search_match_fg, search_current_bg, search_current_fg, search_match_bg);
 
   gtk_css_provider_load_from_data(css, css_str, -1, NULL);
   g_free(css_str);
@@ -884,6 +2540,36 @@ void markyd_window_free(MarkydWindow *self) {
     g_array_free(self->search_matches, TRUE);
     self->search_matches = NULL;
   }
+  g_free(self->search_last_query);
+  cancel_regex_search(self);
+  if (self->marker_bins) {
+    g_byte_array_free(self->marker_bins, TRUE);
+    self->marker_bins = NULL;
+  }
+  if (self->results_model) {
+    g_object_unref(self->results_model);
+    self->results_model = NULL;
+  }
+  if (self->heading_store) {
+    g_object_unref(self->heading_store);
+    self->heading_store = NULL;
+  }
+  if (self->outline_store) {
+    g_object_unref(self->outline_store);
+    self->outline_store = NULL;
+  }
+  if (self->heading_rows) {
+    g_array_free(self->heading_rows, TRUE);
+    self->heading_rows = NULL;
+  }
+  if (self->heading_row_of) {
+    g_array_free(self->heading_row_of, TRUE);
+    self->heading_row_of = NULL;
+  }
+  if (self->search_tagged) {
+    g_array_free(self->search_tagged, TRUE);
+    self->search_tagged = NULL;
+  }
 
   if (self->editor) {
     markyd_editor_free(self->editor);
@@ -1020,6 +2706,30 @@ static gboolean on_key_press_event(GtkWidget *widget, GdkEventKey *event,
     return TRUE;
   }
 
+  if ((event->state & GDK_CONTROL_MASK) != 0 &&
+      (event->keyval == GDK_KEY_g || event->keyval == GDK_KEY_G)) {
+    show_heading_palette(self);
+    return TRUE;
+  }
+
+  if ((event->state & GDK_CONTROL_MASK) != 0 &&
+      event->keyval == GDK_KEY_bracketleft) {
+    markyd_editor_fold_to_level(self->editor, FOLD_ALL_LEVEL);
+    return TRUE;
+  }
+
+  if ((event->state & GDK_CONTROL_MASK) != 0 &&
+      event->keyval == GDK_KEY_bracketright) {
+    markyd_editor_unfold_all(self->editor);
+    return TRUE;
+  }
+
+  if (event->keyval == GDK_KEY_Escape && self->heading_popover &&
+      gtk_widget_get_visible(self->heading_popover)) {
+    gtk_popover_popdown(GTK_POPOVER(self->heading_popover));
+    return TRUE;
+  }
+
   if (event->keyval == GDK_KEY_Escape &&
       self->search_revealer &&
       gtk_revealer_get_reveal_child(GTK_REVEALER(self->search_revealer))) {
@@ -5,6 +5,7 @@
 
 typedef struct _MarkydApp MarkydApp;
 typedef struct _MarkydEditor MarkydEditor;
+typedef struct _MarkydRowModel MarkydRowModel;
 
 typedef struct _MarkydWindow {
   GtkWidget *window;
@@ -12,17 +13,57 @@ typedef struct _MarkydWindow {
   GtkWidget *btn_open;
   GtkWidget *btn_refresh;
   GtkWidget *btn_settings;
+  GtkWidget *btn_outline;
+  /* Shown while the document is rendered with cheaper output. */
+  GtkWidget *btn_render_fully;
   GtkWidget *search_revealer;
   GtkWidget *search_entry;
   GtkWidget *btn_search_prev;
   GtkWidget *btn_search_next;
+  GtkWidget *btn_search_regex;
+  GtkWidget *btn_search_case;
+  GtkWidget *btn_search_word;
   GtkWidget *lbl_search_status;
+  GtkWidget *btn_search_results;
+  GtkWidget *paned;
+  GtkWidget *results_scroll;
+  GtkWidget *results_view;
+  MarkydRowModel *results_model; /* One row per search match. */
+  GtkWidget *heading_popover;
+  GtkWidget *heading_entry;
+  GtkWidget *heading_view;
+  GtkListStore *heading_store;
+  /* Outline sidebar; built the first time it is shown. */
+  GtkWidget *outline_paned;
+  GtkWidget *outline_scroll;
+  GtkWidget *outline_view;
+  GtkListStore *outline_store;
+  gint outline_current;
+  /* Palette and outline rows (HeadingRow), headings in folds included. */
+  GArray *heading_rows;
+  /* Row of each render index heading. */
+  GArray *heading_row_of;
   GtkWidget *lbl_title;
   GtkWidget *scroll;
+  /* Strip beside the vertical scrollbar with one bin per pixel row. */
+  GtkWidget *match_markers;
+  GByteArray *marker_bins;
+  gboolean markers_dirty;
+  gdouble markers_upper;
   MarkydEditor *editor;
   MarkydApp *app;
   GArray *search_matches;
   gint search_current_index;
+  /* Query (casefolded unless matching case) that produced search_matches,
+   * for type-ahead refinement. */
+  gchar *search_last_query;
+  gboolean search_refine_valid;
+  /* Match spans currently carrying the match tag (near the viewport only). */
+  GArray *search_tagged;
+  gint search_current_tag_start;
+  gint search_current_tag_end;
+  /* In-flight regex scan (RegexSearchJob); freed by its completion idle. */
+  gpointer search_regex_job;
 } MarkydWindow;
 
 /* Lifecycle */
@@ -0,0 +1,295 @@
+/* Throughput of the code scanners: the hand-written C, Java and Python
+ * scanners, and the generic lexer against scan_line_c_like on the same C
+ * source. Keyword classification is also timed on its own, with the old
+ * linear strlen scan over the keyword groups next to the hash table. Run
+ * with `make bench`; an optional argument sets the corpus size in KB. */
+
+#include "code_highlight.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define BENCH_DEFAULT_KB 4096
+#define BENCH_ROUNDS 5
+
+static const gchar c_sample[] =
+    "#include <stdio.h>\n"
+    "/* Sum the squares of the first n integers. */\n"
+    "static unsigned long sum_squares(unsigned int n) {\n"
+    "  unsigned long total = 0;\n"
+    "  for (unsigned int i = 0; i < n; i++) {\n"
+    "    total += (unsigned long)i * i; // widen first\n"
+    "  }\n"
+    "  return total;\n"
+    "}\n"
+    "\n"
+    "int main(int argc, char **argv) {\n"
+    "  const char *name = argc > 1 ? argv[1] : \"world\";\n"
+    "  if (sum_squares(10) != 285UL) {\n"
+    "    return 1;\n"
+    "  }\n"
+    "  printf(\"hello, %s\\n\", name);\n"
+    "  return 0;\n"
+    "}\n";
+
+static const gchar java_sample[] =
+    "package org.example.bench;\n"
+    "\n"
+    "import java.util.ArrayList;\n"
+    "import java.util.List;\n"
+    "\n"
+    "/** Keeps a bounded list of recent names. */\n"
+    "public final class Recent {\n"
+    "  private static final int LIMIT = 16;\n"
+    "  private final List<String> names = new ArrayList<>();\n"
+    "\n"
+    "  @Override\n"
+    "  public String toString() {\n"
+    "    return \"Recent(\" + names.size() + \")\"; // debug only\n"
+    "  }\n"
+    "\n"
+    "  public synchronized void add(String name) throws IllegalStateException {\n"
+    "    if (name == null) {\n"
+    "      throw new IllegalStateException(\"null name\");\n"
+    "    }\n"
+    "    names.add(name);\n"
+    "    while (names.size() > LIMIT) {\n"
+    "      names.remove(0);\n"
+    "    }\n"
+    "  }\n"
+    "}\n";
+
+static const gchar python_sample[] =
+    "import os\n"
+    "from collections import defaultdict\n"
+    "\n"
+    "\n"
+    "class Index:\n"
+    "    \"\"\"Map file extensions to the paths using them.\"\"\"\n"
+    "\n"
+    "    def __init__(self, root):\n"
+    "        self.root = root\n"
+    "        self.by_ext = defaultdict(list)\n"
+    "\n"
+    "    def scan(self):\n"
+    "        for dirpath, _, files in os.walk(self.root):\n"
+    "            for name in files:\n"
+    "                ext = os.path.splitext(name)[1] or None  # no suffix\n"
+    "                if ext is not None and not name.startswith('.'):\n"
+    "                    self.by_ext[ext].append(os.path.join(dirpath, name))\n"
+    "        return len(self.by_ext)\n"
+    "\n"
+    "    async def close(self):\n"
+    "        return True\n";
+
+typedef struct {
+  const gchar *label;
+  const gchar *language;
+  const gchar *sample;
+} BenchCase;
+
+static const BenchCase cases[] = {
+    {"c (scan_line_c_like)", "c", c_sample},
+    {"cpp (generic lexer)", "cpp", c_sample},
+    {"java (scan_line_c_like)", "java", java_sample},
+    {"python", "python", python_sample},
+};
+
+/* Languages whose keyword lookup is compared; all use the hand-written
+ * scanners, which went from the linear scan to the table. */
+static const BenchCase keyword_cases[] = {
+    {"c", "c", c_sample},
+    {"java", "java", java_sample},
+    {"python", "python", python_sample},
+};
+
+static void count_token(gint start_offset, gint end_offset,
+                        const gchar *tag_name, gpointer user_data) {
+  (void)start_offset;
+  (void)end_offset;
+  (void)tag_name;
+  (*(guint64 *)user_data)++;
+}
+
+/* Repeat sample up to at least size bytes, split into NUL-terminated lines.
+ * out_len receives the corpus size before splitting. */
+static GPtrArray *build_corpus(const gchar *sample, gsize size,
+                               gchar **out_text, gsize *out_len) {
+  GString *text = g_string_sized_new(size + strlen(sample));
+  GPtrArray *lines = g_ptr_array_new();
+  gchar *line;
+
+  while (text->len < size) {
+    g_string_append(text, sample);
+  }
+  *out_len = text->len;
+  *out_text = g_string_free(text, FALSE);
+
+  line = *out_text;
+  while (*line) {
+    gchar *nl = strchr(line, '\n');
+    g_ptr_array_add(lines, line);
+    if (!nl) {
+      break;
+    }
+    *nl = '\0';
+    line = nl + 1;
+  }
+  return lines;
+}
+
+/* Best of BENCH_ROUNDS full passes, in usec. */
+static gint64 bench_scan(const MarkydLanguageHighlight *language,
+                         GPtrArray *lines, guint64 *out_tokens) {
+  gint64 best = G_MAXINT64;
+
+  for (guint round = 0; round < BENCH_ROUNDS; round++) {
+    MarkydCodeScanState state;
+    guint64 tokens = 0;
+    gint64 start = g_get_monotonic_time();
+    gint64 spent;
+
+    markyd_code_scan_state_reset(&state);
+    for (guint i = 0; i < lines->len; i++) {
+      markyd_code_scan_line(language, g_ptr_array_index(lines, i), &state,
+                            count_token, &tokens);
+    }
+    spent = g_get_monotonic_time() - start;
+    best = MIN(best, spent);
+    *out_tokens = tokens;
+  }
+  return MAX(best, 1);
+}
+
+/* The keyword lookup the scanners used before the hash table. */
+static const gchar *linear_keyword_tag(const MarkydLanguageHighlight *language,
+                                       const gchar *token, gsize token_len) {
+  for (gsize i = 0; i < language->group_count; i++) {
+    const MarkydKeywordGroup *group = &language->groups[i];
+    for (gsize k = 0; k < group->keyword_count; k++) {
+      const gchar *kw = group->keywords[k];
+      if (strlen(kw) == token_len && strncmp(kw, token, token_len) == 0) {
+        return group->tag_name;
+      }
+    }
+  }
+  return NULL;
+}
+
+typedef const gchar *(*KeywordLookupFunc)(
+    const MarkydLanguageHighlight *language, const gchar *token,
+    gsize token_len);
+
+/* Best of BENCH_ROUNDS passes classifying every identifier, in usec. */
+static gint64 bench_keywords(const MarkydLanguageHighlight *language,
+                             GPtrArray *lines, KeywordLookupFunc lookup,
+                             guint64 *out_keywords) {
+  gint64 best = G_MAXINT64;
+
+  for (guint round = 0; round < BENCH_ROUNDS; round++) {
+    guint64 keywords = 0;
+    gint64 start = g_get_monotonic_time();
+    gint64 spent;
+
+    for (guint i = 0; i < lines->len; i++) {
+      const gchar *p = g_ptr_array_index(lines, i);
+
+      while (*p) {
+        const gchar *word = p;
+
+        if (!g_ascii_isalpha(*p) && *p != '_') {
+          p++;
+          continue;
+        }
+        while (g_ascii_isalnum(*p) || *p == '_') {
+          p++;
+        }
+        if (lookup(language, word, (gsize)(p - word))) {
+          keywords++;
+        }
+      }
+    }
+    spent = g_get_monotonic_time() - start;
+    best = MIN(best, spent);
+    *out_keywords = keywords;
+  }
+  return MAX(best, 1);
+}
+
+static int run_keyword_bench(gsize size) {
+  printf("\n%-26s %14s %14s %8s\n", "keyword lookup", "linear lines/s",
+         "table lines/s", "speedup");
+  for (gsize i = 0; i < G_N_ELEMENTS(keyword_cases); i++) {
+    const MarkydLanguageHighlight *language =
+        markyd_code_lookup_language(keyword_cases[i].language);
+    gchar *text;
+    gsize len;
+    GPtrArray *lines;
+    gint64 linear_usec;
+    gint64 table_usec;
+    guint64 linear_keywords = 0;
+    guint64 table_keywords = 0;
+    gdouble linear_rate;
+    gdouble table_rate;
+
+    if (!language) {
+      fprintf(stderr, "unknown language: %s\n", keyword_cases[i].language);
+      return 1;
+    }
+    lines = build_corpus(keyword_cases[i].sample, size, &text, &len);
+    linear_usec =
+        bench_keywords(language, lines, linear_keyword_tag, &linear_keywords);
+    table_usec = bench_keywords(language, lines, markyd_code_keyword_tag,
+                                &table_keywords);
+    if (linear_keywords != table_keywords) {
+      fprintf(stderr,
+              "%s: linear scan found %" G_GUINT64_FORMAT
+              " keywords, table %" G_GUINT64_FORMAT "\n",
+              keyword_cases[i].label, linear_keywords, table_keywords);
+      return 1;
+    }
+    linear_rate = (gdouble)lines->len * G_USEC_PER_SEC / (gdouble)linear_usec;
+    table_rate = (gdouble)lines->len * G_USEC_PER_SEC / (gdouble)table_usec;
+    printf("%-26s %14.0f %14.0f %7.2fx\n", keyword_cases[i].label, linear_rate,
+           table_rate, table_rate / linear_rate);
+    g_ptr_array_free(lines, TRUE);
+    g_free(text);
+  }
+  return 0;
+}
+
+int main(int argc, char **argv) {
+  gsize size = (gsize)BENCH_DEFAULT_KB * 1024;
+
+  if (argc > 1) {
+    long kb = strtol(argv[1], NULL, 10);
+    if (kb <= 0) {
+      fprintf(stderr, "usage: %s [corpus-kb]\n", argv[0]);
+      return 2;
+    }
+    size = (gsize)kb * 1024;
+  }
+
+  printf("%-26s %10s %12s %10s\n", "scanner", "MB/s", "tokens", "ms");
+  for (gsize i = 0; i < G_N_ELEMENTS(cases); i++) {
+    const MarkydLanguageHighlight *language =
+        markyd_code_lookup_language(cases[i].language);
+    gchar *text;
+    gsize len;
+    GPtrArray *lines;
+    gint64 usec;
+    guint64 tokens = 0;
+
+    if (!language) {
+      fprintf(stderr, "unknown language: %s\n", cases[i].language);
+      return 1;
+    }
+    lines = build_corpus(cases[i].sample, size, &text, &len);
+    usec = bench_scan(language, lines, &tokens);
+    printf("%-26s %10.1f %12" G_GUINT64_FORMAT " %10.2f\n", cases[i].label,
+           (gdouble)len / (gdouble)usec, tokens, (gdouble)usec / 1000.0);
+    g_ptr_array_free(lines, TRUE);
+    g_free(text);
+  }
+  return run_keyword_bench(size);
+}